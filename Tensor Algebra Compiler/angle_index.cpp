@@ -0,0 +1,269 @@
+//
+//  angle_index.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+
+// One answer of AngleIndex::nearest: a table cell, its controls and how far its angles are
+// from the query's
+struct AngleNeighbour {
+    std::uint64_t cell = 0;
+    double distance = INFINITY;
+    double u2[4] = {};
+};
+
+/*
+ The reverse of a Table: from angles to the controls whose angles are nearest. The cells
+ are points in six dimensions, theta, alpha and beta as real then imaginary parts. The real
+ parts are phases on a circle of 2 pi and the imaginary parts lie on a line. Distance is
+ Euclidean, with each phase difference taken the short way round, as in the benchmarks'
+ angle_error.
+
+ The points go in a k-d tree, split at the median of the widest side of each box and
+ stored in tree order, so a leaf's points sit together in memory. A node is only its
+ split, 16 bytes, so the tree stays in cache; a query carries the box of the node it is in
+ down from the root's. It descends to the nearer child first and skips any box farther
+ away than its k-th best so far. The distance to a box wraps around the circle on the
+ phase axes, so the tree needs no copies of the points across the cut. Cells without
+ angles, or with infinite or NaN angles (u11 = u12 = 0 and u21 = u22 = 0), are left out.
+ */
+class AngleIndex {
+private:
+    static constexpr std::size_t leaf_size = 16;
+
+    // a node over points [begin, end) splits at their median middle = (begin + end) / 2:
+    // the left child, next in nodes, holds [begin, middle) at or below split along dim,
+    // the right child [middle, end) at or above it. Ranges of leaf_size or fewer are leaves.
+    struct Node {
+        double split;
+        std::uint32_t dim;
+        std::uint32_t right;
+    };
+
+    struct Box {
+        double lower[6];
+        double upper[6];
+    };
+
+    double grid_lower = 0;
+    double grid_step = 1;
+    std::size_t grid_count = 0;
+    std::vector<double> points;
+    std::vector<std::uint64_t> cells;
+    std::vector<Node> nodes;
+    Box bounds;
+
+    static bool periodic(int d) {
+        return d % 2 == 0;
+    }
+
+    // a phase in [-pi, pi]
+    static double wrap(double phase) {
+        return std::remainder(phase, 2 * M_PI);
+    }
+
+    static double squared_distance(double const* a, double const* b) {
+        double sum = 0;
+
+        for (int d = 0; d < 6; d++) {
+            double difference = std::abs(a[d] - b[d]);
+            if (periodic(d) && difference > M_PI) { difference = 2 * M_PI - difference; }
+            sum += difference * difference;
+        }
+
+        return sum;
+    }
+
+    // from q to the nearest point of box
+    static double squared_distance(double const* q, Box const& box) {
+        double sum = 0;
+
+        for (int d = 0; d < 6; d++) {
+            if (q[d] >= box.lower[d] && q[d] <= box.upper[d]) { continue; }
+
+            double to_lower = box.lower[d] - q[d], to_upper = q[d] - box.upper[d];
+
+            // on a phase axis, forward round the circle to lower or back to upper; all three
+            // lie in [-pi, pi], so one turn brings either gap into [0, 2 pi)
+            if (periodic(d)) {
+                if (to_lower < 0) { to_lower += 2 * M_PI; }
+                if (to_upper < 0) { to_upper += 2 * M_PI; }
+            }
+
+            double gap = periodic(d) ? std::min(to_lower, to_upper) : std::max(to_lower, to_upper);
+            sum += gap * gap;
+        }
+
+        return sum;
+    }
+
+    // the nodes over order[begin, end), which is left in tree order
+    void build(std::vector<std::size_t>& order, std::vector<double> const& source, std::size_t begin, std::size_t end) {
+        if (end - begin <= leaf_size) { return; }
+
+        double lower[6], upper[6];
+        std::fill(lower, lower + 6, INFINITY);
+        std::fill(upper, upper + 6, -INFINITY);
+
+        for (std::size_t i = begin; i < end; i++) {
+            for (int d = 0; d < 6; d++) {
+                lower[d] = std::min(lower[d], source[6 * order[i] + d]);
+                upper[d] = std::max(upper[d], source[6 * order[i] + d]);
+            }
+        }
+
+        int dim = 0;
+        for (int d = 1; d < 6; d++) {
+            if (upper[d] - lower[d] > upper[dim] - lower[dim]) { dim = d; }
+        }
+
+        std::size_t middle = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [&](std::size_t a, std::size_t b) {
+            return source[6 * a + dim] < source[6 * b + dim];
+        });
+
+        std::size_t position = nodes.size();
+        nodes.push_back({source[6 * order[middle] + dim], (std::uint32_t) dim, 0});
+        build(order, source, begin, middle);
+        nodes[position].right = (std::uint32_t) nodes.size();
+        build(order, source, middle, end);
+    }
+
+    // best holds the k nearest so far, nearest first, by squared distance
+    void search(std::size_t position, std::size_t begin, std::size_t end, Box const& box, double const* q, std::size_t k, AngleNeighbour* best) const {
+        if (end - begin <= leaf_size) {
+            for (std::size_t i = begin; i < end; i++) {
+                double distance = squared_distance(q, &points[6 * i]);
+                if (distance >= best[k - 1].distance) { continue; }
+
+                std::size_t j = k - 1;
+                for (; j > 0 && best[j - 1].distance > distance; j--) { best[j] = best[j - 1]; }
+                best[j].cell = i;
+                best[j].distance = distance;
+            }
+
+            return;
+        }
+
+        Node const& node = nodes[position];
+        std::size_t middle = begin + (end - begin) / 2;
+        Box left = box, right = box;
+        left.upper[node.dim] = node.split;
+        right.lower[node.dim] = node.split;
+
+        double to_left = squared_distance(q, left), to_right = squared_distance(q, right);
+
+        if (to_left <= to_right) {
+            if (to_left < best[k - 1].distance) { search(position + 1, begin, middle, left, q, k, best); }
+            if (to_right < best[k - 1].distance) { search(node.right, middle, end, right, q, k, best); }
+        } else {
+            if (to_right < best[k - 1].distance) { search(node.right, middle, end, right, q, k, best); }
+            if (to_left < best[k - 1].distance) { search(position + 1, begin, middle, left, q, k, best); }
+        }
+    }
+public:
+    // every cell of table that holds finite angles; table must not be lazy
+    AngleIndex(Table const& table) : grid_lower(table.get_lower()), grid_step(table.get_step()), grid_count(table.get_count()) {
+        const U2Angles* table_cells = table.get_u22angle();
+
+        if (table_cells == nullptr) {
+            TableError("an angle index needs every cell in memory, and this table is lazy");
+        }
+
+        std::size_t cell_count = grid_count * grid_count * grid_count * grid_count;
+        std::vector<double> source;
+        std::vector<std::uint64_t> source_cells;
+        std::fill(bounds.lower, bounds.lower + 6, INFINITY);
+        std::fill(bounds.upper, bounds.upper + 6, -INFINITY);
+
+        for (std::size_t c = 0; c < cell_count; c++) {
+            if (!table.has_angles(c)) { continue; }
+
+            U2Angles const& angles = table_cells[c];
+            double point[6] = {wrap(angles.theta.real()), angles.theta.imag(), wrap(angles.alpha.real()), angles.alpha.imag(), wrap(angles.beta.real()), angles.beta.imag()};
+            if (!std::all_of(point, point + 6, [](double x) { return std::isfinite(x); })) { continue; }
+
+            for (int d = 0; d < 6; d++) {
+                bounds.lower[d] = std::min(bounds.lower[d], point[d]);
+                bounds.upper[d] = std::max(bounds.upper[d], point[d]);
+            }
+
+            source.insert(source.end(), point, point + 6);
+            source_cells.push_back(c);
+        }
+
+        std::vector<std::size_t> order(source_cells.size());
+        std::iota(order.begin(), order.end(), 0);
+        build(order, source, 0, order.size());
+
+        points.resize(source.size());
+        cells.resize(order.size());
+
+        for (std::size_t i = 0; i < order.size(); i++) {
+            std::copy(&source[6 * order[i]], &source[6 * order[i]] + 6, &points[6 * i]);
+            cells[i] = source_cells[order[i]];
+        }
+    }
+
+    // the number of cells indexed
+    std::size_t size() const {
+        return cells.size();
+    }
+
+    std::size_t memory_bytes() const {
+        return points.size() * sizeof(double) + cells.size() * sizeof(std::uint64_t) + nodes.size() * sizeof(Node);
+    }
+
+    // the k cells whose angles are nearest angles, nearest first; k must be at most size()
+    std::vector<AngleNeighbour> nearest(U2Angles const& angles, std::size_t k) const {
+        std::vector<AngleNeighbour> result(k);
+        nearest(angles, k, result.data());
+        return result;
+    }
+
+    void nearest(U2Angles const& angles, std::size_t k, AngleNeighbour* out) const {
+        if (k == 0 || k > size()) {
+            TableError("the " + std::to_string(k) + " nearest of " + std::to_string(size()) + " indexed cells");
+        }
+
+        double q[6] = {wrap(angles.theta.real()), angles.theta.imag(), wrap(angles.alpha.real()), angles.alpha.imag(), wrap(angles.beta.real()), angles.beta.imag()};
+        std::fill(out, out + k, AngleNeighbour());
+        search(0, 0, size(), bounds, q, k, out);
+
+        for (std::size_t j = 0; j < k; j++) {
+            AngleNeighbour& neighbour = out[j];
+            neighbour.distance = std::sqrt(neighbour.distance);
+            neighbour.cell = cells[neighbour.cell];
+
+            std::uint64_t rest = neighbour.cell;
+            for (int d = 3; d >= 0; d--) {
+                neighbour.u2[d] = grid_lower + (rest % grid_count) * grid_step;
+                rest /= grid_count;
+            }
+        }
+    }
+
+    // out[i k] .. out[i k + k - 1] are the k nearest to (theta[i], alpha[i], beta[i]) for
+    // i < theta.size(); the queries are shared out over pool
+    void nearest(ComplexVector const& theta, ComplexVector const& alpha, ComplexVector const& beta, std::size_t k, AngleNeighbour* out, ThreadPool& pool=thread_pool()) const {
+        if (alpha.size() != theta.size() || beta.size() != theta.size()) {
+            TableError("queries of " + std::to_string(theta.size()) + ", " + std::to_string(alpha.size()) + " and " + std::to_string(beta.size()) + " angles");
+        }
+
+        constexpr std::size_t chunk = 256;
+        std::size_t n = theta.size();
+
+        pool.parallel_for((n + chunk - 1) / chunk, [&](std::size_t c) {
+            for (std::size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); i++) {
+                nearest({theta.get(i), alpha.get(i), beta.get(i)}, k, out + i * k);
+            }
+        });
+    }
+};
@@ -0,0 +1,213 @@
+//
+//  angle_kernels.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <cmath>
+#include <complex>
+#include <initializer_list>
+
+// re[k] + i im[k] = i log(x[k] + i y[k]) for k < n: re is minus the phase of x + i y, in
+// [-pi, pi], and im is ln |x + i y|. As from std::log, (0, 0) gives (NaN, -inf) and a NaN
+// gives NaN. x^2 + y^2 must not overflow or be subnormal.
+typedef void (*ILogKernel)(const double* x, const double* y, std::size_t n, double* re, double* im);
+
+void i_log_scalar(const double* x, const double* y, std::size_t n, double* re, double* im) {
+    using namespace std::complex_literals;
+
+    for (std::size_t k = 0; k < n; k++) {
+        std::complex<double> value = 1i * std::log(std::complex<double>(x[k], y[k]));
+        re[k] = value.real();
+        im[k] = value.imag();
+    }
+}
+
+/*
+ The derivatives of theta2, alpha2 and beta2 with respect to the controls. theta and
+ alpha depend on u11 and u12 only, beta on u21 and u22 only, so six complex columns hold
+ the whole Jacobian. With r = u11^2 + u12^2 and s = u21^2 + u22^2:
+
+    theta2 = i log(-(u11 - i u12) / (u11 + i u12))
+        d/du11 = -2 u12 / r                  d/du12 = 2 u11 / r
+    alpha2 = i log(-u12 - i u11)
+        d/du11 = (-u12 + i u11) / r          d/du12 = (u11 + i u12) / r
+    beta2 = i log(u22 + i u21)
+        d/du21 = (-u22 + i u21) / s          d/du22 = (u21 + i u22) / s
+
+ Like the angles, they are singular at r = 0 and s = 0. out holds the real then the
+ imaginary parts of d theta/du11, d theta/du12, d alpha/du11, d alpha/du12, d beta/du21
+ and d beta/du22 at (u2[0][k], .., u2[3][k]) for k < n.
+ */
+typedef void (*JacobianKernel)(const double* const u2[4], std::size_t n, double* const out[12]);
+
+inline void jacobian_point(double const u[4], double result[12]) {
+    double r = u[0] * u[0] + u[2] * u[2], s = u[1] * u[1] + u[3] * u[3];
+    double a = u[0] / r, b = u[2] / r, c = u[1] / s, d = u[3] / s;
+    double values[12] = {-2 * b, 0, 2 * a, 0, -b, a, a, b, -d, c, c, d};
+    for (int j = 0; j < 12; j++) { result[j] = values[j]; }
+}
+
+void jacobian_scalar(const double* const u2[4], std::size_t n, double* const out[12]) {
+    for (std::size_t k = 0; k < n; k++) {
+        double u[4] = {u2[0][k], u2[1][k], u2[2][k], u2[3][k]}, result[12];
+        jacobian_point(u, result);
+        for (int j = 0; j < 12; j++) { out[j][k] = result[j]; }
+    }
+}
+
+#if defined(__x86_64__)
+/*
+ atan2 and log on SIMD registers, with the operations of simd_ops.cpp. atan2 takes the
+ ratio of the smaller to the larger of |x| and |y|, reduces it about 1/2 or 1 as fdlibm's
+ atan does and evaluates fdlibm's polynomial, then moves the result to the octant of
+ (x, y). log splits off the exponent, keeps the mantissa in [sqrt(1/2), sqrt(2)) and sums
+ 2 atanh((m - 1) / (m + 1)) to twelve terms. Both stay within a few ulp.
+ */
+
+template <typename Ops>
+struct AngleMath {
+    typedef typename Ops::V V;
+
+    // atan(a) for a in [0, 1]
+    static void atan(V const& a, V& result) {
+        V one = Ops::set(1.0);
+        auto middle = Ops::less(Ops::set(0.4375), a);
+        auto upper = Ops::less(Ops::set(0.6875), a);
+
+        // atan(a) = atan(c) + atan(t), with c = 1/2 on (7/16, 11/16] and 1 above
+        V t = Ops::blend(a, Ops::div(Ops::sub(Ops::add(a, a), one), Ops::add(Ops::set(2.0), a)), middle);
+        t = Ops::blend(t, Ops::div(Ops::sub(a, one), Ops::add(a, one)), upper);
+        V hi = Ops::blend(Ops::set(0.0), Ops::set(4.63647609000806093515e-01), middle);
+        hi = Ops::blend(hi, Ops::set(7.85398163397448278999e-01), upper);
+        V lo = Ops::blend(Ops::set(0.0), Ops::set(2.26987774529616870924e-17), middle);
+        lo = Ops::blend(lo, Ops::set(3.06161699786838301793e-17), upper);
+
+        V z = Ops::mul(t, t), w = Ops::mul(z, z), odd, even;
+        polynomial<Ops>(w, { 3.33333333333329318027e-01, 1.42857142725034663711e-01, 9.09088713343650656196e-02,
+                        6.66107313738753120669e-02, 4.97687799461593236017e-02, 1.62858201153657823623e-02 }, odd);
+        polynomial<Ops>(w, { -1.99999999998764832476e-01, -1.11111104054623557880e-01, -7.69187620504482999495e-02,
+                        -5.83357013379057348645e-02, -3.65315727442169155270e-02 }, even);
+        V s = Ops::fma(z, odd, Ops::mul(w, even));
+
+        result = Ops::sub(hi, Ops::sub(Ops::sub(Ops::mul(t, s), lo), t));
+    }
+
+    static void atan2(V const& y, V const& x, V& result) {
+        V ax = Ops::abs(x), ay = Ops::abs(y), r;
+        atan(Ops::div(Ops::min(ax, ay), Ops::max(ax, ay)), r);
+
+        r = Ops::blend(r, Ops::add(Ops::sub(Ops::set(1.57079632679489655800e+00), r), Ops::set(6.12323399573676603587e-17)), Ops::less(ax, ay));
+        r = Ops::blend(r, Ops::add(Ops::sub(Ops::set(3.14159265358979311600e+00), r), Ops::set(1.22464679914735317720e-16)), Ops::less(x, Ops::set(0.0)));
+        result = Ops::copysign(r, y);
+    }
+
+    // ln(v) for positive normal v
+    static void log(V const& v, V& result) {
+        V e = Ops::exponent(v), m = Ops::mantissa(v);
+        auto high = Ops::less(Ops::set(M_SQRT2), m);
+        m = Ops::blend(m, Ops::mul(m, Ops::set(0.5)), high);
+        e = Ops::blend(e, Ops::add(e, Ops::set(1.0)), high);
+
+        V one = Ops::set(1.0);
+        V f = Ops::div(Ops::sub(m, one), Ops::add(m, one)), z = Ops::mul(f, f), p;
+        polynomial<Ops>(z, { 1.0 / 3, 1.0 / 5, 1.0 / 7, 1.0 / 9, 1.0 / 11, 1.0 / 13, 1.0 / 15, 1.0 / 17, 1.0 / 19, 1.0 / 21, 1.0 / 23 }, p);
+
+        // e ln 2 + 2 f + 2 f z p, with ln 2 in two parts so that e ln2_hi is exact
+        V two_f = Ops::add(f, f);
+        V r = Ops::fma(Ops::mul(two_f, z), p, Ops::mul(e, Ops::set(1.90821492927058770002e-10)));
+        result = Ops::fma(e, Ops::set(6.93147180369123816490e-01), Ops::add(r, two_f));
+    }
+
+    // re + i im = i log(x + i y), as the i log kernels
+    static void i_log(V const& x, V const& y, V& re, V& im) {
+        V phase, magnitude;
+        atan2(y, x, phase);
+        log(Ops::fma(x, x, Ops::mul(y, y)), magnitude);
+
+        V r = Ops::neg(phase), i = Ops::mul(Ops::set(0.5), magnitude);
+        auto zero = Ops::both(Ops::equal(x, Ops::set(0.0)), Ops::equal(y, Ops::set(0.0)));
+        r = Ops::blend(r, Ops::set(NAN), zero);
+        i = Ops::blend(i, Ops::set(-INFINITY), zero);
+        auto nan = Ops::unordered(x, y);
+        re = Ops::blend(r, Ops::set(NAN), nan);
+        im = Ops::blend(i, Ops::set(NAN), nan);
+    }
+
+    static void i_log(const double* x, const double* y, std::size_t n, double* re, double* im) {
+        constexpr std::size_t W = Ops::width;
+        std::size_t k = 0;
+
+        for (; k + W <= n; k += W) {
+            V r, i;
+            i_log(Ops::load(x + k), Ops::load(y + k), r, i);
+            Ops::store(re + k, r);
+            Ops::store(im + k, i);
+        }
+
+        i_log_scalar(x + k, y + k, n - k, re + k, im + k);
+    }
+
+    static void jacobian(const double* const u2[4], std::size_t n, double* const out[12]) {
+        constexpr std::size_t W = Ops::width;
+        std::size_t k = 0;
+
+        for (; k + W <= n; k += W) {
+            V u11 = Ops::load(u2[0] + k), u21 = Ops::load(u2[1] + k), u12 = Ops::load(u2[2] + k), u22 = Ops::load(u2[3] + k);
+            V one = Ops::set(1.0);
+            V r = Ops::div(one, Ops::fma(u11, u11, Ops::mul(u12, u12))), s = Ops::div(one, Ops::fma(u21, u21, Ops::mul(u22, u22)));
+            V a = Ops::mul(u11, r), b = Ops::mul(u12, r), c = Ops::mul(u21, s), d = Ops::mul(u22, s);
+
+            V values[12] = {Ops::mul(Ops::set(-2.0), b), Ops::set(0.0), Ops::add(a, a), Ops::set(0.0), Ops::neg(b), a, a, b, Ops::neg(d), c, c, d};
+            for (int j = 0; j < 12; j++) { Ops::store(out[j] + k, values[j]); }
+        }
+
+        double* const tail[12] = {out[0] + k, out[1] + k, out[2] + k, out[3] + k, out[4] + k, out[5] + k,
+                                  out[6] + k, out[7] + k, out[8] + k, out[9] + k, out[10] + k, out[11] + k};
+        const double* const rest[4] = {u2[0] + k, u2[1] + k, u2[2] + k, u2[3] + k};
+        jacobian_scalar(rest, n - k, tail);
+    }
+};
+
+__attribute__((target("avx2,fma"), flatten))
+void i_log_avx2(const double* x, const double* y, std::size_t n, double* re, double* im) {
+    AngleMath<Avx2Ops>::i_log(x, y, n, re, im);
+}
+
+__attribute__((target("avx512f"), flatten))
+void i_log_avx512(const double* x, const double* y, std::size_t n, double* re, double* im) {
+    AngleMath<Avx512Ops>::i_log(x, y, n, re, im);
+}
+
+__attribute__((target("avx2,fma"), flatten))
+void jacobian_avx2(const double* const u2[4], std::size_t n, double* const out[12]) {
+    AngleMath<Avx2Ops>::jacobian(u2, n, out);
+}
+
+__attribute__((target("avx512f"), flatten))
+void jacobian_avx512(const double* const u2[4], std::size_t n, double* const out[12]) {
+    AngleMath<Avx512Ops>::jacobian(u2, n, out);
+}
+
+#endif
+
+// the i log kernel for isa, which must be supported
+ILogKernel i_log_kernel(ComplexIsa isa) {
+#if defined(__x86_64__)
+    if (isa == ComplexIsa::AVX512) { return i_log_avx512; }
+    if (isa == ComplexIsa::AVX2) { return i_log_avx2; }
+#endif
+
+    return i_log_scalar;
+}
+
+// the Jacobian kernel for isa, which must be supported
+JacobianKernel jacobian_kernel(ComplexIsa isa) {
+#if defined(__x86_64__)
+    if (isa == ComplexIsa::AVX512) { return jacobian_avx512; }
+    if (isa == ComplexIsa::AVX2) { return jacobian_avx2; }
+#endif
+
+    return jacobian_scalar;
+}
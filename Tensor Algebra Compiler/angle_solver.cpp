@@ -0,0 +1,208 @@
+//
+//  angle_solver.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <cmath>
+#include <complex>
+
+/*
+ The angles of a target U2 solved directly, with no table. With e_x = exp(-i x) the U2 of
+ (theta, alpha, beta) is bilinear in the exponentials (see u2_from_exponentials), and
+ combining its entries undoes it:
+
+    e_alpha = -u00 - i u01    e_alpha e_theta = u00 - i u01    e_beta = u11 - i u10
+
+ That closed form reads e_theta from the first row alone. Each Gauss-Newton step then fits
+ (e_theta, e_alpha, e_beta) to all four entries in the least-squares sense. The normal
+ equations are 3 x 3, with no e_alpha e_beta term, so they solve in closed form as well:
+ with t, a, b the exponentials, g the gradient and T = |t|^2,
+
+    dt = 2 ((T + 1) g_t - t (a* g_a + b* g_b)) / (|a|^2 + |b|^2)
+    da = (2 g_a - a t* dt) / (T + 1)        db = (2 g_b - b t* dt) / (T + 1)
+
+ On a target that is exactly a U2 the fit changes nothing beyond rounding. On one that is
+ not, the model being bilinear in (t, a) and (t, b), each step only moves closer to the
+ least-squares fit; iterations sets how many are taken. The angles are then i log of the
+ exponentials, whose real parts lie in [-pi, pi]. out holds the real then the imaginary
+ parts of theta, alpha and beta for targets[k], k < n. A target whose u00 + i u01 is zero
+ has no angles and gives NaN or infinities.
+ */
+typedef void (*SolverKernel)(const Mat2c* targets, std::size_t n, int iterations, double* const out[6]);
+
+inline void solve_point(Mat2c const& target, int iterations, double result[6]) {
+    using namespace std::complex_literals;
+
+    std::complex<double> u00 = target(0, 0), u01 = target(0, 1), u10 = target(1, 0), u11 = target(1, 1);
+    std::complex<double> a = -u00 - 1i * u01, t = (u00 - 1i * u01) / a, b = u11 - 1i * u10;
+
+    for (int i = 0; i < iterations; i++) {
+        std::complex<double> m = 0.5 * (t - 1.0), p = 0.5 * (t + 1.0);
+        std::complex<double> r0 = u00 - a * m, r1 = u01 - 1i * a * p, r2 = u10 - 1i * b * p, r3 = u11 + b * m;
+
+        std::complex<double> g_t = 0.5 * (std::conj(a) * (r0 - 1i * r1) + std::conj(b) * (-1i * r2 - r3));
+        std::complex<double> g_a = std::conj(m) * r0 - 1i * std::conj(p) * r1;
+        std::complex<double> g_b = -1i * std::conj(p) * r2 - std::conj(m) * r3;
+
+        double T = std::norm(t);
+        std::complex<double> dt = 2.0 * ((T + 1) * g_t - t * (std::conj(a) * g_a + std::conj(b) * g_b)) / (std::norm(a) + std::norm(b));
+        a += (2.0 * g_a - a * std::conj(t) * dt) / (T + 1);
+        b += (2.0 * g_b - b * std::conj(t) * dt) / (T + 1);
+        t += dt;
+    }
+
+    std::complex<double> angles[3] = {1i * std::log(t), 1i * std::log(a), 1i * std::log(b)};
+
+    for (int j = 0; j < 3; j++) {
+        result[2 * j] = angles[j].real();
+        result[2 * j + 1] = angles[j].imag();
+    }
+}
+
+void solve_scalar(const Mat2c* targets, std::size_t n, int iterations, double* const out[6]) {
+    for (std::size_t k = 0; k < n; k++) {
+        double result[6];
+        solve_point(targets[k], iterations, result);
+        for (int j = 0; j < 6; j++) { out[j][k] = result[j]; }
+    }
+}
+
+#if defined(__x86_64__)
+// The same steps on split complex numbers, ending in AngleMath's i log
+
+template <typename Ops>
+struct SolverMath {
+    typedef typename Ops::V V;
+
+    // r + i i = (ar + i ai) (br + i bi)
+    static void product(V const& ar, V const& ai, V const& br, V const& bi, V& r, V& i) {
+        r = Ops::fnma(ai, bi, Ops::mul(ar, br));
+        i = Ops::fma(ai, br, Ops::mul(ar, bi));
+    }
+
+    // r + i i = (ar - i ai) (br + i bi)
+    static void conj_product(V const& ar, V const& ai, V const& br, V const& bi, V& r, V& i) {
+        r = Ops::fma(ai, bi, Ops::mul(ar, br));
+        i = Ops::fnma(ai, br, Ops::mul(ar, bi));
+    }
+
+    static void solve(const Mat2c* targets, std::size_t n, int iterations, double* const out[6]) {
+        constexpr std::size_t W = Ops::width;
+        std::size_t k = 0;
+
+        for (; k + W <= n; k += W) {
+            double lanes[8][W];
+
+            for (std::size_t l = 0; l < W; l++) {
+                for (int e = 0; e < 4; e++) {
+                    lanes[e][l] = targets[k + l].re[e];
+                    lanes[4 + e][l] = targets[k + l].im[e];
+                }
+            }
+
+            V u00r = Ops::load(lanes[0]), u01r = Ops::load(lanes[1]), u10r = Ops::load(lanes[2]), u11r = Ops::load(lanes[3]);
+            V u00i = Ops::load(lanes[4]), u01i = Ops::load(lanes[5]), u10i = Ops::load(lanes[6]), u11i = Ops::load(lanes[7]);
+            V one = Ops::set(1.0), half = Ops::set(0.5), two = Ops::set(2.0);
+
+            // a = -u00 - i u01, b = u11 - i u10, t = (u00 - i u01) / a
+            V ar = Ops::sub(u01i, u00r), ai = Ops::neg(Ops::add(u00i, u01r));
+            V br = Ops::add(u11r, u10i), bi = Ops::sub(u11i, u10r);
+            V tr, ti;
+            conj_product(ar, ai, Ops::add(u00r, u01i), Ops::sub(u00i, u01r), tr, ti);
+            V scale = Ops::div(one, Ops::fma(ar, ar, Ops::mul(ai, ai)));
+            tr = Ops::mul(tr, scale);
+            ti = Ops::mul(ti, scale);
+
+            for (int it = 0; it < iterations; it++) {
+                V mr = Ops::mul(half, Ops::sub(tr, one)), mi = Ops::mul(half, ti), pr = Ops::mul(half, Ops::add(tr, one));
+                V xr, xi, yr, yi;
+
+                // the residuals r0 = u00 - a m, r1 = u01 - i a p, r2 = u10 - i b p, r3 = u11 + b m
+                product(ar, ai, mr, mi, xr, xi);
+                V r0r = Ops::sub(u00r, xr), r0i = Ops::sub(u00i, xi);
+                product(ar, ai, pr, mi, xr, xi);
+                V r1r = Ops::add(u01r, xi), r1i = Ops::sub(u01i, xr);
+                product(br, bi, pr, mi, xr, xi);
+                V r2r = Ops::add(u10r, xi), r2i = Ops::sub(u10i, xr);
+                product(br, bi, mr, mi, xr, xi);
+                V r3r = Ops::add(u11r, xr), r3i = Ops::add(u11i, xi);
+
+                // g_t = (a* (r0 - i r1) + b* (-i r2 - r3)) / 2, g_a = m* r0 + p* (-i r1), g_b = p* (-i r2) - m* r3
+                V gtr, gti, gar, gai, gbr, gbi;
+                conj_product(ar, ai, Ops::add(r0r, r1i), Ops::sub(r0i, r1r), gtr, gti);
+                conj_product(br, bi, Ops::sub(r2i, r3r), Ops::neg(Ops::add(r2r, r3i)), yr, yi);
+                gtr = Ops::mul(half, Ops::add(gtr, yr));
+                gti = Ops::mul(half, Ops::add(gti, yi));
+                conj_product(mr, mi, r0r, r0i, gar, gai);
+                conj_product(pr, mi, r1i, Ops::neg(r1r), yr, yi);
+                gar = Ops::add(gar, yr);
+                gai = Ops::add(gai, yi);
+                conj_product(pr, mi, r2i, Ops::neg(r2r), gbr, gbi);
+                conj_product(mr, mi, r3r, r3i, yr, yi);
+                gbr = Ops::sub(gbr, yr);
+                gbi = Ops::sub(gbi, yi);
+
+                // h = a* g_a + b* g_b, then dt, and t* dt for da and db
+                V hr, hi;
+                conj_product(ar, ai, gar, gai, hr, hi);
+                conj_product(br, bi, gbr, gbi, yr, yi);
+                hr = Ops::add(hr, yr);
+                hi = Ops::add(hi, yi);
+
+                V T1 = Ops::fma(tr, tr, Ops::fma(ti, ti, one));
+                V f = Ops::div(two, Ops::fma(ar, ar, Ops::fma(ai, ai, Ops::fma(br, br, Ops::mul(bi, bi)))));
+                product(tr, ti, hr, hi, yr, yi);
+                V dtr = Ops::mul(f, Ops::sub(Ops::mul(T1, gtr), yr)), dti = Ops::mul(f, Ops::sub(Ops::mul(T1, gti), yi));
+
+                V cr, ci, inverse = Ops::div(one, T1);
+                conj_product(tr, ti, dtr, dti, cr, ci);
+                product(ar, ai, cr, ci, xr, xi);
+                product(br, bi, cr, ci, yr, yi);
+                ar = Ops::add(ar, Ops::mul(inverse, Ops::sub(Ops::add(gar, gar), xr)));
+                ai = Ops::add(ai, Ops::mul(inverse, Ops::sub(Ops::add(gai, gai), xi)));
+                br = Ops::add(br, Ops::mul(inverse, Ops::sub(Ops::add(gbr, gbr), yr)));
+                bi = Ops::add(bi, Ops::mul(inverse, Ops::sub(Ops::add(gbi, gbi), yi)));
+                tr = Ops::add(tr, dtr);
+                ti = Ops::add(ti, dti);
+            }
+
+            V re, im;
+            AngleMath<Ops>::i_log(tr, ti, re, im);
+            Ops::store(out[0] + k, re);
+            Ops::store(out[1] + k, im);
+            AngleMath<Ops>::i_log(ar, ai, re, im);
+            Ops::store(out[2] + k, re);
+            Ops::store(out[3] + k, im);
+            AngleMath<Ops>::i_log(br, bi, re, im);
+            Ops::store(out[4] + k, re);
+            Ops::store(out[5] + k, im);
+        }
+
+        double* const tail[6] = {out[0] + k, out[1] + k, out[2] + k, out[3] + k, out[4] + k, out[5] + k};
+        solve_scalar(targets + k, n - k, iterations, tail);
+    }
+};
+
+__attribute__((target("avx2,fma"), flatten))
+void solve_avx2(const Mat2c* targets, std::size_t n, int iterations, double* const out[6]) {
+    SolverMath<Avx2Ops>::solve(targets, n, iterations, out);
+}
+
+__attribute__((target("avx512f"), flatten))
+void solve_avx512(const Mat2c* targets, std::size_t n, int iterations, double* const out[6]) {
+    SolverMath<Avx512Ops>::solve(targets, n, iterations, out);
+}
+
+#endif
+
+// the solver kernel for isa, which must be supported
+SolverKernel solver_kernel(ComplexIsa isa) {
+#if defined(__x86_64__)
+    if (isa == ComplexIsa::AVX512) { return solve_avx512; }
+    if (isa == ComplexIsa::AVX2) { return solve_avx2; }
+#endif
+
+    return solve_scalar;
+}
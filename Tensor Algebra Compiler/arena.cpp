@@ -0,0 +1,92 @@
+//
+//  arena.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <vector>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <utility>
+#include <type_traits>
+
+// Bump allocator for everything that lives as long as one compilation. Objects are handed
+// out as plain pointers and are destroyed and freed together when the arena goes away.
+class Arena {
+private:
+    static constexpr std::size_t block_size = 64 * 1024;
+
+    struct Destructor {
+        void (*destroy)(void*);
+        void* object;
+    };
+
+    std::vector<std::unique_ptr<char[]>> blocks;
+    std::vector<Destructor> destructors;
+    char* cursor;
+    std::size_t remaining;
+    std::size_t used;
+public:
+    Arena() {
+        cursor = nullptr;
+        remaining = 0;
+        used = 0;
+    }
+
+    Arena(Arena const&) = delete;
+
+    Arena& operator=(Arena const&) = delete;
+
+    ~Arena() {
+        release();
+    }
+
+    void* allocate(std::size_t size, std::size_t align) {
+        std::size_t padding = (align - (std::size_t) cursor % align) % align;
+
+        if (cursor == nullptr || padding + size > remaining) {
+            std::size_t n = std::max(block_size, size + align);
+            blocks.push_back(std::unique_ptr<char[]>(new char[n]));
+            cursor = blocks.back().get();
+            remaining = n;
+            padding = (align - (std::size_t) cursor % align) % align;
+        }
+
+        void* p = cursor + padding;
+        cursor += padding + size;
+        remaining -= padding + size;
+        used += size;
+
+        return p;
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+
+        if (!std::is_trivially_destructible<T>::value) {
+            destructors.push_back({ [](void* p) { static_cast<T*>(p)->~T(); }, object });
+        }
+
+        return object;
+    }
+
+    std::size_t bytes_used() {
+        return used;
+    }
+
+    // Runs every destructor (newest first) and frees all blocks at once
+    void release() {
+        for (auto it = destructors.rbegin(); it != destructors.rend(); it++) {
+            it->destroy(it->object);
+        }
+
+        destructors.clear();
+        blocks.clear();
+        cursor = nullptr;
+        remaining = 0;
+        used = 0;
+    }
+};
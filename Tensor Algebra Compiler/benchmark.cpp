@@ -0,0 +1,1133 @@
+//
+//  benchmark.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Stopwatch {
+private:
+    std::chrono::steady_clock::time_point start;
+public:
+    Stopwatch() {
+        start = std::chrono::steady_clock::now();
+    }
+
+    double seconds() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+// Calls f until at least min_seconds have passed; returns seconds per call
+template <typename F>
+double time_per_call(F f, double min_seconds=0.5) {
+    f();
+
+    std::size_t calls = 0;
+    Stopwatch watch = Stopwatch();
+
+    do {
+        f();
+        calls++;
+    } while (watch.seconds() < min_seconds);
+
+    return watch.seconds() / calls;
+}
+
+void report(std::string name, double per_second, std::string unit) {
+    std::cout << std::left << std::setw(48) << name << std::right << std::setw(14) << std::fixed << std::setprecision(2) << per_second / 1e6 << " M" << unit << "/s" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+std::string max_error(double error, std::string kind="max error") {
+    std::ostringstream text;
+    text << kind << " " << std::setprecision(1) << error;
+    return text.str();
+}
+
+// One row per supported ISA: run(kernel) does count units of work with kernel =
+// kernel_of(isa), and the row reads "name isa suffix (error())", error() describing how far
+// the results that run left are off
+template <typename KernelOf, typename Run, typename Describe>
+void report_isas(std::string name, std::string suffix, double count, std::string unit, KernelOf kernel_of, Run run, Describe error) {
+    for (ComplexIsa isa : {ComplexIsa::SCALAR, ComplexIsa::AVX2, ComplexIsa::AVX512}) {
+        if (!complex_isa_supported(isa)) { continue; }
+
+        auto kernel = kernel_of(isa);
+        double seconds = time_per_call([&]() { run(kernel); });
+
+        report(name + " " + complex_kernels(isa).name + suffix + " (" + error() + ")", count / seconds, unit);
+    }
+}
+
+// VM throughput on compiled .ir programs
+void bench_vm(std::vector<std::string> const& paths) {
+    for (std::string const& path : paths) {
+        VM vm = VM();
+        vm.load_file(path);
+
+        // the examples are a handful of instructions, so whole-program runs are batched
+        std::size_t repeats = 1 + 100000 / (vm.program_size() + 1);
+        double seconds = time_per_call([&]() {
+            for (std::size_t i = 0; i < repeats; i++) {
+                vm.reset();
+                vm.run();
+            }
+        });
+
+        report(path + " (" + std::to_string(vm.program_size()) + " instr)", vm.program_size() * repeats / seconds, "instr");
+    }
+}
+
+// Native code for an elementwise expression over two n x n tensors, with and without fusion
+void bench_fusion(int n) {
+    char path[] = "/tmp/apollo-fusion-XXXXXX";
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        Error(-1, "Cannot create a temporary file");
+    }
+
+    close(fd);
+
+    std::string dims = "[" + std::to_string(n) + "][" + std::to_string(n) + "]";
+    std::ofstream(path) << "let float a = 1.5;\n"
+                        << "let float c = 4;\n"
+                        << "let tensor" << dims << " A = 0.5;\n"
+                        << "let tensor" << dims << " B = 2;\n"
+                        << "let tensor T = a * A + B / c - A * B + (A - B) * a;\n";
+
+    std::string source = path;
+    Arena arena;
+    Parser parser = Parser(source, arena);
+    ProgramNode* ast = parser.parse_compilation_unit();
+    unlink(path);
+
+    Optimizer(arena).optimize(ast);
+    ShapeInference shapes;
+    shapes.infer(ast);
+
+    for (bool fuse : { false, true }) {
+        NativeGenerator generator = NativeGenerator(ast, shapes, fuse);
+        NativeModule module = NativeModule(generator.generate_code());
+        std::vector<double> storage(module.get_storage_size());
+
+        double seconds = time_per_call([&]() {
+            module.run(storage.data());
+        });
+
+        std::string name = std::string(fuse ? "fused" : "unfused") + " " + dims + " (" + std::to_string(generator.get_kernel_count()) + " loop nests, "
+                         + std::to_string(module.get_storage_size() * sizeof(double) >> 20) + " MiB)";
+        report(name, (double) n * n / seconds, "elem");
+    }
+}
+
+// T = A * B + C on n x n literals with density nonzeros, stored dense and as CSR
+void bench_sparse(int n, double density) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::string literals[3];
+    std::size_t nnz = 0;
+
+    for (std::string& literal : literals) {
+        literal = "{";
+
+        for (int i = 0; i < n; i++) {
+            literal += i == 0 ? "{" : ", {";
+
+            for (int j = 0; j < n; j++) {
+                bool nonzero = uniform(random) < density;
+                nnz += nonzero;
+                literal += (j == 0 ? "" : ", ") + std::string(nonzero ? "1.5" : "0");
+            }
+
+            literal += "}";
+        }
+
+        literal += "}";
+    }
+
+    for (std::string format : { "dense, dense", "dense, compressed" }) {
+        char path[] = "/tmp/apollo-sparse-XXXXXX";
+        int fd = mkstemp(path);
+
+        if (fd < 0) {
+            Error(-1, "Cannot create a temporary file");
+        }
+
+        close(fd);
+
+        std::ofstream(path) << "let tensor {" << format << "} A = " << literals[0] << ";\n"
+                            << "let tensor {" << format << "} B = " << literals[1] << ";\n"
+                            << "let tensor {" << format << "} C = " << literals[2] << ";\n"
+                            << "let tensor T = A * B + C;\n";
+
+        std::string source = path;
+        Arena arena;
+        Parser parser = Parser(source, arena);
+        ProgramNode* ast = parser.parse_compilation_unit();
+        unlink(path);
+
+        // as with -O0: the optimizer would fold T, its operands being literals
+        ShapeInference shapes;
+        shapes.infer(ast);
+
+        NativeGenerator generator = NativeGenerator(ast, shapes);
+        NativeModule module = NativeModule(generator.generate_code());
+        std::vector<double> storage(module.get_storage_size());
+
+        double seconds = time_per_call([&]() {
+            module.run(storage.data());
+        });
+
+        std::string name = "{" + format + "} [" + std::to_string(n) + "][" + std::to_string(n) + "] (" + std::to_string(nnz) + " nonzeros)";
+        report(name, (double) n * n / seconds, "elem");
+    }
+}
+
+// Chip::mvm on an n x n complex matrix: nested std::complex vectors, then every SoA kernel
+void bench_chip(int n) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::vector<std::vector<std::complex<double>>> m(n, std::vector<std::complex<double>>(n));
+    std::vector<std::complex<double>> v(n), res;
+
+    for (auto& row : m) {
+        for (auto& value : row) { value = { uniform(random), uniform(random) }; }
+    }
+
+    for (auto& value : v) { value = { uniform(random), uniform(random) }; }
+
+    Chip chip = Chip();
+    std::string size = "[" + std::to_string(n) + "][" + std::to_string(n) + "]";
+
+    double seconds = time_per_call([&]() {
+        chip.mvm(m, v, res);
+    });
+
+    report("mvm std::complex " + size, (double) n * n / seconds, "cmac");
+
+    ComplexMatrix soa_m = ComplexMatrix(m);
+    ComplexVector soa_v = ComplexVector(v), soa_res = ComplexVector(n);
+
+    report_isas("mvm", " " + size, (double) n * n, "cmac", [](ComplexIsa isa) { return &complex_kernels(isa); }, [&](ComplexKernels const* kernels) {
+        kernels->mvm(soa_m.real(), soa_m.imag(), n, n, soa_v.real(), soa_v.imag(), soa_res.real(), soa_res.imag());
+    }, [&]() {
+        double error = 0;
+        for (int i = 0; i < n; i++) { error = std::max(error, std::abs(soa_res.get(i) - res[i])); }
+        return max_error(error);
+    });
+}
+
+// U2 matrices from n random angle triples: one nested-vector matrix per call, as the
+// simulator built them, against the batched kernels writing Mat2c
+void bench_u2(int n) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> phase(0.0, 2 * M_PI), magnitude(-2.0, 2.0);
+    ComplexVector theta = ComplexVector(n), alpha = ComplexVector(n), beta = ComplexVector(n);
+
+    for (ComplexVector* angles : { &theta, &alpha, &beta }) {
+        for (int k = 0; k < n; k++) { angles->set(k, { phase(random), magnitude(random) }); }
+    }
+
+    Chip chip = Chip();
+    std::vector<std::vector<std::vector<std::complex<double>>>> nested(n);
+    std::vector<Mat2c> expected(n), out(n);
+
+    double seconds = time_per_call([&]() {
+        for (int k = 0; k < n; k++) { nested[k] = chip.get_u2({ theta.get(k), alpha.get(k), beta.get(k) }).to_vector(); }
+    });
+
+    report("u2 nested vectors [" + std::to_string(n) + "]", n / seconds, "mat");
+
+    u2_scalar(theta.real(), theta.imag(), alpha.real(), alpha.imag(), beta.real(), beta.imag(), n, expected.data());
+
+    report_isas("u2", " [" + std::to_string(n) + "]", n, "mat", u2_kernel, [&](U2Kernel kernel) {
+        kernel(theta.real(), theta.imag(), alpha.real(), alpha.imag(), beta.real(), beta.imag(), n, out.data());
+    }, [&]() {
+        // relative to each matrix's largest entry, which scales with exp of the imaginary parts
+        double error = 0;
+
+        for (int k = 0; k < n; k++) {
+            double scale = 1e-300, difference = 0;
+
+            for (int e = 0; e < 4; e++) {
+                scale = std::max(scale, std::abs(expected[k](e / 2, e % 2)));
+                difference = std::max(difference, std::abs(out[k](e / 2, e % 2) - expected[k](e / 2, e % 2)));
+            }
+
+            error = std::max(error, difference / scale);
+        }
+
+        return max_error(error, "max rel error");
+    });
+}
+
+// bytes the heap has handed out, to weigh a structure by the difference around building it
+std::size_t heap_in_use() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// the hash the u22angle table used when it was an unordered_map
+struct vd_hash {
+    size_t operator()(const std::vector<double>& v) const {
+        size_t seed = v.size();
+        for (auto &d : v) { seed ^= (size_t) d + 0x9e3779b9 + (seed << 6) + (seed >> 2); }
+        return seed;
+    }
+};
+
+// The u22angle table at step prec: its memory and random lookups, as the dense grid and
+// as the unordered_map<vector<double>, vector<complex<double>>> it replaced
+void bench_table(double prec) {
+    std::vector<std::vector<double>> keys;
+
+    // the map's keys are the exact doubles of the loops that built it
+    for (double i = 0; i < 2 * M_PI; i += prec) {
+        for (double j = 0; j < 2 * M_PI; j += prec) {
+            for (double k = 0; k < 2 * M_PI; k += prec) {
+                for (double l = 0; l < 2 * M_PI; l += prec) { keys.push_back({i, j, k, l}); }
+            }
+        }
+    }
+
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(1));
+
+    std::size_t before = heap_in_use();
+    Table table = Table();
+    table.init_u22angle(prec);
+    std::size_t grid_bytes = heap_in_use() - before;
+
+    before = heap_in_use();
+    std::unordered_map<std::vector<double>, std::vector<std::complex<double>>, vd_hash> map;
+
+    for (std::vector<double> const& u2 : keys) {
+        U2Angles const& angles = table.lookup(u2.data());
+        map.insert({u2, {angles.theta, angles.alpha, angles.beta}});
+    }
+
+    std::size_t map_bytes = heap_in_use() - before;
+
+    std::cout << table.size() << " cells: grid " << grid_bytes / 1024 << " KiB, unordered_map " << map_bytes / 1024 << " KiB ("
+              << std::setprecision(3) << (double) map_bytes / grid_bytes << "x)" << std::endl;
+
+    std::complex<double> sink = 0;
+
+    double seconds = time_per_call([&]() {
+        for (std::vector<double> const& u2 : keys) { sink += map.at(u2)[0]; }
+    });
+
+    report("lookup unordered_map", keys.size() / seconds, "lookup");
+
+    seconds = time_per_call([&]() {
+        for (std::vector<double> const& u2 : keys) { sink += table.lookup(u2.data()).theta; }
+    });
+
+    report("lookup grid", keys.size() / seconds, "lookup");
+
+    if (std::isnan(sink.real()) && sink.imag() == 1) { std::cout << sink << std::endl; }
+}
+
+// the distance between two angles, with real parts compared as phases
+double angle_error(std::complex<double> a, std::complex<double> b) {
+    double phase = std::remainder(a.real() - b.real(), 2 * M_PI);
+    return std::hypot(phase, a.imag() - b.imag());
+}
+
+// theta2, alpha2 and beta2 at every query
+std::vector<U2Angles> exact_angles(std::vector<double> const (&u2)[4]) {
+    std::vector<U2Angles> exact(u2[0].size());
+    for (std::size_t i = 0; i < exact.size(); i++) { exact[i] = Table::angles_of({u2[0][i], u2[1][i], u2[2][i], u2[3][i]}); }
+    return exact;
+}
+
+// The grid at step prec centred on 0, from about -pi to pi, loaded from a CSV written for
+// it. Zero lies halfway between grid lines, so no cell has a corner at the singular
+// u11 = u12 = 0 or u21 = u22 = 0, while the branch cuts of theta2, alpha2 and beta2, on
+// u12 = 0, u11 = 0 and u21 = 0, run through cells.
+Table branch_cut_table(double prec) {
+    int count = 2 * (int) std::ceil(M_PI / prec);
+    double lower = -(count - 1) * prec / 2;
+    char path[] = "/tmp/apollo-cut-XXXXXX";
+    int fd = mkstemp(path);
+
+    if (fd < 0) {
+        Error(-1, "Cannot create a temporary file");
+    }
+
+    close(fd);
+
+    {
+        std::ofstream out(path);
+        out << std::setprecision(17) << "u11,u21,u12,u22,theta(2),alpha(2),beta(2)\n";
+
+        for (int a = 0; a < count; a++) {
+            for (int b = 0; b < count; b++) {
+                for (int c = 0; c < count; c++) {
+                    for (int d = 0; d < count; d++) {
+                        std::vector<double> u2 = {lower + a * prec, lower + b * prec, lower + c * prec, lower + d * prec};
+                        U2Angles angles = Table::angles_of(u2);
+                        out << u2[0] << "," << u2[1] << "," << u2[2] << "," << u2[3] << ",\"" << angles.theta << "\",\"" << angles.alpha << "\",\"" << angles.beta << "\"\n";
+                    }
+                }
+            }
+        }
+    }
+
+    Table table = Table();
+    table.load(path);
+    unlink(path);
+
+    return table;
+}
+
+// Interpolated u22angle lookups at n random u2 off the grid at step prec: the error of
+// nearest-point and interpolated angles against theta2, alpha2 and beta2, and the rate of
+// each interpolation kernel. The errors are also measured on a grid across the branch
+// cuts, where unwrapping matters.
+void bench_interpolate(double prec, int n) {
+    Table table = Table();
+    table.init_u22angle(prec);
+
+    // away from the first grid line, where theta2 and alpha2 are singular at u11 = u12 = 0
+    double low = table.get_lower() + table.get_step(), high = table.get_lower() + (table.get_count() - 1) * table.get_step();
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> uniform(low, high);
+    std::vector<double> u2[4];
+
+    for (std::vector<double>& coordinate : u2) {
+        coordinate.resize(n);
+        for (double& u : coordinate) { u = uniform(random); }
+    }
+
+    std::vector<U2Angles> exact = exact_angles(u2);
+    const char* names[3] = {"theta", "alpha", "beta"};
+
+    auto errors = [&](std::vector<double> const (&points)[4], std::vector<U2Angles> const& truth, std::string name, auto angles_at) {
+        double max[3] = {}, sum[3] = {};
+
+        for (int i = 0; i < n; i++) {
+            double u[4] = {points[0][i], points[1][i], points[2][i], points[3][i]};
+            U2Angles angles = angles_at(u);
+            std::complex<double> got[3] = {angles.theta, angles.alpha, angles.beta}, want[3] = {truth[i].theta, truth[i].alpha, truth[i].beta};
+
+            for (int a = 0; a < 3; a++) {
+                double error = angle_error(got[a], want[a]);
+                max[a] = std::max(max[a], error);
+                sum[a] += error;
+            }
+        }
+
+        std::cout << "  " << std::left << std::setw(20) << name << std::right;
+        for (int a = 0; a < 3; a++) { std::cout << "  " << names[a] << " " << std::setprecision(2) << max[a] << " / " << sum[a] / n; }
+        std::cout << std::endl;
+    };
+
+    std::cout << "step " << table.get_step() << ", " << table.get_count() << "^4 cells; error against theta2, alpha2, beta2 (max / mean):" << std::endl;
+
+    errors(u2, exact, "nearest point", [&](double const* u) { return table.lookup(u); });
+    errors(u2, exact, "interpolated", [&](double const* u) { return table.interpolate(u); });
+    errors(u2, exact, "interpolated, unwrap", [&](double const* u) { return table.interpolate(u, true); });
+
+    Table fine = Table();
+    fine.init_u22angle(prec / 4);
+    errors(u2, exact, "nearest, step / 4", [&](double const* u) { return fine.lookup(u); });
+
+    // the same on the grid across the cuts, at least two steps from either singular plane,
+    // where the angles change too fast for any grid
+    Table cut = branch_cut_table(prec);
+    double cut_low = cut.get_lower(), cut_high = cut.get_lower() + (cut.get_count() - 1) * cut.get_step();
+    std::uniform_real_distribution<double> across(cut_low, cut_high);
+    std::vector<double> cut_u2[4];
+
+    for (std::vector<double>& coordinate : cut_u2) { coordinate.resize(n); }
+
+    for (int i = 0; i < n; i++) {
+        double u[4];
+
+        do {
+            for (double& x : u) { x = across(random); }
+        } while (std::hypot(u[0], u[2]) < 2 * prec || std::hypot(u[1], u[3]) < 2 * prec);
+
+        for (int d = 0; d < 4; d++) { cut_u2[d][i] = u[d]; }
+    }
+
+    std::vector<U2Angles> cut_exact = exact_angles(cut_u2);
+
+    std::cout << std::setprecision(6) << "step " << cut.get_step() << " from " << cut_low << " to " << cut_high << ", across the branch cuts (max / mean):" << std::endl;
+
+    errors(cut_u2, cut_exact, "interpolated", [&](double const* u) { return cut.interpolate(u); });
+    errors(cut_u2, cut_exact, "interpolated, unwrap", [&](double const* u) { return cut.interpolate(u, true); });
+
+    const double* const queries[4] = {u2[0].data(), u2[1].data(), u2[2].data(), u2[3].data()};
+    ComplexVector theta = ComplexVector(n), alpha = ComplexVector(n), beta = ComplexVector(n);
+    double* const out[6] = {theta.real(), theta.imag(), alpha.real(), alpha.imag(), beta.real(), beta.imag()};
+    AngleGrid grid = table.grid();
+
+    for (bool unwrap : {false, true}) {
+        std::string suffix = std::string(unwrap ? " unwrap" : "") + " [" + std::to_string(n) + "]";
+
+        report_isas("interpolate", suffix, n, "lookup", interpolation_kernel, [&](InterpolationKernel kernel) {
+            kernel(grid, queries, n, unwrap, out);
+        }, [&]() {
+            double error = 0;
+
+            for (int i = 0; i < n; i++) {
+                double u[4] = {u2[0][i], u2[1][i], u2[2][i], u2[3][i]};
+                U2Angles angles = table.interpolate(u, unwrap);
+                error = std::max({error, std::abs(theta.get(i) - angles.theta), std::abs(alpha.get(i) - angles.alpha), std::abs(beta.get(i) - angles.beta)});
+            }
+
+            return max_error(error);
+        });
+    }
+}
+
+void report_time(std::string name, double seconds) {
+    std::cout << std::left << std::setw(48) << name << std::right << std::setw(14) << std::fixed << std::setprecision(3) << seconds * 1e3 << " ms" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+// Time to load the u22angle table at csv_path: parsing the CSV against mapping the table
+// files converted from it, alone and followed by a pass over every cell
+void bench_table_load(std::string csv_path) {
+    Table table = Table();
+    table.load(csv_path);
+
+    char path_template[] = "/tmp/apollo-table-XXXXXX";
+    int fd = mkstemp(path_template);
+    if (fd < 0) { Error(-1, "Cannot create a temporary file"); }
+    close(fd);
+
+    std::string path = path_template;
+    std::cout << csv_path << ": " << table.size() << " cells" << std::endl;
+
+    report_time("read csv", time_per_call([&]() {
+        Table csv = Table();
+        csv.load(csv_path);
+    }));
+
+    for (TableDtype dtype : {TableDtype::FLOAT64, TableDtype::FLOAT32}) {
+        std::string name = dtype == TableDtype::FLOAT64 ? "float64" : "float32";
+        table.write_table(path, dtype);
+
+        struct stat st;
+        stat(path.c_str(), &st);
+        std::cout << name << " table file: " << st.st_size / 1024 << " KiB" << std::endl;
+
+        report_time("load " + name, time_per_call([&]() {
+            Table mapped = Table();
+            mapped.load(path);
+        }));
+
+        double sink = 0;
+
+        report_time("load " + name + " and read every cell", time_per_call([&]() {
+            Table mapped = Table();
+            mapped.load(path);
+            const U2Angles* cells = mapped.get_u22angle();
+            std::size_t n = mapped.get_count();
+            for (std::size_t i = 0; i < n * n * n * n; i++) { sink += cells[i].beta.imag(); }
+        }));
+
+        if (sink == 1) { std::cout << sink << std::endl; }
+    }
+
+    unlink(path.c_str());
+}
+
+// Generating the u22angle table at step prec: the i log kernels on their own, then the
+// per-point loop init_u22angle used to be against the kernels on pools of 1 up to threads
+// threads, with the largest difference from the per-point angles
+void bench_table_init(double prec, std::size_t threads) {
+    std::size_t n = 1 << 16;
+    std::mt19937 generator(1);
+    std::uniform_real_distribution<double> coordinate(-2 * M_PI, 2 * M_PI);
+    std::vector<double> x(n), y(n), want_re(n), want_im(n), re(n), im(n);
+    for (std::size_t i = 0; i < n; i++) { x[i] = coordinate(generator); y[i] = coordinate(generator); }
+    i_log_scalar(x.data(), y.data(), n, want_re.data(), want_im.data());
+
+    report_isas("i log", " [" + std::to_string(n) + "]", n, "point", i_log_kernel, [&](ILogKernel kernel) {
+        kernel(x.data(), y.data(), n, re.data(), im.data());
+    }, [&]() {
+        double error = 0;
+        for (std::size_t i = 0; i < n; i++) { error = std::max(error, angle_error({re[i], im[i]}, {want_re[i], want_im[i]})); }
+        return max_error(error);
+    });
+
+    Table table = Table();
+    table.init_u22angle(prec);
+    std::size_t count = table.get_count(), cells = table.size();
+    std::cout << cells << " cells at step " << prec << std::endl;
+
+    double seconds = time_per_call([&]() {
+        std::vector<U2Angles> out(cells);
+
+        for (std::size_t index = 0; index < cells; index++) {
+            std::vector<double> u2 = {prec * (index / (count * count * count)), prec * (index / (count * count) % count), prec * (index / count % count), prec * (index % count)};
+            out[index] = Table::angles_of(u2);
+        }
+    });
+
+    report("per-point angles_of", cells / seconds, "cell");
+    double one_thread = 0;
+
+    for (std::size_t t = 1; t <= threads; t = t < threads && 2 * t > threads ? threads : 2 * t) {
+        ThreadPool pool(t);
+        seconds = time_per_call([&]() {
+            Table generated = Table();
+            generated.init_u22angle(prec, pool);
+        });
+
+        if (t == 1) { one_thread = seconds; }
+
+        std::ostringstream name;
+        name << "init_u22angle, " << t << " thread" << (t == 1 ? "" : "s") << " (" << std::setprecision(2) << one_thread / seconds << "x)";
+        report(name.str(), cells / seconds, "cell");
+    }
+
+    // the singular cells, u11 = u12 = 0 or u21 = u22 = 0, must agree in where they are not finite
+    double error = 0;
+    std::size_t mismatched = 0;
+    const U2Angles* generated = table.get_u22angle();
+
+    for (std::size_t index = 0; index < cells; index++) {
+        std::vector<double> u2 = {prec * (index / (count * count * count)), prec * (index / (count * count) % count), prec * (index / count % count), prec * (index % count)};
+        U2Angles want = Table::angles_of(u2);
+        std::complex<double> got[3] = {generated[index].theta, generated[index].alpha, generated[index].beta};
+        std::complex<double> expected[3] = {want.theta, want.alpha, want.beta};
+
+        for (int a = 0; a < 3; a++) {
+            bool finite = std::isfinite(expected[a].real()) && std::isfinite(expected[a].imag());
+
+            if (finite != (std::isfinite(got[a].real()) && std::isfinite(got[a].imag()))) {
+                mismatched++;
+            } else if (finite) {
+                error = std::max(error, angle_error(got[a], expected[a]));
+            }
+        }
+    }
+
+    std::cout << "max difference from angles_of " << std::setprecision(2) << error << ", " << mismatched << " singular angles mismatched" << std::endl;
+}
+
+// A lazy table at step prec under a workload that touches few of its cells: random
+// lookups among hot grid points, on pools of 1 up to threads threads, with a cache that
+// holds every hot point and one that holds half of them, then a warm start from a file
+void bench_table_lazy(double prec, std::size_t threads) {
+    std::size_t hot = 1 << 15, queries = 1 << 20;
+    std::mt19937 generator(1);
+    std::uniform_int_distribution<int> grid_point(0, (int) std::ceil(2 * M_PI / prec) - 1);
+    std::uniform_int_distribution<std::size_t> pick(0, hot - 1);
+
+    std::vector<std::vector<double>> points(hot), u2(queries);
+    for (std::vector<double>& p : points) { p = {prec * grid_point(generator), prec * grid_point(generator), prec * grid_point(generator), prec * grid_point(generator)}; }
+    for (std::vector<double>& q : u2) { q = points[pick(generator)]; }
+
+    Table probe = Table();
+    probe.init_lazy(prec, 1 << 20);
+    std::size_t count = probe.get_count();
+    std::cout << "step " << prec << ": " << count << "^4 cells, " << std::setprecision(3) << std::pow((double) count, 4) * sizeof(U2Angles) / (1 << 30)
+              << " GiB as a full table; " << hot << " hot points, " << queries << " lookups" << std::endl;
+
+    std::complex<double> sink = 0;
+    double seconds = time_per_call([&]() {
+        for (std::vector<double> const& q : u2) { sink += Table::angles_of(q).theta; }
+    });
+    report("angles_of, no cache", queries / seconds, "lookup");
+
+    char path_template[] = "/tmp/apollo-cache-XXXXXX";
+    int fd = mkstemp(path_template);
+    if (fd < 0) { Error(-1, "Cannot create a temporary file"); }
+    close(fd);
+    std::string path = path_template;
+    unlink(path.c_str());
+
+    for (std::size_t cap : {2 * hot * ClockCache<U2Angles>::entry_bytes, hot / 2 * ClockCache<U2Angles>::entry_bytes}) {
+        for (std::size_t t = 1; t <= threads; t = t < threads && 2 * t > threads ? threads : 2 * t) {
+            ThreadPool pool(t);
+            Table table = Table();
+            table.init_lazy(prec, cap);
+
+            auto pass = [&]() {
+                pool.parallel_for(t, [&](std::size_t part) {
+                    std::complex<double> local = 0;
+                    for (std::size_t i = part; i < queries; i += t) { local += table.lookup_u2_angles(u2[i])[0]; }
+                    if (local == 1.0) { std::cout << local << std::endl; }
+                });
+            };
+
+            Stopwatch cold = Stopwatch();
+            pass();
+            double cold_seconds = cold.seconds();
+            CacheStats first = table.cache_stats();
+            seconds = time_per_call(pass);
+            CacheStats after = table.cache_stats();
+
+            std::ostringstream name;
+            name << "cap " << cap / 1024 << " KiB, " << t << " thread" << (t == 1 ? "" : "s") << " (hits " << std::setprecision(3)
+                 << 100.0 * (after.hits - first.hits) / (after.hits + after.misses - first.hits - first.misses) << "%)";
+            report(name.str(), queries / seconds, "lookup");
+
+            if (t == threads) {
+                std::cout << "  first pass " << std::setprecision(3) << cold_seconds * 1e3 << " ms, " << first.misses << " misses; "
+                          << table.size() << " entries, " << table.memory_bytes() / 1024 << " KiB, " << after.evictions << " evictions" << std::endl;
+                table.save_cache(path);
+            }
+        }
+
+        Table warm = Table();
+        Stopwatch load = Stopwatch();
+        warm.init_lazy(prec, cap, path);
+        double load_seconds = load.seconds();
+        std::size_t loaded = warm.size();
+        for (std::vector<double> const& q : u2) { sink += warm.lookup_u2_angles(q)[0]; }
+
+        CacheStats stats = warm.cache_stats();
+        std::cout << "  warm start: " << loaded << " entries loaded in " << std::setprecision(3) << load_seconds * 1e3
+                  << " ms, first pass hits " << 100.0 * stats.hits / (stats.hits + stats.misses) << "%" << std::endl;
+        unlink(path.c_str());
+    }
+
+    if (std::isnan(sink.real()) && sink.imag() == 1) { std::cout << sink << std::endl; }
+}
+
+// Meshes of random U2 blocks over 16 up to max_n modes, applied to batch states at once
+// layer by layer, against dense mvm of each state by the mesh's matrix
+void bench_mesh(int max_n, int batch) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> angle(0, 2 * M_PI), uniform(-1.0, 1.0);
+    Chip chip = Chip();
+
+    for (int n = 16; n <= max_n; n *= 4) {
+        for (MeshStyle style : {MeshStyle::CLEMENTS, MeshStyle::RECK}) {
+            std::size_t blocks = (std::size_t) n * (n - 1) / 2;
+            ComplexVector theta = ComplexVector(blocks), alpha = ComplexVector(blocks), beta = ComplexVector(blocks);
+
+            for (std::size_t b = 0; b < blocks; b++) {
+                theta.set(b, angle(random));
+                alpha.set(b, angle(random));
+                beta.set(b, angle(random));
+            }
+
+            Mesh mesh = chip.get_mesh(n, style, theta, alpha, beta);
+            std::string name = std::string(style == MeshStyle::CLEMENTS ? "clements" : "reck") + " [" + std::to_string(n) + "]";
+            std::cout << name << ": " << mesh.block_count() << " blocks, depth " << mesh.depth() << std::endl;
+
+            ComplexMatrix states = ComplexMatrix(n, batch);
+            for (int i = 0; i < n; i++) {
+                for (int k = 0; k < batch; k++) { states.set(i, k, {uniform(random), uniform(random)}); }
+            }
+
+            // the dense path takes every state as a contiguous vector
+            std::vector<ComplexVector> inputs(batch, ComplexVector(n)), outputs(batch, ComplexVector(n));
+            for (int k = 0; k < batch; k++) {
+                for (int i = 0; i < n; i++) { inputs[k].set(i, states.get(i, k)); }
+            }
+
+            Stopwatch build = Stopwatch();
+            ComplexMatrix dense = mesh.matrix();
+            double build_seconds = build.seconds();
+
+            double seconds = time_per_call([&]() {
+                for (int k = 0; k < batch; k++) { chip.mvm(dense, inputs[k], outputs[k]); }
+            });
+            report_time("  dense mvm, 1000 states (matrix built in " + std::to_string((int) (build_seconds * 1e3)) + " ms)", seconds / batch * 1000);
+
+            ComplexMatrix applied = states;
+            chip.apply(mesh, applied);
+
+            double error = 0, norm = 0;
+            for (int k = 0; k < batch; k++) {
+                for (int i = 0; i < n; i++) {
+                    error = std::max(error, std::abs(applied.get(i, k) - outputs[k].get(i)));
+                    norm += std::norm(applied.get(i, k)) - std::norm(states.get(i, k));
+                }
+            }
+
+            seconds = time_per_call([&]() {
+                chip.apply(mesh, states);
+            });
+
+            std::ostringstream label;
+            label << "  mesh, 1000 states in batches of " << batch << " (max error " << std::setprecision(1) << error << ", norm drift " << std::abs(norm) / batch << ")";
+            report_time(label.str(), seconds / batch * 1000);
+        }
+    }
+}
+
+// The Jacobian of the angles at n random controls: central differences of angles_of and
+// of lookups in the table at step prec, as calibration estimated it, against the
+// analytic kernels
+void bench_jacobian(double prec, int n) {
+    Table table = Table();
+    table.init_u22angle(prec);
+
+    // inside the grid and away from u11 = u12 = 0 and u21 = u22 = 0, where the angles are singular
+    double low = table.get_lower() + 2 * table.get_step(), high = table.get_lower() + (table.get_count() - 3) * table.get_step();
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> uniform(low, high);
+    std::vector<double> u2[4];
+
+    for (std::vector<double>& coordinate : u2) {
+        coordinate.resize(n);
+        for (double& u : coordinate) { u = uniform(random); }
+    }
+
+    const double* const controls[4] = {u2[0].data(), u2[1].data(), u2[2].data(), u2[3].data()};
+    auto parts = [](AngleJacobian& J) {
+        return std::array<double*, 12>{J.theta_u11.real(), J.theta_u11.imag(), J.theta_u12.real(), J.theta_u12.imag(), J.alpha_u11.real(), J.alpha_u11.imag(),
+                                       J.alpha_u12.real(), J.alpha_u12.imag(), J.beta_u21.real(), J.beta_u21.imag(), J.beta_u22.real(), J.beta_u22.imag()};
+    };
+
+    AngleJacobian exact = AngleJacobian(n);
+    jacobian_scalar(controls, n, parts(exact).data());
+
+    // the 3 x 4 complex Jacobian at point i from angles at u2 +- h along each control
+    auto differences = [&](int i, double h, auto angles_at, std::complex<double> J[3][4]) {
+        for (int d = 0; d < 4; d++) {
+            std::vector<double> plus = {u2[0][i], u2[1][i], u2[2][i], u2[3][i]}, minus = plus;
+            plus[d] += h;
+            minus[d] -= h;
+            U2Angles p = angles_at(plus), m = angles_at(minus);
+            std::complex<double> up[3] = {p.theta, p.alpha, p.beta}, down[3] = {m.theta, m.alpha, m.beta};
+
+            for (int a = 0; a < 3; a++) {
+                // real parts are phases, so a step across the branch cut is not a jump
+                J[a][d] = std::complex<double>(std::remainder(up[a].real() - down[a].real(), 2 * M_PI), up[a].imag() - down[a].imag()) / (2 * h);
+            }
+        }
+    };
+
+    auto error_at = [&](int i, std::complex<double> J[3][4]) {
+        std::complex<double> want[3][4] = {{exact.theta_u11.get(i), 0, exact.theta_u12.get(i), 0}, {exact.alpha_u11.get(i), 0, exact.alpha_u12.get(i), 0},
+                                           {0, exact.beta_u21.get(i), 0, exact.beta_u22.get(i)}};
+        double error = 0;
+        for (int a = 0; a < 3; a++) {
+            for (int d = 0; d < 4; d++) { error = std::max(error, std::abs(J[a][d] - want[a][d])); }
+        }
+        return error;
+    };
+
+    std::cout << n << " controls; table at step " << table.get_step() << std::endl;
+
+    auto finite = [&](std::string name, double h, auto angles_at) {
+        std::complex<double> J[3][4];
+        double error = 0;
+        for (int i = 0; i < n; i++) {
+            differences(i, h, angles_at, J);
+            error = std::max(error, error_at(i, J));
+        }
+
+        double seconds = time_per_call([&]() {
+            for (int i = 0; i < n; i++) { differences(i, h, angles_at, J); }
+        });
+
+        std::ostringstream label;
+        label << name << " (max error " << std::setprecision(1) << error << ")";
+        report(label.str(), n / seconds, "jacobian");
+    };
+
+    finite("differences of angles_of", 1e-6, [&](std::vector<double> const& u) { return Table::angles_of(u); });
+    finite("differences of table lookups", table.get_step(), [&](std::vector<double> const& u) { return table.lookup(u.data()); });
+
+    AngleJacobian J = AngleJacobian(n);
+    std::array<double*, 12> out = parts(J);
+
+    report_isas("analytic", " [" + std::to_string(n) + "]", n, "jacobian", jacobian_kernel, [&](JacobianKernel kernel) {
+        kernel(controls, n, out.data());
+    }, [&]() {
+        double error = 0;
+        for (int i = 0; i < n; i++) {
+            std::vector<std::vector<double>> single = Table::J_u22u4({u2[0][i], u2[1][i], u2[2][i], u2[3][i]});
+            std::complex<double> got[3][4];
+            for (int a = 0; a < 3; a++) {
+                for (int d = 0; d < 4; d++) { got[a][d] = {single[2 * a][d], single[2 * a + 1][d]}; }
+            }
+            got[0][0] = J.theta_u11.get(i);
+            got[0][2] = J.theta_u12.get(i);
+            got[1][0] = J.alpha_u11.get(i);
+            got[1][2] = J.alpha_u12.get(i);
+            got[2][1] = J.beta_u21.get(i);
+            got[2][3] = J.beta_u22.get(i);
+            error = std::max(error, error_at(i, got));
+        }
+
+        return max_error(error);
+    });
+}
+
+// The direct angle solver against the table at a few steps. The targets are the U2 of n
+// random controls: a table answers from the grid point nearest the controls, the solver
+// from the target alone. Errors are of the U2 of the answer against the target, relative
+// to its largest entry, and of the angles against theta2, alpha2 and beta2.
+void bench_solver(int n, int iterations) {
+    std::mt19937 random(1);
+
+    // inside every grid below and away from u11 = u12 = 0 and u21 = u22 = 0, where the angles are singular
+    std::uniform_real_distribution<double> uniform(0.5, 5.5);
+    std::vector<std::vector<double>> controls(n);
+    std::vector<U2Angles> exact(n);
+    std::vector<Mat2c> targets(n);
+    Chip chip = Chip();
+
+    for (int i = 0; i < n; i++) {
+        controls[i] = {uniform(random), uniform(random), uniform(random), uniform(random)};
+        exact[i] = Table::angles_of(controls[i]);
+        targets[i] = chip.get_u2(exact[i].to_vector());
+    }
+
+    auto u2_error = [&](Mat2c const& got, Mat2c const& want) {
+        double scale = 1e-300, difference = 0;
+
+        for (int e = 0; e < 4; e++) {
+            scale = std::max(scale, std::abs(want(e / 2, e % 2)));
+            difference = std::max(difference, std::abs(got(e / 2, e % 2) - want(e / 2, e % 2)));
+        }
+
+        return difference / scale;
+    };
+
+    auto label = [](std::string name, double u2, double angles) {
+        std::ostringstream label;
+        label << name << " (max error " << std::setprecision(1) << u2 << ", angles " << angles << ")";
+        return label.str();
+    };
+
+    std::cout << n << " targets" << std::endl;
+
+    for (double prec : {0.5, 0.25, 0.125}) {
+        std::size_t before = heap_in_use();
+        Table table = Table();
+        table.init_u22angle(prec);
+        std::size_t bytes = heap_in_use() - before;
+
+        double u2 = 0, angles = 0;
+
+        for (int i = 0; i < n; i++) {
+            U2Angles const& got = table.lookup(controls[i].data());
+            u2 = std::max(u2, u2_error(u2_from_angles(got.theta, got.alpha, got.beta), targets[i]));
+            angles = std::max({angles, angle_error(got.theta, exact[i].theta), angle_error(got.alpha, exact[i].alpha), angle_error(got.beta, exact[i].beta)});
+        }
+
+        std::complex<double> sink = 0;
+        double seconds = time_per_call([&]() {
+            for (std::vector<double> const& u : controls) { sink += table.lookup(u.data()).theta; }
+        });
+
+        std::ostringstream name;
+        name << "table step " << prec << ", " << bytes / (1 << 20) << " MiB";
+        report(label(name.str(), u2, angles), n / seconds, "u2");
+
+        if (std::isnan(sink.real()) && sink.imag() == 1) { std::cout << sink << std::endl; }
+    }
+
+    ComplexVector theta = ComplexVector(n), alpha = ComplexVector(n), beta = ComplexVector(n);
+    double* const out[6] = {theta.real(), theta.imag(), alpha.real(), alpha.imag(), beta.real(), beta.imag()};
+
+    auto errors = [&](std::vector<Mat2c> const& want, double& u2, double& angles) {
+        u2 = 0;
+        angles = 0;
+
+        for (int i = 0; i < n; i++) {
+            u2 = std::max(u2, u2_error(u2_from_angles(theta.get(i), alpha.get(i), beta.get(i)), want[i]));
+            angles = std::max({angles, angle_error(theta.get(i), exact[i].theta), angle_error(alpha.get(i), exact[i].alpha), angle_error(beta.get(i), exact[i].beta)});
+        }
+    };
+
+    for (int steps : {0, iterations}) {
+        report_isas("solver", ", " + std::to_string(steps) + " steps", n, "u2", solver_kernel, [&](SolverKernel kernel) {
+            kernel(targets.data(), n, steps, out);
+        }, [&]() {
+            double u2, angles;
+            errors(targets, u2, angles);
+            return max_error(u2) + max_error(angles, ", angles");
+        });
+    }
+
+    double seconds = time_per_call([&]() { chip.solve_u2_angles(targets.data(), theta, alpha, beta, iterations); });
+    report("Chip::solve_u2_angles on " + std::to_string(thread_pool().size()) + " threads", n / seconds, "u2");
+
+    // targets a little off any U2, which the steps fit in the least-squares sense
+    std::normal_distribution<double> noise(0.0, 1e-6);
+    std::vector<Mat2c> noisy = targets;
+
+    for (Mat2c& target : noisy) {
+        for (int e = 0; e < 4; e++) {
+            target.re[e] += noise(random);
+            target.im[e] += noise(random);
+        }
+    }
+
+    std::cout << "targets with 1e-6 noise, mean residual |U2 - target|:";
+
+    for (int steps : {0, iterations}) {
+        chip.solve_u2_angles(noisy.data(), theta, alpha, beta, steps);
+        double residual = 0;
+
+        for (int i = 0; i < n; i++) {
+            Mat2c got = u2_from_angles(theta.get(i), alpha.get(i), beta.get(i));
+            double squares = 0;
+            for (int e = 0; e < 4; e++) { squares += std::norm(got(e / 2, e % 2) - noisy[i](e / 2, e % 2)); }
+            residual += std::sqrt(squares);
+        }
+
+        std::cout << "  " << steps << " steps " << std::setprecision(3) << residual / n;
+    }
+
+    std::cout << std::endl;
+}
+
+// The angle index over the table at step prec: its build, then n random queries for the
+// nearest cell and for the 8 nearest, against a linear scan of every cell for a few of
+// them. The queries are the exact angles of random controls between grid points.
+void bench_index(double prec, int n) {
+    Table table = Table();
+    table.init_u22angle(prec);
+
+    Stopwatch watch = Stopwatch();
+    AngleIndex index = AngleIndex(table);
+    double build = watch.seconds();
+
+    std::cout << index.size() << " of " << table.size() << " cells indexed, " << index.memory_bytes() / (1 << 20) << " MiB" << std::endl;
+    report_time("build", build);
+
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> uniform(table.get_lower() + table.get_step(), table.get_lower() + (table.get_count() - 1) * table.get_step());
+    ComplexVector theta = ComplexVector(n), alpha = ComplexVector(n), beta = ComplexVector(n);
+
+    for (int i = 0; i < n; i++) {
+        U2Angles angles = Table::angles_of({uniform(random), uniform(random), uniform(random), uniform(random)});
+        theta.set(i, angles.theta);
+        alpha.set(i, angles.alpha);
+        beta.set(i, angles.beta);
+    }
+
+    // the k smallest distances from query i to any cell, by brute force
+    const U2Angles* cells = table.get_u22angle();
+    std::size_t cell_count = table.get_count() * table.get_count() * table.get_count() * table.get_count();
+
+    auto scan = [&](int i, std::size_t k) {
+        std::vector<double> distances;
+
+        for (std::size_t c = 0; c < cell_count; c++) {
+            double distance = std::sqrt(std::pow(angle_error(cells[c].theta, theta.get(i)), 2) + std::pow(angle_error(cells[c].alpha, alpha.get(i)), 2) +
+                                        std::pow(angle_error(cells[c].beta, beta.get(i)), 2));
+            if (std::isfinite(distance)) { distances.push_back(distance); }
+        }
+
+        std::partial_sort(distances.begin(), distances.begin() + k, distances.end());
+        distances.resize(k);
+        return distances;
+    };
+
+    int scanned = std::min(n, 64);
+
+    for (std::size_t k : {1, 8}) {
+        std::vector<AngleNeighbour> out(n * k);
+        double error = 0, sink = 0;
+
+        for (int i = 0; i < scanned; i++) {
+            std::vector<double> want = scan(i, k);
+            std::vector<AngleNeighbour> got = index.nearest({theta.get(i), alpha.get(i), beta.get(i)}, k);
+            for (std::size_t j = 0; j < k; j++) { error = std::max(error, std::abs(got[j].distance - want[j])); }
+        }
+
+        double seconds = time_per_call([&]() {
+            for (int i = 0; i < scanned; i++) { sink += scan(i, k)[0]; }
+        });
+
+        report_time("linear scan, k = " + std::to_string(k) + ", 1000 queries", seconds / scanned * 1000);
+
+        seconds = time_per_call([&]() {
+            for (int i = 0; i < n; i++) { sink += index.nearest({theta.get(i), alpha.get(i), beta.get(i)}, k)[0].distance; }
+        });
+
+        std::ostringstream label;
+        label << "index, k = " << k << ", 1000 queries (max error " << std::setprecision(1) << error << ")";
+        report_time(label.str(), seconds / n * 1000);
+
+        seconds = time_per_call([&]() { index.nearest(theta, alpha, beta, k, out.data()); });
+        report_time("batched on " + std::to_string(thread_pool().size()) + " threads, k = " + std::to_string(k) + ", 1000 queries", seconds / n * 1000);
+
+        if (std::isnan(sink)) { std::cout << sink << std::endl; }
+    }
+}
+
+// n x n unitary-sized matrix on batch states: one Chip::mvm call per state, nested
+// vectors and then SoA, against the batched GEMM
+void bench_gemm(int n, int batch) {
+    std::mt19937 random(1);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+    std::vector<std::vector<std::complex<double>>> m(n, std::vector<std::complex<double>>(n));
+    std::vector<std::vector<std::complex<double>>> vectors(batch, std::vector<std::complex<double>>(n));
+
+    for (auto& row : m) {
+        for (auto& value : row) { value = {uniform(random), uniform(random)}; }
+    }
+
+    for (auto& v : vectors) {
+        for (auto& value : v) { value = {uniform(random), uniform(random)}; }
+    }
+
+    Chip chip = Chip();
+    std::string size = "[" + std::to_string(n) + "][" + std::to_string(n) + "] x " + std::to_string(batch);
+    double macs = (double) n * n * batch;
+    std::vector<std::vector<std::complex<double>>> results(batch);
+
+    double seconds = time_per_call([&]() {
+        for (int s = 0; s < batch; s++) { chip.mvm(m, vectors[s], results[s]); }
+    });
+
+    report("mvm per state, std::complex " + size, macs / seconds, "cmac");
+
+    ComplexMatrix soa_m = ComplexMatrix(m);
+    std::vector<ComplexVector> soa_vectors, soa_results(batch, ComplexVector(n));
+    for (auto& v : vectors) { soa_vectors.push_back(ComplexVector(v)); }
+
+    seconds = time_per_call([&]() {
+        for (int s = 0; s < batch; s++) { chip.mvm(soa_m, soa_vectors[s], soa_results[s]); }
+    });
+
+    report("mvm per state, " + complex_kernels().name + " " + size, macs / seconds, "cmac");
+
+    // the states as the columns of one matrix
+    ComplexMatrix states = ComplexMatrix(n, batch), out = ComplexMatrix(n, batch);
+    for (int s = 0; s < batch; s++) {
+        for (int i = 0; i < n; i++) { states.set(i, s, vectors[s][i]); }
+    }
+
+    auto error = [&]() {
+        double error = 0;
+        for (int s = 0; s < batch; s++) {
+            for (int i = 0; i < n; i++) { error = std::max(error, std::abs(out.get(i, s) - results[s][i])); }
+        }
+        return error;
+    };
+
+    report_isas("gemm", " " + size, macs, "cmac", gemm_kernel, [&](GemmKernel kernel) {
+        kernel(soa_m.real(), soa_m.imag(), n, n, states.real(), states.imag(), out.real(), out.imag(), batch, batch);
+    }, [&]() { return max_error(error()); });
+
+    seconds = time_per_call([&]() { chip.mvm(soa_m, states, out); });
+
+    std::ostringstream label;
+    label << "Chip::mvm batched on " << thread_pool().size() << " threads (max error " << std::setprecision(1) << error() << ")";
+    report(label.str(), macs / seconds, "cmac");
+}
@@ -0,0 +1,460 @@
+//
+//  bytecode.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "instruction.cpp"
+
+std::unordered_map<std::string, VirtualSegment> const name_to_segment = { {"constant", CONSTANT}, {"local", LOCAL}, {"argument", ARGUMENT}, {"static", STATIC}, {"global", STATIC}, {"this", THIS}, {"that", THAT}, {"pointer", POINTER}, {"temp", TEMP} };
+std::unordered_map<int, std::string> const segment_to_name = { {CONSTANT, "constant"}, {LOCAL, "local"}, {ARGUMENT, "argument"}, {STATIC, "static"}, {THIS, "this"}, {THAT, "that"}, {POINTER, "pointer"}, {TEMP, "temp"} };
+std::unordered_map<std::string, Opcode> const name_to_arithmetic = { {"fadd", Opcode::FADD}, {"fsub", Opcode::FSUB}, {"fmult", Opcode::FMULT}, {"fdiv", Opcode::FDIV}, {"fneg", Opcode::FNEG} };
+
+// Shortest text that reads back as the same double
+std::string format_double(double value) {
+    char text[32];
+
+    for (int precision = 6; precision <= 17; precision++) {
+        snprintf(text, sizeof(text), "%.*g", precision, value);
+        if (std::strtod(text, nullptr) == value) { break; }
+    }
+
+    return text;
+}
+
+// What the VM has to allocate before running: the code is straight-line, so this is exact
+struct SegmentTable {
+    std::uint32_t stack;
+    std::uint32_t local;
+    std::uint32_t argument;
+    std::uint32_t statics;
+    std::uint32_t temp;
+    std::uint32_t reserved;
+};
+
+/*
+ Bytecode container (.irb). Native byte order, every offset 8-byte aligned, so a mapped
+ file is used in place:
+
+    header      "APBC" version:u16 section_count:u16 byte_order:u32 reserved:u32
+    sections    section_count x { kind:u32 reserved:u32 offset:u64 size:u64 }
+    CODE        Instruction[]   (8 bytes each, ends with HALT)
+    CONSTANTS   double[]        (the constant pool, raw IEEE-754)
+    SEGMENTS    SegmentTable
+ */
+struct BytecodeHeader {
+    char magic[4];
+    std::uint16_t version;
+    std::uint16_t section_count;
+    std::uint32_t byte_order;
+    std::uint32_t reserved;
+};
+
+struct BytecodeSection {
+    std::uint32_t kind;
+    std::uint32_t reserved;
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+
+enum class SectionKind : std::uint32_t {
+    CODE = 1,
+    CONSTANTS = 2,
+    SEGMENTS = 3
+};
+
+constexpr std::uint16_t bytecode_version = 1;
+constexpr std::uint32_t bytecode_byte_order = 0x01020304;
+
+// A loaded program: either owns its arrays or points into a read-only mapping of an .irb file
+class Program {
+private:
+    std::vector<Instruction> owned_code;
+    std::vector<double> owned_constants;
+    const Instruction* code;
+    std::size_t code_size;
+    const double* constants;
+    std::size_t constant_count;
+    SegmentTable segments;
+    void* mapping;
+    std::size_t mapping_size;
+
+    static int stack_effect(Opcode op) {
+        if (op <= Opcode::PUSH_TEMP) { return 1; }
+        if (op <= Opcode::POP_TEMP) { return -1; }
+        if (op == Opcode::FNEG || op == Opcode::ALLOC || op == Opcode::HALT) { return 0; }
+        return -1;
+    }
+
+    static int operands_needed(Opcode op) {
+        if (op >= Opcode::FADD && op <= Opcode::FDIV) { return 2; }
+        if (op == Opcode::FNEG || op == Opcode::ALLOC) { return 1; }
+        return -std::min(stack_effect(op), 0);
+    }
+
+    // Sizes every segment and checks operands, so the VM can run without bounds checks
+    static SegmentTable analyze(const Instruction* code, std::size_t code_size, std::size_t constant_count) {
+        SegmentTable table = { 0, 0, 0, 0, 0, 0 };
+        std::uint32_t depth = 0;
+
+        for (std::size_t i = 0; i < code_size; i++) {
+            Instruction const& instruction = code[i];
+            std::uint32_t needed = instruction.operand + 1;
+
+            if ((int) instruction.op >= NUM_OPCODES || (instruction.op == Opcode::HALT) != (i + 1 == code_size)) {
+                SyntaxError((int) i);
+            }
+
+            switch (instruction.op) {
+                case Opcode::PUSH_CONSTANT: if (instruction.operand >= constant_count) { SyntaxError((int) i); } break;
+                case Opcode::PUSH_LOCAL: case Opcode::POP_LOCAL: table.local = std::max(table.local, needed); break;
+                case Opcode::PUSH_ARGUMENT: case Opcode::POP_ARGUMENT: table.argument = std::max(table.argument, needed); break;
+                case Opcode::PUSH_STATIC: case Opcode::POP_STATIC: table.statics = std::max(table.statics, needed); break;
+                case Opcode::PUSH_TEMP: case Opcode::POP_TEMP: table.temp = std::max(table.temp, needed); break;
+                case Opcode::PUSH_POINTER: case Opcode::POP_POINTER: if (instruction.operand > 1) { SyntaxError((int) i); } break;
+                default: break;
+            }
+
+            if (depth < (std::uint32_t) operands_needed(instruction.op)) {
+                RuntimeError((int) i);
+            }
+
+            depth += stack_effect(instruction.op);
+            table.stack = std::max(table.stack, depth);
+        }
+
+        table.stack++;
+
+        return table;
+    }
+
+    void release() {
+        if (mapping != nullptr) { munmap(mapping, mapping_size); }
+        mapping = nullptr;
+    }
+public:
+    Program() {
+        code = nullptr;
+        code_size = 0;
+        constants = nullptr;
+        constant_count = 0;
+        segments = { 0, 0, 0, 0, 0, 0 };
+        mapping = nullptr;
+        mapping_size = 0;
+    }
+
+    Program(std::vector<Instruction> code, std::vector<double> constants) : Program() {
+        owned_code = std::move(code);
+        owned_constants = std::move(constants);
+        this->code = owned_code.data();
+        code_size = owned_code.size();
+        this->constants = owned_constants.data();
+        constant_count = owned_constants.size();
+        segments = analyze(this->code, code_size, constant_count);
+    }
+
+    Program(Program const&) = delete;
+
+    Program(Program&& other) : Program() {
+        *this = std::move(other);
+    }
+
+    Program& operator=(Program&& other) {
+        release();
+        owned_code = std::move(other.owned_code);
+        owned_constants = std::move(other.owned_constants);
+        code = other.code;
+        code_size = other.code_size;
+        constants = other.constants;
+        constant_count = other.constant_count;
+        segments = other.segments;
+        mapping = other.mapping;
+        mapping_size = other.mapping_size;
+        other.mapping = nullptr;
+
+        return *this;
+    }
+
+    ~Program() {
+        release();
+    }
+
+    const Instruction* get_code() const { return code; }
+
+    std::size_t get_code_size() const { return code_size; }
+
+    const double* get_constants() const { return constants; }
+
+    std::size_t get_constant_count() const { return constant_count; }
+
+    SegmentTable const& get_segments() const { return segments; }
+
+    static bool is_bytecode_file(std::string const& path) {
+        char magic[4] = {};
+        std::ifstream in(path, std::ios::binary);
+        in.read(magic, 4);
+
+        return in && std::memcmp(magic, "APBC", 4) == 0;
+    }
+
+    // One mmap; the code and constant pool are used where they lie in the file
+    static Program map_file(std::string const& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            Error(-1, "Cannot open " + path);
+        }
+
+        std::size_t size = (std::size_t) st.st_size;
+        void* mapped = size >= sizeof(BytecodeHeader) ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+
+        if (mapped == MAP_FAILED) {
+            Error(-1, "Cannot map " + path);
+        }
+
+        Program program = Program();
+        program.mapping = mapped;
+        program.mapping_size = size;
+
+        const char* base = (const char*) mapped;
+        const BytecodeHeader* header = (const BytecodeHeader*) base;
+
+        if (std::memcmp(header->magic, "APBC", 4) != 0 || header->version != bytecode_version ||
+            header->byte_order != bytecode_byte_order ||
+            sizeof(BytecodeHeader) + header->section_count * sizeof(BytecodeSection) > size) {
+            SyntaxError(-1);
+        }
+
+        const BytecodeSection* sections = (const BytecodeSection*) (base + sizeof(BytecodeHeader));
+        bool has_segments = false;
+
+        for (int i = 0; i < header->section_count; i++) {
+            BytecodeSection const& section = sections[i];
+
+            if (section.offset % 8 != 0 || section.offset > size || section.size > size - section.offset) {
+                SyntaxError(-1);
+            }
+
+            switch ((SectionKind) section.kind) {
+                case SectionKind::CODE:
+                    program.code = (const Instruction*) (base + section.offset);
+                    program.code_size = section.size / sizeof(Instruction);
+                    break;
+                case SectionKind::CONSTANTS:
+                    program.constants = (const double*) (base + section.offset);
+                    program.constant_count = section.size / sizeof(double);
+                    break;
+                case SectionKind::SEGMENTS:
+                    if (section.size < sizeof(SegmentTable)) { SyntaxError(-1); }
+                    std::memcpy(&program.segments, base + section.offset, sizeof(SegmentTable));
+                    has_segments = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (program.code_size == 0 || !has_segments) {
+            SyntaxError(-1);
+        }
+
+        // never trust the stored table: a corrupt file must not let the VM run out of bounds
+        SegmentTable checked = analyze(program.code, program.code_size, program.constant_count);
+
+        if (std::memcmp(&checked, &program.segments, sizeof(SegmentTable)) != 0) {
+            SyntaxError(-1);
+        }
+
+        return program;
+    }
+
+    // The textual .ir the CodeGenerator used to emit
+    static Program read_text(std::istream& in);
+
+    static Program load_file(std::string const& path) {
+        if (is_bytecode_file(path)) {
+            return map_file(path);
+        }
+
+        std::ifstream in(path);
+
+        if (!in) {
+            Error(-1, "Cannot open " + path);
+        }
+
+        return read_text(in);
+    }
+
+    void write(std::string const& path) const {
+        std::size_t header_size = sizeof(BytecodeHeader) + 3 * sizeof(BytecodeSection);
+        std::size_t code_bytes = code_size * sizeof(Instruction);
+        std::size_t constant_bytes = constant_count * sizeof(double);
+
+        BytecodeHeader header = { {'A', 'P', 'B', 'C'}, bytecode_version, 3, bytecode_byte_order, 0 };
+        BytecodeSection sections[3] = {
+            { (std::uint32_t) SectionKind::CODE, 0, header_size, code_bytes },
+            { (std::uint32_t) SectionKind::CONSTANTS, 0, header_size + code_bytes, constant_bytes },
+            { (std::uint32_t) SectionKind::SEGMENTS, 0, header_size + code_bytes + constant_bytes, sizeof(SegmentTable) }
+        };
+
+        std::ofstream out(path, std::ios::binary);
+        out.write((const char*) &header, sizeof(header));
+        out.write((const char*) sections, sizeof(sections));
+        out.write((const char*) code, code_bytes);
+        out.write((const char*) constants, constant_bytes);
+        out.write((const char*) &segments, sizeof(SegmentTable));
+    }
+
+    void disassemble(std::ostream& out) const {
+        for (std::size_t i = 0; i + 1 < code_size; i++) {
+            Instruction const& instruction = code[i];
+
+            if (instruction.op == Opcode::PUSH_CONSTANT) {
+                out << "push constant " << format_double(constants[instruction.operand]) << "\n";
+            } else if (instruction.op <= Opcode::PUSH_TEMP) {
+                out << "push " << segment_to_name.at(instruction.segment) << " " << instruction.operand << "\n";
+            } else if (instruction.op <= Opcode::POP_TEMP) {
+                out << "pop " << segment_to_name.at(instruction.segment) << " " << instruction.operand << "\n";
+            } else if (instruction.op == Opcode::ALLOC) {
+                out << "call Memory.alloc 1\n";
+            } else {
+                for (auto const& entry : name_to_arithmetic) {
+                    if (entry.second == instruction.op) { out << entry.first << "\n"; }
+                }
+            }
+        }
+    }
+};
+
+// Encodes instructions as they are generated; the constant pool keeps one copy of each value
+class BytecodeBuilder {
+private:
+    std::vector<Instruction> code;
+    std::vector<double> constants;
+    std::unordered_map<std::uint64_t, std::uint32_t> constant_index;
+
+    static Opcode push_opcode(VirtualSegment segment) {
+        switch (segment) {
+            case CONSTANT: return Opcode::PUSH_CONSTANT;
+            case LOCAL: return Opcode::PUSH_LOCAL;
+            case ARGUMENT: return Opcode::PUSH_ARGUMENT;
+            case STATIC: return Opcode::PUSH_STATIC;
+            case THIS: return Opcode::PUSH_THIS;
+            case THAT: return Opcode::PUSH_THAT;
+            case POINTER: return Opcode::PUSH_POINTER;
+            default: return Opcode::PUSH_TEMP;
+        }
+    }
+
+    static Opcode pop_opcode(VirtualSegment segment) {
+        switch (segment) {
+            case LOCAL: return Opcode::POP_LOCAL;
+            case ARGUMENT: return Opcode::POP_ARGUMENT;
+            case STATIC: return Opcode::POP_STATIC;
+            case THIS: return Opcode::POP_THIS;
+            case THAT: return Opcode::POP_THAT;
+            case POINTER: return Opcode::POP_POINTER;
+            case TEMP: return Opcode::POP_TEMP;
+            default: LogicalError(-1); return Opcode::HALT;
+        }
+    }
+
+    std::uint32_t constant(double value) {
+        std::uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+
+        auto it = constant_index.find(bits);
+
+        if (it != constant_index.end()) { return it->second; }
+
+        std::uint32_t index = (std::uint32_t) constants.size();
+        constants.push_back(value);
+        constant_index.insert({bits, index});
+
+        return index;
+    }
+public:
+    void push(VirtualSegment segment, double n) {
+        if (segment == CONSTANT) {
+            code.push_back({ Opcode::PUSH_CONSTANT, (std::uint8_t) segment, 0, constant(n) });
+        } else {
+            code.push_back({ push_opcode(segment), (std::uint8_t) segment, 0, (std::uint32_t) n });
+        }
+    }
+
+    void pop(VirtualSegment segment, std::uint32_t n) {
+        code.push_back({ pop_opcode(segment), (std::uint8_t) segment, 0, n });
+    }
+
+    void op(Opcode opcode) {
+        code.push_back({ opcode, 0, 0, 0 });
+    }
+
+    std::size_t size() {
+        return code.size();
+    }
+
+    Program finish() {
+        code.push_back({ Opcode::HALT, 0, 0, 0 });
+        Program program = Program(std::move(code), std::move(constants));
+        code.clear();
+        constants.clear();
+        constant_index.clear();
+
+        return program;
+    }
+};
+
+Program Program::read_text(std::istream& in) {
+    BytecodeBuilder builder = BytecodeBuilder();
+    std::string line;
+    int line_number = 0;
+
+    while (std::getline(in, line)) {
+        std::istringstream words(line);
+        std::string op, arg1, arg2;
+        words >> op >> arg1 >> arg2;
+        line_number++;
+
+        if (op == "" || op.rfind("//", 0) == 0) { continue; }
+
+        if ((op == "push" || op == "pop") && name_to_segment.find(arg1) != name_to_segment.end() && arg2 != "") {
+            VirtualSegment segment = name_to_segment.at(arg1);
+
+            if (op == "pop" && segment == CONSTANT) {
+                SyntaxError((int) line_number);
+            }
+
+            if (op == "push") {
+                builder.push(segment, std::strtod(arg2.c_str(), nullptr));
+            } else {
+                builder.pop(segment, (std::uint32_t) std::strtoul(arg2.c_str(), nullptr, 10));
+            }
+        } else if (name_to_arithmetic.find(op) != name_to_arithmetic.end()) {
+            builder.op(name_to_arithmetic.at(op));
+        } else if (op == "call" && arg1 == "Memory.alloc" && arg2 == "1") {
+            builder.op(Opcode::ALLOC);
+        } else {
+            SyntaxError((int) line_number);
+        }
+    }
+
+    return builder.finish();
+}
@@ -0,0 +1,45 @@
+//
+//  char_class.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <array>
+
+enum class CharClass : unsigned char {
+    SPACE,
+    NEWLINE,
+    DIGIT,
+    DOT,
+    ALPHA,
+    SYMBOL,
+    HASH,
+    OTHER,
+    END
+};
+
+constexpr int NUM_CHAR_CLASSES = 9;
+
+constexpr std::array<CharClass, 256> make_char_classes() {
+    std::array<CharClass, 256> classes{};
+
+    for (int c = 0; c < 256; c++) { classes[c] = CharClass::OTHER; }
+    for (char c : {' ', '\t', '\v', '\f'}) { classes[(unsigned char) c] = CharClass::SPACE; }
+    for (char c : {'\n', '\r'}) { classes[(unsigned char) c] = CharClass::NEWLINE; }
+    for (int c = '0'; c <= '9'; c++) { classes[c] = CharClass::DIGIT; }
+    for (int c = 'a'; c <= 'z'; c++) { classes[c] = CharClass::ALPHA; }
+    for (int c = 'A'; c <= 'Z'; c++) { classes[c] = CharClass::ALPHA; }
+    classes['_'] = CharClass::ALPHA;
+    classes['.'] = CharClass::DOT;
+    classes['#'] = CharClass::HASH;
+
+    // same set the old "[!@'{}().,;+*-/^%=~]|[[\\]]" regex accepted ('*-/' is a range)
+    for (char c : {'!', '@', '\'', '{', '}', '(', ')', ',', ';', '+', '*', '-', '/', '^', '%', '=', '~', '[', ']'}) {
+        classes[(unsigned char) c] = CharClass::SYMBOL;
+    }
+
+    return classes;
+}
+
+constexpr std::array<CharClass, 256> char_classes = make_char_classes();
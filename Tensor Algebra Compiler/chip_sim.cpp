@@ -5,9 +5,15 @@
 //
 
 #include <stdio.h>
+#include <algorithm>
 #include <vector>
 #include <complex>
 
+#include "mat2c.cpp"
+#include "mesh.cpp"
+#include "angle_solver.cpp"
+#include "complex_gemm.cpp"
+
 using namespace std::complex_literals;
 
 class Chip {
@@ -15,24 +21,102 @@ public:
     Chip() {}
     
     // angles = [theta, alpha, beta]
-    std::vector<std::vector<std::complex<double>>> get_u2(std::vector<std::complex<double>>& angles) {
-        std::vector<std::complex<double>> expangs;
-        for (std::complex<double> angle : angles) { expangs.push_back(std::exp(-1i * angle)); };
-        return std::vector<std::vector<std::complex<double>>> {
-            {0.5 * expangs[1] * (expangs[0] - 1.0), 0.5i * expangs[1] * (expangs[0] + 1.0)},
-            {0.5i * expangs[2] * (expangs[0] + 1.0), 0.5 * expangs[2] * (1.0 - expangs[0])}
-        };
+    Mat2c get_u2(std::vector<std::complex<double>> const& angles) {
+        return get_u2(angles[0], angles[1], angles[2]);
+    }
+    
+    Mat2c get_u2(std::complex<double> theta, std::complex<double> alpha, std::complex<double> beta) {
+        return u2_from_angles(theta, alpha, beta);
+    }
+    
+    // out[k] is the U2 of (theta[k], alpha[k], beta[k]); out must hold theta.size() matrices
+    void get_u2(ComplexVector const& theta, ComplexVector const& alpha, ComplexVector const& beta, Mat2c* out) {
+        if (alpha.size() != theta.size() || beta.size() != theta.size()) {
+            RuntimeError(-1);
+        }
+        
+        static U2Kernel const kernel = u2_kernel(complex_kernels().isa);
+        kernel(theta.real(), theta.imag(), alpha.real(), alpha.imag(), beta.real(), beta.imag(), theta.size(), out);
+    }
+    
+    // The angles [theta, alpha, beta] whose U2 is target, solved directly (see
+    // angle_solver.cpp) rather than read from a Table, so they are exact off any grid
+    std::vector<std::complex<double>> solve_u2_angles(Mat2c const& target, int iterations=2) {
+        double result[6];
+        solve_point(target, iterations, result);
+        return {{result[0], result[1]}, {result[2], result[3]}, {result[4], result[5]}};
+    }
+    
+    // (theta[k], alpha[k], beta[k]) solved for targets[k], k < theta.size(), on the SIMD
+    // kernels and shared out over the thread pool
+    void solve_u2_angles(const Mat2c* targets, ComplexVector& theta, ComplexVector& alpha, ComplexVector& beta, int iterations=2) {
+        if (alpha.size() != theta.size() || beta.size() != theta.size()) {
+            RuntimeError(-1);
+        }
+        
+        static SolverKernel const kernel = solver_kernel(complex_kernels().isa);
+        constexpr std::size_t chunk = 4096;
+        std::size_t n = theta.size();
+        
+        thread_pool().parallel_for((n + chunk - 1) / chunk, [&](std::size_t c) {
+            std::size_t first = c * chunk;
+            double* const out[6] = {theta.real() + first, theta.imag() + first, alpha.real() + first, alpha.imag() + first, beta.real() + first, beta.imag() + first};
+            kernel(targets + first, std::min(chunk, n - first), iterations, out);
+        });
     }
     
     std::complex<double> dot(std::vector<std::complex<double>>& a, std::vector<std::complex<double>>& b) {
         std::complex<double> res = 0;
-        for (int i = 0; i < a.size(); i++) { res += a[i] * b[i]; }
+        for (std::size_t i = 0; i < a.size(); i++) { res += a[i] * b[i]; }
         return res;
     }
     
-    std::vector<std::complex<double>> mvm(std::vector<std::vector<std::complex<double>>>& m, std::vector<std::complex<double>>& v) {
-        std::vector<std::complex<double>> res;
-        for (int i = 0; i < m.size(); i++) { res.push_back(dot(m[i], v)); }
-        return res;
+    // res holds m.size() entries once it returns; it is only resized if it had another size
+    void mvm(std::vector<std::vector<std::complex<double>>>& m, std::vector<std::complex<double>>& v, std::vector<std::complex<double>>& res) {
+        res.resize(m.size());
+        for (std::size_t i = 0; i < m.size(); i++) { res[i] = dot(m[i], v); }
+    }
+    
+    // The split real/imaginary forms below run on the SIMD kernels
+    std::complex<double> dot(ComplexVector const& a, ComplexVector const& b) {
+        if (a.size() != b.size()) {
+            RuntimeError(-1);
+        }
+        
+        return complex_kernels().dot(a.real(), a.imag(), b.real(), b.imag(), a.size());
+    }
+    
+    // res must hold m.row_count() entries and not be v
+    void mvm(ComplexMatrix const& m, ComplexVector const& v, ComplexVector& res) {
+        if (m.col_count() != v.size() || m.row_count() != res.size() || &v == &res) {
+            RuntimeError(-1);
+        }
+        
+        complex_kernels().mvm(m.real(), m.imag(), m.row_count(), m.col_count(), v.real(), v.imag(), res.real(), res.imag());
+    }
+    
+    // Every column of states, one state per column, through m at once as a blocked GEMM
+    // (see complex_gemm.cpp); out must be m.row_count() x states.col_count() and be
+    // neither m nor states
+    void mvm(ComplexMatrix const& m, ComplexMatrix const& states, ComplexMatrix& out) {
+        complex_gemm(m, states, out);
+    }
+    
+    // A mesh over modes modes whose block b, in the mesh's layer order, is the U2 of
+    // (theta[b], alpha[b], beta[b]); the angles hold one entry per block
+    Mesh get_mesh(std::size_t modes, MeshStyle style, ComplexVector const& theta, ComplexVector const& alpha, ComplexVector const& beta) {
+        Mesh mesh = Mesh(modes, style);
+        
+        if (theta.size() != mesh.block_count()) {
+            RuntimeError(-1);
+        }
+        
+        get_u2(theta, alpha, beta, mesh.get_blocks());
+        return mesh;
+    }
+    
+    // every column of states, one state per column, through the mesh in place
+    void apply(Mesh const& mesh, ComplexMatrix& states) {
+        mesh.apply(states);
     }
 };
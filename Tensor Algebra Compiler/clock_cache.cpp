@@ -0,0 +1,235 @@
+//
+//  clock_cache.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <shared_mutex>
+#include <type_traits>
+
+struct CacheStats {
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t evictions = 0;
+    std::size_t entries = 0;
+};
+
+/*
+ A bounded map from 64-bit keys to values that many threads can use at once. Keys are
+ spread over shards by hash, each with its own reader-writer lock, so threads only wait
+ for one another when they touch the same shard at the same moment. A hit takes its
+ shard's lock shared and marks the entry referenced; a miss computes the value with no
+ lock held, then inserts it under the exclusive lock.
+
+ A shard holds at most its share of the capacity and evicts by CLOCK: a hand sweeps the
+ entries, unmarking referenced ones, and replaces the first it finds unmarked. That
+ approximates LRU without reordering anything on a hit.
+
+ A shard's entries sit in one array, found through an open-addressed index of (key,
+ entry) slots at most half full, so a hit reads one slot and one entry. Both arrays are
+ allocated for the full capacity but only touched as they fill. The index has a power of
+ two of slots, so the cache is sized from its memory cap: of the slot counts, the one
+ that leaves room for the most entries beside it, within both the cap and half the slots.
+ */
+template <typename Value>
+class ClockCache {
+private:
+    static_assert(std::is_trivially_destructible<Value>::value, "entries are overwritten in place");
+
+    static constexpr std::size_t shard_bits = 6;
+    static constexpr std::size_t shard_count = std::size_t(1) << shard_bits;
+
+    struct Entry {
+        std::uint64_t key;
+        Value value;
+        std::atomic<bool> referenced;
+    };
+
+    // entry is the index of the entry holding key plus one, or 0 for an empty slot
+    struct Slot {
+        std::uint64_t key;
+        std::uint64_t entry;
+    };
+
+    struct Free {
+        void operator()(void* p) const { free(p); }
+    };
+
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unique_ptr<Entry[], Free> entries;
+        std::unique_ptr<Slot[], Free> slots;
+        std::size_t used = 0;
+        std::size_t hand = 0;
+        std::atomic<std::size_t> hits{0};
+        std::size_t misses = 0;
+        std::size_t evictions = 0;
+    };
+
+    std::size_t shard_capacity = 0;
+    std::size_t slot_mask = 0;
+    std::unique_ptr<Shard[]> shards;
+
+    // splitmix64's finalizer: the top bits pick the shard, the low bits the home slot
+    static std::uint64_t mix(std::uint64_t key) {
+        key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9;
+        key = (key ^ (key >> 27)) * 0x94d049bb133111eb;
+        return key ^ (key >> 31);
+    }
+
+    // the slot holding key, or the empty slot where it would go
+    std::size_t find(Shard const& shard, std::uint64_t key, std::uint64_t hash) const {
+        std::size_t s = hash & slot_mask;
+        while (shard.slots[s].entry != 0 && shard.slots[s].key != key) { s = (s + 1) & slot_mask; }
+        return s;
+    }
+
+    // empties slot s, moving back the slots after it that would otherwise be cut off from
+    // their home slot
+    void erase(Shard& shard, std::size_t s) {
+        std::size_t hole = s;
+
+        for (std::size_t next = (hole + 1) & slot_mask; shard.slots[next].entry != 0; next = (next + 1) & slot_mask) {
+            std::size_t home = mix(shard.slots[next].key) & slot_mask;
+
+            if (((next - home) & slot_mask) >= ((next - hole) & slot_mask)) {
+                shard.slots[hole] = shard.slots[next];
+                hole = next;
+            }
+        }
+
+        shard.slots[hole].entry = 0;
+    }
+
+    // with the shard's lock held exclusively
+    void insert(Shard& shard, std::uint64_t key, std::uint64_t hash, Value const& value) {
+        std::size_t s = find(shard, key, hash);
+        if (shard.slots[s].entry != 0) { return; }
+
+        std::size_t e = shard.used;
+
+        if (shard.used < shard_capacity) {
+            new (&shard.entries[e]) Entry();
+            shard.used++;
+        } else {
+            while (shard.entries[shard.hand].referenced.exchange(false, std::memory_order_relaxed)) {
+                shard.hand = (shard.hand + 1) % shard_capacity;
+            }
+
+            e = shard.hand;
+            shard.hand = (shard.hand + 1) % shard_capacity;
+            std::uint64_t victim = shard.entries[e].key;
+            erase(shard, find(shard, victim, mix(victim)));
+            shard.evictions++;
+            s = find(shard, key, hash);
+        }
+
+        shard.entries[e].key = key;
+        shard.entries[e].value = value;
+        shard.slots[s] = {key, e + 1};
+    }
+public:
+    // the memory an entry takes with the index exactly half full, counting its two slots
+    static constexpr std::size_t entry_bytes = sizeof(Entry) + 2 * sizeof(Slot);
+
+    // as many entries as fit in memory_cap bytes, the shards and their indexes included;
+    // the cap must leave room for one entry per shard
+    ClockCache(std::size_t memory_cap) : shards(new Shard[shard_count]) {
+        std::size_t budget = memory_cap > sizeof(Shard) * shard_count ? (memory_cap - sizeof(Shard) * shard_count) / shard_count : 0;
+        std::size_t slot_count = 0;
+
+        for (std::size_t slots = 2; slots * sizeof(Slot) < budget; slots *= 2) {
+            std::size_t fit = std::min(slots / 2, (budget - slots * sizeof(Slot)) / sizeof(Entry));
+            if (fit > shard_capacity) { shard_capacity = fit; slot_count = slots; }
+        }
+
+        if (shard_capacity == 0) {
+            Error(-1, "A cache of " + std::to_string(memory_cap) + " bytes cannot hold an entry in each of its " + std::to_string(shard_count) + " shards");
+        }
+
+        slot_mask = slot_count - 1;
+
+        for (std::size_t s = 0; s < shard_count; s++) {
+            shards[s].entries.reset((Entry*) malloc(shard_capacity * sizeof(Entry)));
+            shards[s].slots.reset((Slot*) calloc(slot_count, sizeof(Slot)));
+
+            if (shards[s].entries == nullptr || shards[s].slots == nullptr) {
+                Error(-1, "Cannot allocate a cache of " + std::to_string(memory_cap) + " bytes");
+            }
+        }
+    }
+
+    // the value for key, from compute(key) when it is not cached
+    template <typename F>
+    Value get(std::uint64_t key, F const& compute) {
+        std::uint64_t hash = mix(key);
+        Shard& shard = shards[hash >> (64 - shard_bits)];
+
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            Slot const& slot = shard.slots[find(shard, key, hash)];
+
+            if (slot.entry != 0) {
+                Entry& entry = shard.entries[slot.entry - 1];
+                if (!entry.referenced.load(std::memory_order_relaxed)) { entry.referenced.store(true, std::memory_order_relaxed); }
+                shard.hits.fetch_add(1, std::memory_order_relaxed);
+                return entry.value;
+            }
+        }
+
+        Value value = compute(key);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        shard.misses++;
+        insert(shard, key, hash, value);
+        return value;
+    }
+
+    void put(std::uint64_t key, Value const& value) {
+        std::uint64_t hash = mix(key);
+        Shard& shard = shards[hash >> (64 - shard_bits)];
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        insert(shard, key, hash, value);
+    }
+
+    // f(key, value) for every entry, one shard at a time
+    template <typename F>
+    void for_each(F const& f) const {
+        for (std::size_t s = 0; s < shard_count; s++) {
+            std::shared_lock<std::shared_mutex> lock(shards[s].mutex);
+            for (std::size_t e = 0; e < shards[s].used; e++) { f(shards[s].entries[e].key, shards[s].entries[e].value); }
+        }
+    }
+
+    std::size_t capacity() const {
+        return shard_capacity * shard_count;
+    }
+
+    // the bytes allocated, at most the memory cap: pages of the arrays are only touched as
+    // the cache fills
+    std::size_t memory_bytes() const {
+        return shard_count * (sizeof(Shard) + shard_capacity * sizeof(Entry) + (slot_mask + 1) * sizeof(Slot));
+    }
+
+    CacheStats stats() const {
+        CacheStats stats;
+
+        for (std::size_t s = 0; s < shard_count; s++) {
+            std::shared_lock<std::shared_mutex> lock(shards[s].mutex);
+            stats.hits += shards[s].hits.load(std::memory_order_relaxed);
+            stats.misses += shards[s].misses;
+            stats.evictions += shards[s].evictions;
+            stats.entries += shards[s].used;
+        }
+
+        return stats;
+    }
+};
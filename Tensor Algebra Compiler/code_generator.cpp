@@ -6,29 +6,50 @@
 
 #include <stdio.h>
 #include "parser.cpp"
+#include "optimizer.cpp"
+#include "shape_inference.cpp"
 #include "tables.cpp"
+#include "angle_index.cpp"
 
 
 class CodeGenerator {
 private:
-    ProgramNode ast;
+    ProgramNode* ast;
+    ShapeInference& shapes;
     SymbolTable symbol_table;
-    std::ofstream out;
-public:
-    CodeGenerator(ProgramNode n, std::string ofname) : ast(n) {
-        out = std::ofstream(ofname);
+    VMWriter writer;
+    
+    // The VM holds a tensor as a pointer to its Memory.alloc block and its arithmetic works on
+    // scalars, so an operator on a tensor would compute on the pointer; like contractions,
+    // tensor operands are left to the native backend
+    void check_scalar_operands(ExpressionNode* n) {
+        for (ExpressionNode* operand : {n->get_left(), n->get_right()}) {
+            if (operand == nullptr) { continue; }
+            
+            if (!shapes.shape_of(operand).empty()) {
+                LogicalError(-1);
+            }
+            
+            check_scalar_operands(operand);
+        }
     }
+public:
+    CodeGenerator(ProgramNode* n, ShapeInference& shapes) : ast(n), shapes(shapes) {}
     
-    void generate_code() {
-        codegen_helper(ast);
+    Program generate_code() {
+        codegen_helper(*ast);
+        
+        return writer.finish();
     }
     
     void codegen_helper(ASTNode& n) {
-        std::cout << n.get_token().get_token() << std::endl;
+        if (VarDecNode* var_dec = dynamic_cast<VarDecNode*>(&n)) {
+            check_scalar_operands(var_dec->get_rhs());
+        }
         
-        n.codegen(out, symbol_table);
+        n.codegen(writer, symbol_table);
         
-        for (std::shared_ptr<ASTNode> child : n.get_children()) {
+        for (ASTNode* child : n.get_children()) {
             codegen_helper(*child);
         }
     }
@@ -0,0 +1,223 @@
+//
+//  complex_gemm.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// out = m x over width columns, on split real/imaginary planes: m is rows x depth and
+// row-major, x is depth x width and out rows x width, both with rows stride doubles apart.
+// out may not overlap m or x.
+typedef void (*GemmKernel)(const double* mr, const double* mi, std::size_t rows, std::size_t depth,
+                           const double* xr, const double* xi, double* outr, double* outi, std::size_t stride, std::size_t width);
+
+void gemm_scalar(const double* mr, const double* mi, std::size_t rows, std::size_t depth,
+                 const double* xr, const double* xi, double* outr, double* outi, std::size_t stride, std::size_t width) {
+    for (std::size_t i = 0; i < rows; i++) {
+        double* cr = outr + i * stride;
+        double* ci = outi + i * stride;
+        std::fill(cr, cr + width, 0.0);
+        std::fill(ci, ci + width, 0.0);
+
+        for (std::size_t k = 0; k < depth; k++) {
+            double ar = mr[i * depth + k], ai = mi[i * depth + k];
+            const double* br = xr + k * stride;
+            const double* bi = xi + k * stride;
+
+            for (std::size_t j = 0; j < width; j++) {
+                cr[j] += ar * br[j] - ai * bi[j];
+                ci[j] += ar * bi[j] + ai * br[j];
+            }
+        }
+    }
+}
+
+#if defined(__x86_64__)
+/*
+ Blocked the way BLAS libraries block a GEMM. The columns go in blocks of nc and depth in
+ slices of kc; each slice of a block of x is packed into panels of two registers' width,
+ real then imaginary parts for each k, 1 MiB in all, so the tile below reads it in order
+ from L2. A tile holds tile_rows rows by one panel of out in registers through the whole
+ slice, a complex multiply-add being four FMAs:
+
+    re += ar br - ai bi        im += ar bi + ai br
+
+ That is 16 accumulators on AVX-512 (four rows) and 8 on AVX2 (two rows), which leaves
+ registers for the panel and the broadcast entries of m. The first slice stores out and
+ later ones add to it. Partial panels are zero-padded when packed and go through a
+ buffer on the way out.
+ */
+
+template <typename Ops>
+struct GemmMath {
+    typedef typename Ops::V V;
+
+    static constexpr std::size_t W = Ops::width;
+    static constexpr std::size_t panel = 2 * W;
+    static constexpr std::size_t tile_rows = W == 8 ? 4 : 2;
+    static constexpr std::size_t kc = 256;
+    static constexpr std::size_t nc = 256;
+
+    // R rows of out from m, starting at column 0 of the packed panel, over valid columns
+    template <std::size_t R>
+    static void tile(const double* mr, const double* mi, std::size_t depth, const double* packed, std::size_t k_count,
+                     double* outr, double* outi, std::size_t stride, std::size_t valid, bool accumulate) {
+        V cr[R][2], ci[R][2];
+
+        // the loops over rows and halves are unrolled so the accumulators stay in registers
+        #pragma GCC unroll 4
+        for (std::size_t r = 0; r < R; r++) {
+            for (int h = 0; h < 2; h++) { cr[r][h] = Ops::set(0.0); ci[r][h] = Ops::set(0.0); }
+        }
+
+        for (std::size_t k = 0; k < k_count; k++) {
+            const double* p = packed + 2 * panel * k;
+            V br[2] = {Ops::load(p), Ops::load(p + W)}, bi[2] = {Ops::load(p + panel), Ops::load(p + panel + W)};
+
+            #pragma GCC unroll 4
+            for (std::size_t r = 0; r < R; r++) {
+                V ar = Ops::set(mr[r * depth + k]), ai = Ops::set(mi[r * depth + k]);
+
+                #pragma GCC unroll 2
+                for (int h = 0; h < 2; h++) {
+                    cr[r][h] = Ops::fnma(ai, bi[h], Ops::fma(ar, br[h], cr[r][h]));
+                    ci[r][h] = Ops::fma(ai, br[h], Ops::fma(ar, bi[h], ci[r][h]));
+                }
+            }
+        }
+
+        #pragma GCC unroll 4
+        for (std::size_t r = 0; r < R; r++) {
+            double* row_r = outr + r * stride;
+            double* row_i = outi + r * stride;
+
+            if (valid == panel) {
+                for (int h = 0; h < 2; h++) {
+                    V re = accumulate ? Ops::add(cr[r][h], Ops::load(row_r + h * W)) : cr[r][h];
+                    V im = accumulate ? Ops::add(ci[r][h], Ops::load(row_i + h * W)) : ci[r][h];
+                    Ops::store(row_r + h * W, re);
+                    Ops::store(row_i + h * W, im);
+                }
+                continue;
+            }
+
+            double lanes[2][panel];
+            for (int h = 0; h < 2; h++) {
+                Ops::store(lanes[0] + h * W, cr[r][h]);
+                Ops::store(lanes[1] + h * W, ci[r][h]);
+            }
+
+            for (std::size_t j = 0; j < valid; j++) {
+                row_r[j] = accumulate ? row_r[j] + lanes[0][j] : lanes[0][j];
+                row_i[j] = accumulate ? row_i[j] + lanes[1][j] : lanes[1][j];
+            }
+        }
+    }
+
+    // at most nc columns, so that the packed slice stays within L2
+    static void block(const double* mr, const double* mi, std::size_t rows, std::size_t depth,
+                      const double* xr, const double* xi, double* outr, double* outi, std::size_t stride, std::size_t width) {
+        if (depth == 0) {
+            for (std::size_t i = 0; i < rows; i++) {
+                std::fill(outr + i * stride, outr + i * stride + width, 0.0);
+                std::fill(outi + i * stride, outi + i * stride + width, 0.0);
+            }
+            return;
+        }
+
+        std::size_t panels = (width + panel - 1) / panel;
+        static thread_local std::vector<double> packed;
+        packed.resize(panels * 2 * panel * kc);
+
+        for (std::size_t k0 = 0; k0 < depth; k0 += kc) {
+            std::size_t k_count = std::min(kc, depth - k0);
+
+            for (std::size_t p = 0; p < panels; p++) {
+                std::size_t j0 = p * panel, valid = std::min(panel, width - j0);
+
+                for (std::size_t k = 0; k < k_count; k++) {
+                    double* to = &packed[(p * kc + k) * 2 * panel];
+                    std::memcpy(to, xr + (k0 + k) * stride + j0, valid * sizeof(double));
+                    std::memcpy(to + panel, xi + (k0 + k) * stride + j0, valid * sizeof(double));
+                    std::fill(to + valid, to + panel, 0.0);
+                    std::fill(to + panel + valid, to + 2 * panel, 0.0);
+                }
+            }
+
+            bool accumulate = k0 > 0;
+            std::size_t i = 0;
+
+            for (; i + tile_rows <= rows; i += tile_rows) {
+                for (std::size_t p = 0; p < panels; p++) {
+                    std::size_t j0 = p * panel;
+                    tile<tile_rows>(mr + i * depth + k0, mi + i * depth + k0, depth, &packed[p * kc * 2 * panel], k_count,
+                                    outr + i * stride + j0, outi + i * stride + j0, stride, std::min(panel, width - j0), accumulate);
+                }
+            }
+
+            for (; i < rows; i++) {
+                for (std::size_t p = 0; p < panels; p++) {
+                    std::size_t j0 = p * panel;
+                    tile<1>(mr + i * depth + k0, mi + i * depth + k0, depth, &packed[p * kc * 2 * panel], k_count,
+                            outr + i * stride + j0, outi + i * stride + j0, stride, std::min(panel, width - j0), accumulate);
+                }
+            }
+        }
+    }
+
+    static void gemm(const double* mr, const double* mi, std::size_t rows, std::size_t depth,
+                     const double* xr, const double* xi, double* outr, double* outi, std::size_t stride, std::size_t width) {
+        for (std::size_t j = 0; j < width; j += nc) {
+            block(mr, mi, rows, depth, xr + j, xi + j, outr + j, outi + j, stride, std::min(nc, width - j));
+        }
+    }
+};
+
+__attribute__((target("avx2,fma"), flatten))
+void gemm_avx2(const double* mr, const double* mi, std::size_t rows, std::size_t depth,
+               const double* xr, const double* xi, double* outr, double* outi, std::size_t stride, std::size_t width) {
+    GemmMath<Avx2Ops>::gemm(mr, mi, rows, depth, xr, xi, outr, outi, stride, width);
+}
+
+__attribute__((target("avx512f"), flatten))
+void gemm_avx512(const double* mr, const double* mi, std::size_t rows, std::size_t depth,
+                 const double* xr, const double* xi, double* outr, double* outi, std::size_t stride, std::size_t width) {
+    GemmMath<Avx512Ops>::gemm(mr, mi, rows, depth, xr, xi, outr, outi, stride, width);
+}
+
+#endif
+
+// the GEMM kernel for isa, which must be supported
+GemmKernel gemm_kernel(ComplexIsa isa) {
+#if defined(__x86_64__)
+    if (isa == ComplexIsa::AVX512) { return gemm_avx512; }
+    if (isa == ComplexIsa::AVX2) { return gemm_avx2; }
+#endif
+
+    return gemm_scalar;
+}
+
+/*
+ out = m states on every column of states at once, with out preallocated and distinct
+ from both m and states. The columns go in blocks of up to 256, about 1 MiB of a packed
+ slice, shared out over pool; a block is narrower when that keeps every thread busy.
+ */
+void complex_gemm(ComplexMatrix const& m, ComplexMatrix const& states, ComplexMatrix& out, ThreadPool& pool=thread_pool()) {
+    if (m.col_count() != states.row_count() || out.row_count() != m.row_count() || out.col_count() != states.col_count() || &out == &states || &out == &m) {
+        RuntimeError(-1);
+    }
+
+    static GemmKernel const kernel = gemm_kernel(complex_kernels().isa);
+    std::size_t columns = states.col_count();
+    std::size_t width = std::min<std::size_t>(256, std::max<std::size_t>(16, (columns + pool.size() - 1) / pool.size() + 15) / 16 * 16);
+
+    pool.parallel_for((columns + width - 1) / width, [&](std::size_t block) {
+        std::size_t first = block * width;
+        kernel(m.real(), m.imag(), m.row_count(), m.col_count(), states.real() + first, states.imag() + first,
+               out.real() + first, out.imag() + first, columns, std::min(width, columns - first));
+    });
+}
@@ -0,0 +1,318 @@
+//
+//  complex_kernels.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <complex>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// A complex vector as one array of real parts and one of imaginary parts, so that a SIMD
+// register holds consecutive elements rather than alternating parts of one
+class ComplexVector {
+private:
+    std::vector<double> re;
+    std::vector<double> im;
+public:
+    ComplexVector() {}
+
+    ComplexVector(std::size_t n) : re(n, 0.0), im(n, 0.0) {}
+
+    ComplexVector(std::vector<std::complex<double>> const& values) : re(values.size()), im(values.size()) {
+        for (std::size_t i = 0; i < values.size(); i++) { set(i, values[i]); }
+    }
+
+    std::size_t size() const {
+        return re.size();
+    }
+
+    double* real() {
+        return re.data();
+    }
+
+    double* imag() {
+        return im.data();
+    }
+
+    const double* real() const {
+        return re.data();
+    }
+
+    const double* imag() const {
+        return im.data();
+    }
+
+    std::complex<double> get(std::size_t i) const {
+        return { re[i], im[i] };
+    }
+
+    void set(std::size_t i, std::complex<double> value) {
+        re[i] = value.real();
+        im[i] = value.imag();
+    }
+
+    std::vector<std::complex<double>> to_vector() const {
+        std::vector<std::complex<double>> values(size());
+        for (std::size_t i = 0; i < size(); i++) { values[i] = get(i); }
+        return values;
+    }
+};
+
+// rows x cols, row-major, as a plane of real parts and a plane of imaginary parts
+class ComplexMatrix {
+private:
+    std::size_t rows = 0;
+    std::size_t cols = 0;
+    std::vector<double> re;
+    std::vector<double> im;
+public:
+    ComplexMatrix() {}
+
+    ComplexMatrix(std::size_t rows, std::size_t cols) : rows(rows), cols(cols), re(rows * cols, 0.0), im(rows * cols, 0.0) {}
+
+    // every row must have as many entries as the first
+    ComplexMatrix(std::vector<std::vector<std::complex<double>>> const& values) : ComplexMatrix(values.size(), values.empty() ? 0 : values[0].size()) {
+        for (std::size_t i = 0; i < rows; i++) {
+            for (std::size_t j = 0; j < cols; j++) { set(i, j, values[i][j]); }
+        }
+    }
+
+    std::size_t row_count() const {
+        return rows;
+    }
+
+    std::size_t col_count() const {
+        return cols;
+    }
+
+    double* real() {
+        return re.data();
+    }
+
+    double* imag() {
+        return im.data();
+    }
+
+    const double* real() const {
+        return re.data();
+    }
+
+    const double* imag() const {
+        return im.data();
+    }
+
+    std::complex<double> get(std::size_t i, std::size_t j) const {
+        return { re[i * cols + j], im[i * cols + j] };
+    }
+
+    void set(std::size_t i, std::size_t j, std::complex<double> value) {
+        re[i * cols + j] = value.real();
+        im[i * cols + j] = value.imag();
+    }
+};
+
+enum class ComplexIsa {
+    SCALAR,
+    AVX2,
+    AVX512
+};
+
+/*
+ Complex dot products and matrix-vector products on split real/imaginary arrays. With the
+ parts apart a complex multiply-add is four real FMAs on full registers:
+
+    re += ar * br - ai * bi        im += ar * bi + ai * br
+
+ mvm runs four rows at a time, so every chunk of x is loaded once per four rows. The
+ AVX2 and AVX-512 versions are compiled with target attributes and picked at run time by
+ what the CPU supports; elsewhere only the scalar loop exists.
+ */
+struct ComplexKernels {
+    ComplexIsa isa;
+    std::string name;
+
+    // sum of a[i] * b[i], i < n
+    std::complex<double> (*dot)(const double* ar, const double* ai, const double* br, const double* bi, std::size_t n);
+
+    // out = m x, m rows x cols and row-major; out may not overlap m or x
+    void (*mvm)(const double* mr, const double* mi, std::size_t rows, std::size_t cols, const double* xr, const double* xi, double* outr, double* outi);
+};
+
+// inline, so the SIMD kernels' tails do not call across instruction sets
+inline std::complex<double> dot_scalar(const double* ar, const double* ai, const double* br, const double* bi, std::size_t n) {
+    double re = 0, im = 0;
+
+    for (std::size_t i = 0; i < n; i++) {
+        re += ar[i] * br[i] - ai[i] * bi[i];
+        im += ar[i] * bi[i] + ai[i] * br[i];
+    }
+
+    return { re, im };
+}
+
+void mvm_scalar(const double* mr, const double* mi, std::size_t rows, std::size_t cols, const double* xr, const double* xi, double* outr, double* outi) {
+    for (std::size_t i = 0; i < rows; i++) {
+        std::complex<double> value = dot_scalar(mr + i * cols, mi + i * cols, xr, xi, cols);
+        outr[i] = value.real();
+        outi[i] = value.imag();
+    }
+}
+
+#if defined(__x86_64__)
+__attribute__((target("avx2,fma")))
+static double sum_avx2(__m256d v) {
+    __m128d pair = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+}
+
+__attribute__((target("avx2,fma")))
+std::complex<double> dot_avx2(const double* ar, const double* ai, const double* br, const double* bi, std::size_t n) {
+    // four independent sums keep the FMA units busy
+    __m256d rr = _mm256_setzero_pd(), ii = _mm256_setzero_pd(), ri = _mm256_setzero_pd(), ir = _mm256_setzero_pd();
+    std::size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256d a_re = _mm256_loadu_pd(ar + i), a_im = _mm256_loadu_pd(ai + i);
+        __m256d b_re = _mm256_loadu_pd(br + i), b_im = _mm256_loadu_pd(bi + i);
+        rr = _mm256_fmadd_pd(a_re, b_re, rr);
+        ii = _mm256_fmadd_pd(a_im, b_im, ii);
+        ri = _mm256_fmadd_pd(a_re, b_im, ri);
+        ir = _mm256_fmadd_pd(a_im, b_re, ir);
+    }
+
+    std::complex<double> tail = dot_scalar(ar + i, ai + i, br + i, bi + i, n - i);
+    return { sum_avx2(_mm256_sub_pd(rr, ii)) + tail.real(), sum_avx2(_mm256_add_pd(ri, ir)) + tail.imag() };
+}
+
+__attribute__((target("avx2,fma")))
+void mvm_avx2(const double* mr, const double* mi, std::size_t rows, std::size_t cols, const double* xr, const double* xi, double* outr, double* outi) {
+    std::size_t i = 0;
+
+    for (; i + 4 <= rows; i += 4) {
+        __m256d re[4], im[4];
+        for (int r = 0; r < 4; r++) { re[r] = _mm256_setzero_pd(); im[r] = _mm256_setzero_pd(); }
+
+        std::size_t j = 0;
+
+        for (; j + 4 <= cols; j += 4) {
+            __m256d x_re = _mm256_loadu_pd(xr + j), x_im = _mm256_loadu_pd(xi + j);
+
+            for (int r = 0; r < 4; r++) {
+                __m256d m_re = _mm256_loadu_pd(mr + (i + r) * cols + j), m_im = _mm256_loadu_pd(mi + (i + r) * cols + j);
+                re[r] = _mm256_fnmadd_pd(m_im, x_im, _mm256_fmadd_pd(m_re, x_re, re[r]));
+                im[r] = _mm256_fmadd_pd(m_im, x_re, _mm256_fmadd_pd(m_re, x_im, im[r]));
+            }
+        }
+
+        for (int r = 0; r < 4; r++) {
+            std::complex<double> tail = dot_scalar(mr + (i + r) * cols + j, mi + (i + r) * cols + j, xr + j, xi + j, cols - j);
+            outr[i + r] = sum_avx2(re[r]) + tail.real();
+            outi[i + r] = sum_avx2(im[r]) + tail.imag();
+        }
+    }
+
+    for (; i < rows; i++) {
+        std::complex<double> value = dot_avx2(mr + i * cols, mi + i * cols, xr, xi, cols);
+        outr[i] = value.real();
+        outi[i] = value.imag();
+    }
+}
+
+__attribute__((target("avx512f")))
+static double sum_avx512(__m512d v) {
+    double lanes[8];
+    _mm512_storeu_pd(lanes, v);
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+__attribute__((target("avx512f")))
+std::complex<double> dot_avx512(const double* ar, const double* ai, const double* br, const double* bi, std::size_t n) {
+    __m512d rr = _mm512_setzero_pd(), ii = _mm512_setzero_pd(), ri = _mm512_setzero_pd(), ir = _mm512_setzero_pd();
+    std::size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m512d a_re = _mm512_loadu_pd(ar + i), a_im = _mm512_loadu_pd(ai + i);
+        __m512d b_re = _mm512_loadu_pd(br + i), b_im = _mm512_loadu_pd(bi + i);
+        rr = _mm512_fmadd_pd(a_re, b_re, rr);
+        ii = _mm512_fmadd_pd(a_im, b_im, ii);
+        ri = _mm512_fmadd_pd(a_re, b_im, ri);
+        ir = _mm512_fmadd_pd(a_im, b_re, ir);
+    }
+
+    std::complex<double> tail = dot_scalar(ar + i, ai + i, br + i, bi + i, n - i);
+    return { sum_avx512(_mm512_sub_pd(rr, ii)) + tail.real(), sum_avx512(_mm512_add_pd(ri, ir)) + tail.imag() };
+}
+
+__attribute__((target("avx512f")))
+void mvm_avx512(const double* mr, const double* mi, std::size_t rows, std::size_t cols, const double* xr, const double* xi, double* outr, double* outi) {
+    std::size_t i = 0;
+
+    for (; i + 4 <= rows; i += 4) {
+        __m512d re[4], im[4];
+        for (int r = 0; r < 4; r++) { re[r] = _mm512_setzero_pd(); im[r] = _mm512_setzero_pd(); }
+
+        std::size_t j = 0;
+
+        for (; j + 8 <= cols; j += 8) {
+            __m512d x_re = _mm512_loadu_pd(xr + j), x_im = _mm512_loadu_pd(xi + j);
+
+            for (int r = 0; r < 4; r++) {
+                __m512d m_re = _mm512_loadu_pd(mr + (i + r) * cols + j), m_im = _mm512_loadu_pd(mi + (i + r) * cols + j);
+                re[r] = _mm512_fnmadd_pd(m_im, x_im, _mm512_fmadd_pd(m_re, x_re, re[r]));
+                im[r] = _mm512_fmadd_pd(m_im, x_re, _mm512_fmadd_pd(m_re, x_im, im[r]));
+            }
+        }
+
+        for (int r = 0; r < 4; r++) {
+            std::complex<double> tail = dot_scalar(mr + (i + r) * cols + j, mi + (i + r) * cols + j, xr + j, xi + j, cols - j);
+            outr[i + r] = sum_avx512(re[r]) + tail.real();
+            outi[i + r] = sum_avx512(im[r]) + tail.imag();
+        }
+    }
+
+    for (; i < rows; i++) {
+        std::complex<double> value = dot_avx512(mr + i * cols, mi + i * cols, xr, xi, cols);
+        outr[i] = value.real();
+        outi[i] = value.imag();
+    }
+}
+#endif
+
+bool complex_isa_supported(ComplexIsa isa) {
+#if defined(__x86_64__)
+    if (isa == ComplexIsa::AVX512) { return __builtin_cpu_supports("avx512f"); }
+    if (isa == ComplexIsa::AVX2) { return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"); }
+#endif
+
+    return isa == ComplexIsa::SCALAR;
+}
+
+// the kernels for isa, which must be supported
+ComplexKernels const& complex_kernels(ComplexIsa isa) {
+    static ComplexKernels const scalar = { ComplexIsa::SCALAR, "scalar", dot_scalar, mvm_scalar };
+
+#if defined(__x86_64__)
+    static ComplexKernels const avx2 = { ComplexIsa::AVX2, "avx2", dot_avx2, mvm_avx2 };
+    static ComplexKernels const avx512 = { ComplexIsa::AVX512, "avx512", dot_avx512, mvm_avx512 };
+
+    if (isa == ComplexIsa::AVX512) { return avx512; }
+    if (isa == ComplexIsa::AVX2) { return avx2; }
+#endif
+
+    return scalar;
+}
+
+// the widest kernels this CPU runs, chosen on first use
+ComplexKernels const& complex_kernels() {
+    static ComplexKernels const& best = complex_kernels(
+        complex_isa_supported(ComplexIsa::AVX512) ? ComplexIsa::AVX512 :
+        complex_isa_supported(ComplexIsa::AVX2) ? ComplexIsa::AVX2 : ComplexIsa::SCALAR);
+
+    return best;
+}
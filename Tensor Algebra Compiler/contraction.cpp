@@ -0,0 +1,195 @@
+//
+//  contraction.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// One pairwise contraction. Operands are numbered in order; the result of step s is
+// operand operand_count + s.
+struct ContractionStep {
+    int left;
+    int right;
+    std::vector<std::string> indices;
+    double flops;
+};
+
+/*
+ Picks the order of pairwise contractions for A[..] @ B[..] @ C[..] @ ... by dynamic
+ programming over subsets of operands. Contracting a subset leaves the indices it shares
+ with the rest of the expression (or the output); joining two subsets costs the product of
+ the extents of every index either side has. Among orders with the fewest FLOPs, the one
+ with the smallest intermediates wins.
+
+ With up to max_operands operands the search is exact, O(3^n); longer chains are
+ contracted left to right.
+ */
+class ContractionPlanner {
+private:
+    static constexpr int max_operands = 16;
+
+    std::vector<std::vector<std::string>> operands;
+    std::vector<std::string> output;
+    std::vector<std::string> index_names;
+    std::vector<double> extents;
+    std::vector<std::uint64_t> operand_indices;
+    std::uint64_t output_indices = 0;
+
+    int index_of(std::string const& name) {
+        for (std::size_t i = 0; i < index_names.size(); i++) {
+            if (index_names[i] == name) { return (int) i; }
+        }
+
+        return -1;
+    }
+
+    double product(std::uint64_t indices) {
+        double p = 1;
+        for (std::size_t i = 0; i < index_names.size(); i++) { if (indices >> i & 1) { p *= extents[i]; } }
+        return p;
+    }
+
+    // the indices a contracted subset of operands still carries
+    std::uint64_t kept(std::uint32_t subset) {
+        std::uint64_t inside = 0, outside = output_indices;
+
+        for (std::size_t k = 0; k < operands.size(); k++) {
+            (subset >> k & 1 ? inside : outside) |= operand_indices[k];
+        }
+
+        return inside & outside;
+    }
+
+    // what a subset brings to the step that joins it: a lone operand still has every index
+    std::uint64_t carried(std::uint32_t subset) {
+        return (subset & (subset - 1)) == 0 ? operand_indices[__builtin_ctz(subset)] : kept(subset);
+    }
+
+    std::vector<std::string> names(std::uint64_t indices) {
+        std::vector<std::string> result;
+        for (std::size_t i = 0; i < index_names.size(); i++) { if (indices >> i & 1) { result.push_back(index_names[i]); } }
+        return result;
+    }
+
+    int unroll(std::uint32_t subset, std::vector<std::uint32_t> const& split, std::vector<ContractionStep>& steps) {
+        if ((subset & (subset - 1)) == 0) {
+            return __builtin_ctz(subset);
+        }
+
+        std::uint32_t full = (1u << operands.size()) - 1;
+        int left = unroll(split[subset], split, steps);
+        int right = unroll(subset ^ split[subset], split, steps);
+        std::uint64_t indices = kept(subset);
+        double flops = product(operand_set(left, steps) | operand_set(right, steps));
+
+        steps.push_back({ left, right, subset == full ? output : names(indices), flops });
+
+        return (int) (operands.size() + steps.size() - 1);
+    }
+
+    std::uint64_t operand_set(int operand, std::vector<ContractionStep> const& steps) {
+        if (operand < (int) operands.size()) { return operand_indices[operand]; }
+
+        std::uint64_t indices = 0;
+        for (std::string const& name : steps[operand - operands.size()].indices) { indices |= 1ull << index_of(name); }
+        return indices;
+    }
+public:
+    // extents holds the size of every index name the operands use
+    ContractionPlanner(std::vector<std::vector<std::string>> operands, std::vector<std::string> output, std::unordered_map<std::string, int> const& extents) {
+        this->operands = operands;
+        this->output = output;
+
+        for (std::vector<std::string> const& operand : operands) {
+            std::uint64_t indices = 0;
+
+            for (std::string const& name : operand) {
+                if (index_of(name) == -1) {
+                    if (index_names.size() == 64) {
+                        LogicalError(-1);
+                    }
+
+                    index_names.push_back(name);
+                    this->extents.push_back(extents.at(name));
+                }
+
+                indices |= 1ull << index_of(name);
+            }
+
+            operand_indices.push_back(indices);
+        }
+
+        for (std::string const& name : output) { output_indices |= 1ull << index_of(name); }
+    }
+
+    // Pairwise steps, the last of which produces the output; none for a single operand
+    std::vector<ContractionStep> plan() {
+        std::vector<ContractionStep> steps;
+        std::size_t n = operands.size();
+
+        if (n > max_operands) {
+            return left_to_right();
+        }
+
+        std::uint32_t full = (1u << n) - 1;
+        std::vector<double> flops(full + 1, 0.0), sizes(full + 1, 0.0);
+        std::vector<std::uint32_t> split(full + 1, 0);
+
+        for (std::uint32_t subset = 1; subset <= full; subset++) {
+            if ((subset & (subset - 1)) == 0) { continue; }
+
+            flops[subset] = -1;
+            std::uint64_t result = kept(subset);
+
+            // each unordered split once: the half holding the lowest operand comes first
+            std::uint32_t low = subset & -subset;
+
+            for (std::uint32_t left = (subset - 1) & subset; left > 0; left = (left - 1) & subset) {
+                if (!(left & low)) { continue; }
+
+                std::uint32_t right = subset ^ left;
+                double cost = flops[left] + flops[right] + product(carried(left) | carried(right));
+                double size = sizes[left] + sizes[right] + product(result);
+
+                if (flops[subset] < 0 || cost < flops[subset] || (cost == flops[subset] && size < sizes[subset])) {
+                    flops[subset] = cost;
+                    sizes[subset] = size;
+                    split[subset] = left;
+                }
+            }
+        }
+
+        if (n > 1) { unroll(full, split, steps); }
+
+        return steps;
+    }
+
+    // The order the expression is written in, for comparison
+    std::vector<ContractionStep> left_to_right() {
+        std::vector<ContractionStep> steps;
+        std::uint64_t indices = operands.empty() ? 0 : operand_indices[0];
+
+        for (std::size_t k = 1; k < operands.size(); k++) {
+            std::uint32_t subset = (std::uint32_t) ((2ull << k) - 1);
+            std::uint64_t result = k + 1 == operands.size() ? output_indices : kept(subset);
+            double flops = product(indices | operand_indices[k]);
+            int left = k == 1 ? 0 : (int) (operands.size() + steps.size() - 1);
+
+            steps.push_back({ left, (int) k, k + 1 == operands.size() ? output : names(result), flops });
+            indices = result;
+        }
+
+        return steps;
+    }
+
+    static double total_flops(std::vector<ContractionStep> const& steps) {
+        double total = 0;
+        for (ContractionStep const& step : steps) { total += step.flops; }
+        return total;
+    }
+};
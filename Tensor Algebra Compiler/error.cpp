@@ -62,6 +62,13 @@ public:
     IllegalIdentifierError(int index) : SemanticError(index) {}
 };
 
+class ShapeError : public Error {
+public:
+    ShapeError(int index, std::string message) : Error(index, {"Shape error: " + message}) {
+        
+    }
+};
+
 class LogicalError : public Error {
 public:
     LogicalError(int index) : Error(index, {"Logical error"}) {
@@ -69,4 +76,19 @@ public:
     }
 };
 
+class RuntimeError : public Error {
+public:
+    RuntimeError(int index) : Error(index, {"Runtime error"}) {
+        
+    }
+};
+
+// a u22angle table that cannot be built, read or looked up
+class TableError : public Error {
+public:
+    TableError(std::string message) : Error(-1, {"Table error: " + message}) {
+        
+    }
+};
+
 class Warning : public Problem {};
@@ -0,0 +1,101 @@
+//
+//  fusion.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+/*
+ Splits every statement's expression into kernels, each one loop nest that writes one
+ tensor. A kernel covers a maximal elementwise subtree (+ - * / unary minus and
+ transposes), so its memory traffic is one read per operand and one write, however many
+ operators it fuses:
+
+    T = a * A + B / c          fused:    1 kernel, reads A and B, writes T
+                               unfused:  4 kernels, 3 temporaries of T's size
+
+ A subtree is its own kernel when it is a contraction (it needs a reduction loop) or
+ when several parents share it (it is computed once rather than once per use). Without
+ fusion every tensor-valued operator is a kernel, as if each ExpressionNode were
+ evaluated into a temporary.
+ */
+class FusionPlan {
+private:
+    ShapeInference& shapes;
+    bool fuse;
+    std::unordered_map<ExpressionNode*, int> parents;
+    std::unordered_set<ExpressionNode*> kernels;
+    std::vector<ExpressionNode*> roots;
+
+    static bool is_leaf(ExpressionNode* n) {
+        return dynamic_cast<TensorNode*>(n) != nullptr || dynamic_cast<IndentifierNode*>(n) != nullptr;
+    }
+
+    void count_parents(ExpressionNode* n) {
+        if (n == nullptr || ++parents[n] > 1) { return; }
+
+        count_parents(n->get_left());
+        count_parents(n->get_right());
+    }
+
+    void mark(ExpressionNode* n, std::unordered_set<ExpressionNode*>& visited) {
+        if (n == nullptr || is_leaf(n) || !visited.insert(n).second) { return; }
+
+        mark(n->get_left(), visited);
+        mark(n->get_right(), visited);
+
+        bool is_contraction = n->get_value().get_token() == "@" && n->get_left() != nullptr;
+        bool is_tensor = !shapes.shape_of(n).empty();
+
+        // a statement's own root is written straight into its variable
+        bool is_root = parents.at(n) == 1 && std::find(roots.begin(), roots.end(), n) != roots.end();
+
+        if (is_contraction || (is_tensor && ((!fuse && !is_root) || parents.at(n) > 1))) {
+            kernels.insert(n);
+        }
+    }
+
+    void collect(ASTNode& n) {
+        if (VarDecNode* var_dec = dynamic_cast<VarDecNode*>(&n)) {
+            roots.push_back(var_dec->get_rhs());
+            return;
+        }
+
+        for (ASTNode* child : n.get_children()) {
+            collect(*child);
+        }
+    }
+public:
+    FusionPlan(ShapeInference& shapes, bool fuse=true) : shapes(shapes) {
+        this->fuse = fuse;
+    }
+
+    void plan(ProgramNode* ast) {
+        collect(*ast);
+
+        for (ExpressionNode* root : roots) {
+            count_parents(root);
+        }
+
+        std::unordered_set<ExpressionNode*> visited;
+
+        for (ExpressionNode* root : roots) {
+            mark(root, visited);
+        }
+    }
+
+    // n is computed into a slot of its own before the kernel that reads it
+    bool is_kernel(ExpressionNode* n) {
+        return kernels.find(n) != kernels.end();
+    }
+
+    // loop nests in the program: one per statement plus one per intermediate kernel
+    std::size_t kernel_count() {
+        return roots.size() + kernels.size();
+    }
+};
@@ -0,0 +1,48 @@
+//
+//  instruction.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <cstdint>
+
+// Push and pop are specialized by segment when the IR is decoded, so the interpreter
+// dispatches once per instruction and never looks at the segment again.
+enum class Opcode : std::uint8_t {
+    PUSH_CONSTANT,
+    PUSH_LOCAL,
+    PUSH_ARGUMENT,
+    PUSH_STATIC,
+    PUSH_THIS,
+    PUSH_THAT,
+    PUSH_POINTER,
+    PUSH_TEMP,
+    POP_LOCAL,
+    POP_ARGUMENT,
+    POP_STATIC,
+    POP_THIS,
+    POP_THAT,
+    POP_POINTER,
+    POP_TEMP,
+    FADD,
+    FSUB,
+    FMULT,
+    FDIV,
+    FNEG,
+    ALLOC,
+    HALT
+};
+
+constexpr int NUM_OPCODES = (int) Opcode::HALT + 1;
+
+// Fixed-width decoded instruction. For PUSH_CONSTANT the operand indexes the constant pool,
+// for every other push/pop it is the segment index.
+struct Instruction {
+    Opcode op;
+    std::uint8_t segment;
+    std::uint16_t reserved;
+    std::uint32_t operand;
+};
+
+static_assert(sizeof(Instruction) == 8, "Instruction must stay 8 bytes");
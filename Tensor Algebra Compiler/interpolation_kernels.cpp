@@ -0,0 +1,202 @@
+//
+//  interpolation_kernels.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <cmath>
+#include <cstdint>
+
+// A u22angle grid as the kernels read it: count^4 cells in row-major order, each six
+// doubles (theta, alpha and beta as real and imaginary parts)
+struct AngleGrid {
+    const double* cells;
+    double lower;
+    double step;
+    std::size_t count;
+};
+
+/*
+ Multilinear interpolation in four dimensions. A query u2 falls in the grid cell with
+ corners q + b, b in {0, 1}^4, where q = floor((u2 - lower) / step); with t the fraction of
+ the way across in each dimension, corner b has weight
+
+    w_b = prod_d (b_d ? t_d : 1 - t_d)
+
+ and the result is the weighted sum of the 16 corners' angles. Queries must lie within
+ the grid; the kernels only clamp q so the far edge uses the last cell.
+
+ The real parts of the angles are phases in (-pi, pi]. With unwrap, each corner's phase is
+ moved by a multiple of 2 pi to within pi of the first corner's before blending, and the
+ result is wrapped back, so a cell the branch cut runs through does not average pi and -pi
+ to 0. Imaginary parts are log magnitudes and are blended as they are.
+
+ out holds six arrays of n: theta, alpha and beta, each as real then imaginary parts. The
+ AVX2 and AVX-512 versions gather the corners of four or eight queries at once.
+ */
+typedef void (*InterpolationKernel)(AngleGrid const& grid, const double* const u2[4], std::size_t n, bool unwrap, double* const out[6]);
+
+// v + 2 pi k nearest reference, with ties to even k as in the SIMD kernels
+inline double unwrap_phase(double v, double reference) {
+    return v - 2 * M_PI * std::nearbyint((v - reference) * (1 / (2 * M_PI)));
+}
+
+// inline, so the SIMD kernels' tails do not call across instruction sets
+inline void interpolate_point(AngleGrid const& grid, double const u[4], bool unwrap, double result[6]) {
+    std::size_t c = grid.count;
+    std::size_t strides[4] = { c * c * c, c * c, c, 1 };
+    std::size_t base = 0;
+    double t[4];
+
+    for (int d = 0; d < 4; d++) {
+        double x = (u[d] - grid.lower) / grid.step;
+        double q = std::min(std::max(std::floor(x), 0.0), (double) (c - 2));
+        t[d] = x - q;
+        base += (std::size_t) q * strides[d];
+    }
+
+    double reference[6] = {};
+    for (int k = 0; k < 6; k++) { result[k] = 0; }
+
+    for (int b = 0; b < 16; b++) {
+        double weight = 1;
+        std::size_t offset = 0;
+
+        for (int d = 0; d < 4; d++) {
+            bool high = b >> (3 - d) & 1;
+            weight *= high ? t[d] : 1 - t[d];
+            offset += high ? strides[d] : 0;
+        }
+
+        const double* cell = grid.cells + 6 * (base + offset);
+
+        for (int k = 0; k < 6; k++) {
+            double v = cell[k];
+
+            if (unwrap && k % 2 == 0) {
+                if (b == 0) { reference[k] = v; }
+                v = unwrap_phase(v, reference[k]);
+            }
+
+            result[k] += weight * v;
+        }
+    }
+
+    if (unwrap) {
+        for (int k = 0; k < 6; k += 2) { result[k] = unwrap_phase(result[k], 0); }
+    }
+}
+
+void interpolate_scalar(AngleGrid const& grid, const double* const u2[4], std::size_t n, bool unwrap, double* const out[6]) {
+    for (std::size_t i = 0; i < n; i++) {
+        double u[4] = { u2[0][i], u2[1][i], u2[2][i], u2[3][i] };
+        double result[6];
+        interpolate_point(grid, u, unwrap, result);
+
+        for (int k = 0; k < 6; k++) { out[k][i] = result[k]; }
+    }
+}
+
+#if defined(__x86_64__)
+// the corner offsets in cells, b_0 c^3 + b_1 c^2 + b_2 c + b_3, times the six doubles a cell holds
+static void corner_offsets(std::size_t c, std::int64_t offsets[16]) {
+    for (int b = 0; b < 16; b++) {
+        offsets[b] = 6 * (std::int64_t) ((b >> 3 & 1) * c * c * c + (b >> 2 & 1) * c * c + (b >> 1 & 1) * c + (b & 1));
+    }
+}
+
+template <typename Ops>
+struct InterpolationMath {
+    typedef typename Ops::V V;
+    typedef typename Ops::Q Q;
+
+    // v less the multiple of 2 pi that brings it nearest reference
+    static void unwrap_phase(V& v, V const& reference) {
+        V turns = Ops::round(Ops::mul(Ops::sub(v, reference), Ops::set(1 / (2 * M_PI))));
+        v = Ops::fnma(turns, Ops::set(2 * M_PI), v);
+    }
+
+    static void interpolate(AngleGrid const& grid, const double* const u2[4], std::size_t n, bool unwrap, double* const out[6]) {
+        constexpr std::size_t W = Ops::width;
+        std::size_t c = grid.count;
+        std::int64_t offsets[16];
+        corner_offsets(c, offsets);
+
+        double strides[4] = { 6.0 * c * c * c, 6.0 * c * c, 6.0 * c, 6.0 };
+        V lower = Ops::set(grid.lower), inverse_step = Ops::set(1 / grid.step);
+        V last = Ops::set((double) (c - 2)), zero = Ops::set(0.0), one = Ops::set(1.0);
+        std::size_t i = 0;
+
+        for (; i + W <= n; i += W) {
+            V base = zero, t[4];
+
+            for (int d = 0; d < 4; d++) {
+                V x = Ops::mul(Ops::sub(Ops::load(u2[d] + i), lower), inverse_step);
+                V q = Ops::min(Ops::max(Ops::floor(x), zero), last);
+                t[d] = Ops::sub(x, q);
+                base = Ops::fma(q, Ops::set(strides[d]), base);
+            }
+
+            Q index = Ops::index(base);
+
+            // side[d][b_d] is a corner's weight factor in dimension d
+            V side[4][2];
+            for (int d = 0; d < 4; d++) { side[d][0] = Ops::sub(one, t[d]); side[d][1] = t[d]; }
+
+            V sum[6], reference[6];
+            for (int k = 0; k < 6; k++) { sum[k] = zero; reference[k] = zero; }
+
+            for (int b = 0; b < 16; b++) {
+                V weight = Ops::mul(Ops::mul(side[0][b >> 3 & 1], side[1][b >> 2 & 1]), Ops::mul(side[2][b >> 1 & 1], side[3][b & 1]));
+                Q corner = Ops::add_index(index, offsets[b]);
+
+                for (int k = 0; k < 6; k++) {
+                    V v = Ops::gather(grid.cells + k, corner);
+
+                    if (unwrap && k % 2 == 0) {
+                        if (b == 0) { reference[k] = v; }
+                        unwrap_phase(v, reference[k]);
+                    }
+
+                    sum[k] = Ops::fma(weight, v, sum[k]);
+                }
+            }
+
+            for (int k = 0; k < 6; k++) {
+                if (unwrap && k % 2 == 0) { unwrap_phase(sum[k], zero); }
+
+                Ops::store(out[k] + i, sum[k]);
+            }
+        }
+
+        for (; i < n; i++) {
+            double u[4] = { u2[0][i], u2[1][i], u2[2][i], u2[3][i] };
+            double result[6];
+            interpolate_point(grid, u, unwrap, result);
+
+            for (int k = 0; k < 6; k++) { out[k][i] = result[k]; }
+        }
+    }
+};
+
+__attribute__((target("avx2,fma"), flatten))
+void interpolate_avx2(AngleGrid const& grid, const double* const u2[4], std::size_t n, bool unwrap, double* const out[6]) {
+    InterpolationMath<Avx2Ops>::interpolate(grid, u2, n, unwrap, out);
+}
+
+__attribute__((target("avx512f"), flatten))
+void interpolate_avx512(AngleGrid const& grid, const double* const u2[4], std::size_t n, bool unwrap, double* const out[6]) {
+    InterpolationMath<Avx512Ops>::interpolate(grid, u2, n, unwrap, out);
+}
+#endif
+
+// the interpolation kernel for isa, which must be supported
+InterpolationKernel interpolation_kernel(ComplexIsa isa) {
+#if defined(__x86_64__)
+    if (isa == ComplexIsa::AVX512) { return interpolate_avx512; }
+    if (isa == ComplexIsa::AVX2) { return interpolate_avx2; }
+#endif
+
+    return interpolate_scalar;
+}
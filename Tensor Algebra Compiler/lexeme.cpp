@@ -0,0 +1,43 @@
+//
+//  lexeme.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <string_view>
+
+// A token as it sits in the source: a view into the tokenizer's input, valid until the next advance()
+class Lexeme {
+private:
+    std::string_view text;
+    TokenType type;
+    std::size_t offset;
+public:
+    Lexeme() {
+        type = TokenType::T_NONE;
+        offset = 0;
+    }
+
+    Lexeme(std::string_view text, TokenType type, std::size_t offset) {
+        this->text = text;
+        this->type = type;
+        this->offset = offset;
+    }
+
+    std::string_view get_text() const {
+        return text;
+    }
+
+    TokenType get_type() const {
+        return type;
+    }
+
+    std::size_t get_offset() const {
+        return offset;
+    }
+
+    bool empty() const {
+        return text.empty();
+    }
+};
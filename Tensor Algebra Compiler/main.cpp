@@ -9,7 +9,11 @@
 #include <string>
 
 #include "code_generator.cpp"
+#include "native_generator.cpp"
+#include "native_module.cpp"
 #include "chip_sim.cpp"
+#include "vm.cpp"
+#include "benchmark.cpp"
 
 
 void reconstruct(std::vector<double>& tree, int index=0, int indents=0) {
@@ -25,19 +29,209 @@ void reconstruct(std::vector<double>& tree, int index=0, int indents=0) {
     reconstruct(tree, 2 * index + 2, indents=indents + 1);
 }
 
-int main(int argc, const char* argv[]) {
-    std::string fname_base = "expression";
-    std::string path_base = "/Users/sathvik.redrouthu/Desktop/Procyon/CS/Tensor Algebra Compiler/Tables/";
-    std::string in_path = path_base + fname_base + ".apollo";
-    std::string out_path_xml = path_base + fname_base + ".xml";
-    std::string out_path_code = path_base + fname_base + ".ir";
-//
-    Tokenizer tokenizer = Tokenizer(in_path);
-    Parser parser = Parser(in_path, out_path_xml);
-    ProgramNode ast = parser.parse_compilation_unit();
-    CodeGenerator code_generator = CodeGenerator(ast, out_path_code);
+void usage() {
+    std::cerr << "usage: apollo <source.apollo | -> [-O0] [-o out.irb] [--ir out.ir] [--cpp out.cpp] [--xml out.xml] [--trace out.trace]" << std::endl;
+    std::cerr << "       apollo --run <program.irb | program.ir>" << std::endl;
+    std::cerr << "       apollo --run-native <source.apollo> [-O0]" << std::endl;
+    std::cerr << "       apollo --disassemble <program.irb>" << std::endl;
+    std::cerr << "       apollo --convert-table <table.csv> <table.apt> [float32]" << std::endl;
+    std::cerr << "       apollo --bench vm <program.irb | program.ir>..." << std::endl;
+    std::cerr << "       apollo --bench fusion [n]" << std::endl;
+    std::cerr << "       apollo --bench sparse [n] [density]" << std::endl;
+    std::cerr << "       apollo --bench chip [n]" << std::endl;
+    std::cerr << "       apollo --bench u2 [n]" << std::endl;
+    std::cerr << "       apollo --bench table [prec]" << std::endl;
+    std::cerr << "       apollo --bench interpolate [prec] [n]" << std::endl;
+    std::cerr << "       apollo --bench table-load <table.csv>" << std::endl;
+    std::cerr << "       apollo --bench table-init [prec] [threads]" << std::endl;
+    std::cerr << "       apollo --bench table-lazy [prec] [threads]" << std::endl;
+    std::cerr << "       apollo --bench mesh [n] [batch]" << std::endl;
+    std::cerr << "       apollo --bench jacobian [prec] [n]" << std::endl;
+    std::cerr << "       apollo --bench solver [n] [iterations]" << std::endl;
+    std::cerr << "       apollo --bench index [prec] [n]" << std::endl;
+    std::cerr << "       apollo --bench gemm [n] [batch]" << std::endl;
+    exit(1);
+}
+
+int run_program(std::string path) {
+    VM vm = VM();
+    vm.load_file(path);
+    vm.run();
+    
+    std::vector<double> const& locals = vm.get_locals();
+    
+    for (std::size_t i = 0; i < locals.size(); i++) {
+        std::cout << "local " << i << " = " << locals[i] << std::endl;
+    }
+    
+    return 0;
+}
+
+// Compiles the program to a shared object, runs it once and prints every variable
+int run_native(std::string path, bool optimize) {
+    Arena arena;
+    Parser parser = Parser(path, arena);
+    ProgramNode* ast = parser.parse_compilation_unit();
+    if (optimize) { Optimizer(arena).optimize(ast); }
+    ShapeInference shapes;
+    shapes.infer(ast);
+    NativeGenerator generator = NativeGenerator(ast, shapes, optimize);
+    NativeModule module = NativeModule(generator.generate_code());
+    std::vector<double> storage = module.run();
+    
+    for (NativeVariable const& var : generator.get_variables()) {
+        std::cout << var.name;
+        for (int d : var.dims) { std::cout << "[" << d << "]"; }
+        std::cout << " =";
+        for (double value : var.read(storage.data())) { std::cout << " " << value; }
+        std::cout << std::endl;
+    }
+    
+    return 0;
+}
+
+int disassemble(std::string path) {
+    Program::load_file(path).disassemble(std::cout);
+    
+    return 0;
+}
+
+// Writes a u22angle CSV as a table file, which loads with one mmap
+int convert_table(std::string in_path, std::string out_path, TableDtype dtype) {
+    Table table = Table();
+    table.load(in_path);
+    table.write_table(out_path, dtype);
+    
+    std::cout << table.size() << " of " << table.get_count() << "^4 cells, from " << table.get_lower() << " at step " << table.get_step() << std::endl;
+    
+    return 0;
+}
 
-    code_generator.generate_code();
+int run_benchmark(std::string name, std::vector<std::string> args) {
+    if (name == "vm" && !args.empty()) {
+        bench_vm(args);
+    } else if (name == "fusion" && args.size() <= 1) {
+        bench_fusion(args.empty() ? 2048 : std::stoi(args[0]));
+    } else if (name == "sparse" && args.size() <= 2) {
+        bench_sparse(args.empty() ? 512 : std::stoi(args[0]), args.size() < 2 ? 0.01 : std::stod(args[1]));
+    } else if (name == "chip" && args.size() <= 1) {
+        bench_chip(args.empty() ? 512 : std::stoi(args[0]));
+    } else if (name == "u2" && args.size() <= 1) {
+        bench_u2(args.empty() ? 1 << 20 : std::stoi(args[0]));
+    } else if (name == "table" && args.size() <= 1) {
+        bench_table(args.empty() ? 0.5 : std::stod(args[0]));
+    } else if (name == "interpolate" && args.size() <= 2) {
+        bench_interpolate(args.empty() ? 0.5 : std::stod(args[0]), args.size() < 2 ? 1 << 16 : std::stoi(args[1]));
+    } else if (name == "table-load" && args.size() == 1) {
+        bench_table_load(args[0]);
+    } else if (name == "table-init" && args.size() <= 2) {
+        bench_table_init(args.empty() ? 0.25 : std::stod(args[0]), args.size() < 2 ? thread_pool().size() : std::stoi(args[1]));
+    } else if (name == "mesh" && args.size() <= 2) {
+        bench_mesh(args.empty() ? 1024 : std::stoi(args[0]), args.size() < 2 ? 256 : std::stoi(args[1]));
+    } else if (name == "jacobian" && args.size() <= 2) {
+        bench_jacobian(args.empty() ? 0.25 : std::stod(args[0]), args.size() < 2 ? 1 << 16 : std::stoi(args[1]));
+    } else if (name == "table-lazy" && args.size() <= 2) {
+        bench_table_lazy(args.empty() ? 0.001 : std::stod(args[0]), args.size() < 2 ? thread_pool().size() : std::stoi(args[1]));
+    } else if (name == "solver" && args.size() <= 2) {
+        bench_solver(args.empty() ? 1 << 16 : std::stoi(args[0]), args.size() < 2 ? 2 : std::stoi(args[1]));
+    } else if (name == "index" && args.size() <= 2) {
+        bench_index(args.empty() ? 0.25 : std::stod(args[0]), args.size() < 2 ? 1 << 14 : std::stoi(args[1]));
+    } else if (name == "gemm" && args.size() <= 2) {
+        bench_gemm(args.empty() ? 256 : std::stoi(args[0]), args.size() < 2 ? 4096 : std::stoi(args[1]));
+    } else {
+        usage();
+    }
+    
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 2) { usage(); }
+    
+    if (std::string(argv[1]) == "--run" && argc == 3) {
+        return run_program(argv[2]);
+    } else if (std::string(argv[1]) == "--run-native" && (argc == 3 || (argc == 4 && std::string(argv[3]) == "-O0"))) {
+        return run_native(argv[2], argc == 3);
+    } else if (std::string(argv[1]) == "--disassemble" && argc == 3) {
+        return disassemble(argv[2]);
+    } else if (std::string(argv[1]) == "--convert-table" && (argc == 4 || (argc == 5 && std::string(argv[4]) == "float32"))) {
+        return convert_table(argv[2], argv[3], argc == 5 ? TableDtype::FLOAT32 : TableDtype::FLOAT64);
+    } else if (std::string(argv[1]) == "--bench" && argc >= 3) {
+        return run_benchmark(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+    }
+    
+    std::string in_path = argv[1];
+    std::string fname_base = in_path == "-" ? "out" : in_path.substr(0, in_path.rfind(".apollo"));
+    std::string out_path_code = fname_base + ".irb";
+    std::string out_path_ir = "";
+    std::string out_path_cpp = "";
+    bool optimize = true;
+    std::string out_path_xml = "";
+    std::string out_path_trace = "";
+    
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        
+        if (arg == "-O0") {
+            optimize = false;
+            continue;
+        }
+        
+        if (i + 1 >= argc) { usage(); }
+        
+        if (arg == "-o") {
+            out_path_code = argv[++i];
+        } else if (arg == "--ir") {
+            out_path_ir = argv[++i];
+        } else if (arg == "--cpp") {
+            out_path_cpp = argv[++i];
+        } else if (arg == "--xml") {
+            out_path_xml = argv[++i];
+        } else if (arg == "--trace") {
+            out_path_trace = argv[++i];
+        } else {
+            usage();
+        }
+    }
+    
+    // the parse tree is debug output: nothing is written unless asked for
+    std::unique_ptr<ParseSink> sink;
+    
+    if (out_path_xml != "") {
+        sink = std::make_unique<XmlParseSink>(out_path_xml);
+    } else if (out_path_trace != "") {
+        sink = std::make_unique<TraceParseSink>(out_path_trace);
+    }
+    
+    Arena arena;
+    Parser parser = Parser(in_path, arena, sink.get());
+    ProgramNode* ast = parser.parse_compilation_unit();
+    sink.reset();
+    
+    if (optimize) {
+        Optimizer(arena).optimize(ast);
+    }
+    
+    ShapeInference shapes;
+    shapes.infer(ast);
+    
+    // the native source first: contractions and tensor arithmetic only run natively, and the VM
+    // backend rejects them
+    if (out_path_cpp != "") {
+        std::ofstream out(out_path_cpp);
+        out << NativeGenerator(ast, shapes, optimize).generate_code();
+    }
+    
+    CodeGenerator code_generator = CodeGenerator(ast, shapes);
+    Program program = code_generator.generate_code();
+    
+    program.write(out_path_code);
+    
+    // the text IR is only a disassembly of the bytecode
+    if (out_path_ir != "") {
+        std::ofstream out(out_path_ir);
+        program.disassemble(out);
+    }
 //    ast.print();
     
     
@@ -69,11 +263,11 @@ int main(int argc, const char* argv[]) {
 //    t.init_u22angle(0.5);
 //    std::vector<double> u2 = {5, 5, 5, 5};
 //    std::vector<std::complex<double>> u2_angles = t.lookup_u2_angles(u2);
-//    std::vector<std::vector<std::complex<double>>> t_u2 = tachyon.get_u2(u2_angles);
+//    Mat2c t_u2 = tachyon.get_u2(u2_angles);
 //
 //
-//    for (int i = 0; i < t_u2.size(); i++) {
-//        for (int j = 0; j < t_u2[i].size(); j++) { std::cout << t_u2[i][j] << ","; }
+//    for (int i = 0; i < 2; i++) {
+//        for (int j = 0; j < 2; j++) { std::cout << t_u2(i, j) << ","; }
 //        std::cout << "\n";
 //    }
     
@@ -0,0 +1,246 @@
+//
+//  mat2c.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <array>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+/*
+ A 2x2 complex matrix by value: 64 bytes, no allocation, and usable in constant
+ expressions. Entries are stored as real parts then imaginary parts, row-major:
+
+    re = {a, b, c, d}    im = {a, b, c, d}    for    [[a, b], [c, d]]
+
+ Arithmetic is written out on doubles, since std::complex's operators are not constexpr
+ before C++20.
+ */
+struct Mat2c {
+    double re[4] = {};
+    double im[4] = {};
+
+    constexpr Mat2c() {}
+
+    constexpr Mat2c(std::complex<double> a, std::complex<double> b, std::complex<double> c, std::complex<double> d) {
+        set(0, 0, a);
+        set(0, 1, b);
+        set(1, 0, c);
+        set(1, 1, d);
+    }
+
+    static constexpr Mat2c identity() {
+        return Mat2c(1.0, 0.0, 0.0, 1.0);
+    }
+
+    constexpr std::complex<double> operator()(int i, int j) const {
+        return { re[2 * i + j], im[2 * i + j] };
+    }
+
+    constexpr void set(int i, int j, std::complex<double> value) {
+        re[2 * i + j] = value.real();
+        im[2 * i + j] = value.imag();
+    }
+
+    constexpr Mat2c operator*(Mat2c const& other) const {
+        Mat2c product;
+
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                int k0 = 2 * i, k1 = 2 * i + 1, l0 = j, l1 = 2 + j;
+                product.re[2 * i + j] = re[k0] * other.re[l0] - im[k0] * other.im[l0] + re[k1] * other.re[l1] - im[k1] * other.im[l1];
+                product.im[2 * i + j] = re[k0] * other.im[l0] + im[k0] * other.re[l0] + re[k1] * other.im[l1] + im[k1] * other.re[l1];
+            }
+        }
+
+        return product;
+    }
+
+    // the conjugate transpose, which is the inverse of a unitary matrix
+    constexpr Mat2c adjoint() const {
+        Mat2c result;
+
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                result.re[2 * j + i] = re[2 * i + j];
+                result.im[2 * j + i] = -im[2 * i + j];
+            }
+        }
+
+        return result;
+    }
+
+    constexpr std::array<std::complex<double>, 2> apply(std::array<std::complex<double>, 2> const& x) const {
+        double x0r = x[0].real(), x0i = x[0].imag(), x1r = x[1].real(), x1i = x[1].imag();
+
+        return {
+            std::complex<double>(re[0] * x0r - im[0] * x0i + re[1] * x1r - im[1] * x1i, re[0] * x0i + im[0] * x0r + re[1] * x1i + im[1] * x1r),
+            std::complex<double>(re[2] * x0r - im[2] * x0i + re[3] * x1r - im[3] * x1i, re[2] * x0i + im[2] * x0r + re[3] * x1i + im[3] * x1r)
+        };
+    }
+
+    // the nested form the rest of the simulator used to pass around
+    std::vector<std::vector<std::complex<double>>> to_vector() const {
+        return { { (*this)(0, 0), (*this)(0, 1) }, { (*this)(1, 0), (*this)(1, 1) } };
+    }
+};
+
+static_assert(sizeof(Mat2c) == 64, "a Mat2c is one cache line");
+static_assert((Mat2c::identity() * Mat2c::identity()).re[3] == 1.0, "Mat2c works in constant expressions");
+
+/*
+ The U2 of one Mach-Zehnder interferometer from its angles, with e_x = exp(-i x):
+
+    [[ e_alpha (e_theta - 1) / 2,   i e_alpha (e_theta + 1) / 2 ],
+     [ i e_beta (e_theta + 1) / 2,  e_beta (1 - e_theta) / 2    ]]
+
+ The angles are complex, so exp(-i (x + i y)) = exp(y) (cos x - i sin x) takes one sincos
+ and one exp per angle.
+ */
+inline Mat2c u2_from_exponentials(std::complex<double> e_theta, std::complex<double> e_alpha, std::complex<double> e_beta) {
+    using namespace std::complex_literals;
+
+    return Mat2c(0.5 * e_alpha * (e_theta - 1.0), 0.5i * e_alpha * (e_theta + 1.0),
+                 0.5i * e_beta * (e_theta + 1.0), 0.5 * e_beta * (1.0 - e_theta));
+}
+
+inline Mat2c u2_from_angles(std::complex<double> theta, std::complex<double> alpha, std::complex<double> beta) {
+    using namespace std::complex_literals;
+
+    return u2_from_exponentials(std::exp(-1i * theta), std::exp(-1i * alpha), std::exp(-1i * beta));
+}
+
+// out[k] is the U2 of (theta[k], alpha[k], beta[k]) for k < n; every angle is split into
+// an array of real parts and one of imaginary parts
+typedef void (*U2Kernel)(const double* theta_re, const double* theta_im, const double* alpha_re, const double* alpha_im,
+                         const double* beta_re, const double* beta_im, std::size_t n, Mat2c* out);
+
+void u2_scalar(const double* theta_re, const double* theta_im, const double* alpha_re, const double* alpha_im,
+               const double* beta_re, const double* beta_im, std::size_t n, Mat2c* out) {
+    for (std::size_t k = 0; k < n; k++) {
+        out[k] = u2_from_angles({ theta_re[k], theta_im[k] }, { alpha_re[k], alpha_im[k] }, { beta_re[k], beta_im[k] });
+    }
+}
+
+#if defined(__x86_64__)
+/*
+ sincos and exp on SIMD registers, written once for AVX2 and AVX-512 through the
+ operations of simd_ops.cpp. sincos reduces x by multiples of pi/2 in three parts (exact for
+ |x| < 2^20) and evaluates fdlibm's kernels on [-pi/4, pi/4]; exp reduces by multiples of
+ ln 2 and scales a degree-13 Taylor polynomial by 2^n. Both stay within a few ulp.
+ */
+
+template <typename Ops>
+struct U2Math {
+    typedef typename Ops::V V;
+
+    static void sincos(V const& x, V& sin, V& cos) {
+        V j = Ops::round(Ops::mul(x, Ops::set(0.63661977236758134308)));
+        V r = Ops::fnma(j, Ops::set(1.57079632673412561417e+00), x);
+        r = Ops::fnma(j, Ops::set(6.07710050630396597660e-11), r);
+        r = Ops::fnma(j, Ops::set(2.02226624871116645580e-21), r);
+
+        V z = Ops::mul(r, r), s, c;
+        polynomial<Ops>(z, { -1.66666666666666324348e-01, 8.33333333332248946124e-03, -1.98412698298579493134e-04,
+                        2.75573137070700676789e-06, -2.50507602534068634195e-08, 1.58969099521155010221e-10 }, s);
+        polynomial<Ops>(z, { 4.16666666666666019037e-02, -1.38888888888741095749e-03, 2.48015872894767294178e-05,
+                        -2.75573143513906633035e-07, 2.08757232129817482790e-09, -1.13596475577881948265e-11 }, c);
+        s = Ops::fma(Ops::mul(r, z), s, r);
+        c = Ops::fma(Ops::mul(z, z), c, Ops::fnma(Ops::set(0.5), z, Ops::set(1.0)));
+
+        // quadrant q of x: sin, cos = s, c / c, -s / -s, -c / -c, s
+        auto q = Ops::quadrant(j);
+        auto swap = Ops::bit(q, 1);
+        sin = Ops::blend(s, c, swap);
+        cos = Ops::blend(c, s, swap);
+        sin = Ops::negate_if(sin, Ops::bit(q, 2));
+        cos = Ops::negate_if(cos, Ops::bit(Ops::add_quadrant(q, 1), 2));
+    }
+
+    static void exp(V const& x, V& result) {
+        V y = Ops::max(Ops::min(x, Ops::set(709.0)), Ops::set(-708.0));
+
+        V n = Ops::round(Ops::mul(y, Ops::set(1.4426950408889634074)));
+        V r = Ops::fnma(n, Ops::set(6.93147180369123816490e-01), y);
+        r = Ops::fnma(n, Ops::set(1.90821492927058770002e-10), r);
+
+        polynomial<Ops>(r, { 1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320, 1.0 / 362880,
+                        1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600, 1.0 / 6227020800 }, result);
+        result = Ops::mul(result, Ops::pow2(n));
+    }
+
+    // exp(-i (x + i y)) = exp(y) (cos x - i sin x)
+    static void exponential(V const& x, V const& y, V& re, V& im) {
+        V sin, cos, scale;
+        sincos(x, sin, cos);
+        exp(y, scale);
+        re = Ops::mul(scale, cos);
+        im = Ops::neg(Ops::mul(scale, sin));
+    }
+
+    static void u2(const double* theta_re, const double* theta_im, const double* alpha_re, const double* alpha_im,
+                   const double* beta_re, const double* beta_im, std::size_t n, Mat2c* out) {
+        constexpr std::size_t W = Ops::width;
+        std::size_t k = 0;
+
+        for (; k + W <= n; k += W) {
+            V t_re, t_im, a_re, a_im, b_re, b_im;
+            exponential(Ops::load(theta_re + k), Ops::load(theta_im + k), t_re, t_im);
+            exponential(Ops::load(alpha_re + k), Ops::load(alpha_im + k), a_re, a_im);
+            exponential(Ops::load(beta_re + k), Ops::load(beta_im + k), b_re, b_im);
+
+            V half = Ops::set(0.5), one = Ops::set(1.0);
+            V minus_re = Ops::mul(half, Ops::sub(t_re, one)), minus_im = Ops::mul(half, t_im);
+            V plus_re = Ops::mul(half, Ops::add(t_re, one)), plus_im = Ops::mul(half, t_im);
+
+            // a = e_alpha (e_theta - 1) / 2, b = i e_alpha (e_theta + 1) / 2, and likewise with e_beta
+            double lanes[8][W];
+            Ops::store(lanes[0], Ops::fnma(a_im, minus_im, Ops::mul(a_re, minus_re)));
+            Ops::store(lanes[4], Ops::fma(a_im, minus_re, Ops::mul(a_re, minus_im)));
+            Ops::store(lanes[1], Ops::neg(Ops::fma(a_im, plus_re, Ops::mul(a_re, plus_im))));
+            Ops::store(lanes[5], Ops::fnma(a_im, plus_im, Ops::mul(a_re, plus_re)));
+            Ops::store(lanes[2], Ops::neg(Ops::fma(b_im, plus_re, Ops::mul(b_re, plus_im))));
+            Ops::store(lanes[6], Ops::fnma(b_im, plus_im, Ops::mul(b_re, plus_re)));
+            Ops::store(lanes[3], Ops::neg(Ops::fnma(b_im, minus_im, Ops::mul(b_re, minus_re))));
+            Ops::store(lanes[7], Ops::neg(Ops::fma(b_im, minus_re, Ops::mul(b_re, minus_im))));
+
+            for (std::size_t l = 0; l < W; l++) {
+                for (int e = 0; e < 4; e++) {
+                    out[k + l].re[e] = lanes[e][l];
+                    out[k + l].im[e] = lanes[4 + e][l];
+                }
+            }
+        }
+
+        u2_scalar(theta_re + k, theta_im + k, alpha_re + k, alpha_im + k, beta_re + k, beta_im + k, n - k, out + k);
+    }
+};
+
+__attribute__((target("avx2,fma"), flatten))
+void u2_avx2(const double* theta_re, const double* theta_im, const double* alpha_re, const double* alpha_im,
+             const double* beta_re, const double* beta_im, std::size_t n, Mat2c* out) {
+    U2Math<Avx2Ops>::u2(theta_re, theta_im, alpha_re, alpha_im, beta_re, beta_im, n, out);
+}
+
+__attribute__((target("avx512f"), flatten))
+void u2_avx512(const double* theta_re, const double* theta_im, const double* alpha_re, const double* alpha_im,
+               const double* beta_re, const double* beta_im, std::size_t n, Mat2c* out) {
+    U2Math<Avx512Ops>::u2(theta_re, theta_im, alpha_re, alpha_im, beta_re, beta_im, n, out);
+}
+
+#endif
+
+// the U2 kernel for isa, which must be supported
+U2Kernel u2_kernel(ComplexIsa isa) {
+#if defined(__x86_64__)
+    if (isa == ComplexIsa::AVX512) { return u2_avx512; }
+    if (isa == ComplexIsa::AVX2) { return u2_avx2; }
+#endif
+
+    return u2_scalar;
+}
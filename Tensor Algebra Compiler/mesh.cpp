@@ -0,0 +1,196 @@
+//
+//  mesh.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <algorithm>
+#include <complex>
+#include <vector>
+
+// rows m and m + 1 of a column chunk, through one 2x2 block:
+// [x, y] = [[u00, u01], [u10, u11]] [x, y], columns k0 <= k < n
+inline void rotate_scalar(Mat2c const& u, double* xr, double* xi, double* yr, double* yi, std::size_t k0, std::size_t n) {
+    for (std::size_t k = k0; k < n; k++) {
+        double a = xr[k], b = xi[k], c = yr[k], d = yi[k];
+        xr[k] = u.re[0] * a - u.im[0] * b + u.re[1] * c - u.im[1] * d;
+        xi[k] = u.re[0] * b + u.im[0] * a + u.re[1] * d + u.im[1] * c;
+        yr[k] = u.re[2] * a - u.im[2] * b + u.re[3] * c - u.im[3] * d;
+        yi[k] = u.re[2] * b + u.im[2] * a + u.re[3] * d + u.im[3] * c;
+    }
+}
+
+// One layer of a mesh over a chunk of width columns: block b rotates rows modes[b] and
+// modes[b] + 1, where row r starts at re + r stride and im + r stride
+typedef void (*LayerKernel)(const Mat2c* blocks, const std::size_t* modes, std::size_t count, double* re, double* im, std::size_t stride, std::size_t width);
+
+void layer_scalar(const Mat2c* blocks, const std::size_t* modes, std::size_t count, double* re, double* im, std::size_t stride, std::size_t width) {
+    for (std::size_t b = 0; b < count; b++) {
+        double* xr = re + modes[b] * stride;
+        double* xi = im + modes[b] * stride;
+        rotate_scalar(blocks[b], xr, xi, xr + stride, xi + stride, 0, width);
+    }
+}
+
+#if defined(__x86_64__)
+template <typename Ops>
+struct MeshMath {
+    typedef typename Ops::V V;
+
+    // a w + b z for complex a, b given by parts
+    static void combine(V const& ar, V const& ai, V const& wr, V const& wi, V const& br, V const& bi, V const& zr, V const& zi, V& outr, V& outi) {
+        outr = Ops::fnma(bi, zi, Ops::fma(br, zr, Ops::fnma(ai, wi, Ops::mul(ar, wr))));
+        outi = Ops::fma(bi, zr, Ops::fma(br, zi, Ops::fma(ai, wr, Ops::mul(ar, wi))));
+    }
+
+    static void layer(const Mat2c* blocks, const std::size_t* modes, std::size_t count, double* re, double* im, std::size_t stride, std::size_t width) {
+        constexpr std::size_t W = Ops::width;
+
+        for (std::size_t b = 0; b < count; b++) {
+            Mat2c const& u = blocks[b];
+            double* xr = re + modes[b] * stride;
+            double* xi = im + modes[b] * stride;
+            double* yr = xr + stride;
+            double* yi = xi + stride;
+
+            V u00r = Ops::set(u.re[0]), u00i = Ops::set(u.im[0]), u01r = Ops::set(u.re[1]), u01i = Ops::set(u.im[1]);
+            V u10r = Ops::set(u.re[2]), u10i = Ops::set(u.im[2]), u11r = Ops::set(u.re[3]), u11i = Ops::set(u.im[3]);
+            std::size_t k = 0;
+
+            for (; k + W <= width; k += W) {
+                V x_r = Ops::load(xr + k), x_i = Ops::load(xi + k), y_r = Ops::load(yr + k), y_i = Ops::load(yi + k), nr, ni;
+                combine(u00r, u00i, x_r, x_i, u01r, u01i, y_r, y_i, nr, ni);
+                Ops::store(xr + k, nr);
+                Ops::store(xi + k, ni);
+                combine(u10r, u10i, x_r, x_i, u11r, u11i, y_r, y_i, nr, ni);
+                Ops::store(yr + k, nr);
+                Ops::store(yi + k, ni);
+            }
+
+            rotate_scalar(u, xr, xi, yr, yi, k, width);
+        }
+    }
+};
+
+__attribute__((target("avx2,fma"), flatten))
+void layer_avx2(const Mat2c* blocks, const std::size_t* modes, std::size_t count, double* re, double* im, std::size_t stride, std::size_t width) {
+    MeshMath<Avx2Ops>::layer(blocks, modes, count, re, im, stride, width);
+}
+
+__attribute__((target("avx512f"), flatten))
+void layer_avx512(const Mat2c* blocks, const std::size_t* modes, std::size_t count, double* re, double* im, std::size_t stride, std::size_t width) {
+    MeshMath<Avx512Ops>::layer(blocks, modes, count, re, im, stride, width);
+}
+
+#endif
+
+// the layer kernel for isa, which must be supported
+LayerKernel layer_kernel(ComplexIsa isa) {
+#if defined(__x86_64__)
+    if (isa == ComplexIsa::AVX512) { return layer_avx512; }
+    if (isa == ComplexIsa::AVX2) { return layer_avx2; }
+#endif
+
+    return layer_scalar;
+}
+
+/*
+ How the 2x2 blocks of a mesh over n modes are laid out. Both have n (n - 1) / 2 blocks,
+ and a block on mode m mixes modes m and m + 1.
+
+    CLEMENTS    n layers, alternately on the even and the odd pairs of modes: a
+                rectangle of depth n
+    RECK        a triangle whose diagonal k runs from mode k down to mode 0, k < n - 1;
+                block (k, m) goes in layer 2k - m, for a depth of 2n - 3
+ */
+enum class MeshStyle {
+    CLEMENTS,
+    RECK
+};
+
+/*
+ A photonic mesh: layers of U2 blocks over n modes, the blocks of a layer on disjoint
+ pairs of modes. It is applied to states by rotating pairs of rows in place, layer after
+ layer. That is 2 n depth complex multiply-adds per state, of the same order as the n^2
+ of a dense mvm since depth is about n, so it does not apply a state more cheaply. What
+ it saves is the dense n x n unitary: its n^2 memory and the one-time work of building it.
+ */
+class Mesh {
+private:
+    std::size_t n = 0;
+    std::vector<std::size_t> modes;
+    std::vector<std::size_t> layers;
+    std::vector<Mat2c> blocks;
+
+    void add_layer(std::vector<std::size_t> const& layer_modes) {
+        modes.insert(modes.end(), layer_modes.begin(), layer_modes.end());
+        layers.push_back(modes.size());
+    }
+public:
+    // every block starts as the identity
+    Mesh(std::size_t mode_count, MeshStyle style) : n(mode_count), layers({0}) {
+        std::size_t depth = style == MeshStyle::CLEMENTS ? n : (n < 2 ? 0 : 2 * n - 3);
+
+        for (std::size_t l = 0; l < depth; l++) {
+            std::vector<std::size_t> layer_modes;
+
+            for (std::size_t m = l % 2; m + 1 < n; m += 2) {
+                // a Reck layer l holds block (k, m) with 2k - m = l and k <= n - 2
+                if (style == MeshStyle::RECK && (m > l || (l + m) / 2 > n - 2)) { continue; }
+                layer_modes.push_back(m);
+            }
+
+            add_layer(layer_modes);
+        }
+
+        blocks.assign(modes.size(), Mat2c::identity());
+    }
+
+    std::size_t mode_count() const { return n; }
+    std::size_t block_count() const { return blocks.size(); }
+    std::size_t depth() const { return layers.size() - 1; }
+
+    // the upper of the two modes block b mixes
+    std::size_t mode_of(std::size_t b) const {
+        return modes[b];
+    }
+
+    // the blocks in order, layer by layer: block_count() of them
+    Mat2c* get_blocks() { return blocks.data(); }
+    const Mat2c* get_blocks() const { return blocks.data(); }
+
+    /*
+     Every column of states, which has mode_count() rows, becomes the mesh applied to it.
+     The columns go in chunks of about 2 MiB, so that a chunk's rows stay in the L2
+     cache through all the layers, and the chunks are shared out over pool.
+     */
+    void apply(ComplexMatrix& states, ThreadPool& pool=thread_pool()) const {
+        if (states.row_count() != n) {
+            RuntimeError(-1);
+        }
+
+        static LayerKernel const kernel = layer_kernel(complex_kernels().isa);
+        std::size_t columns = states.col_count();
+        std::size_t width = std::max<std::size_t>(8, (2 << 20) / 16 / std::max<std::size_t>(n, 1) / 8 * 8);
+        double* re = states.real();
+        double* im = states.imag();
+
+        pool.parallel_for((columns + width - 1) / width, [&](std::size_t chunk) {
+            std::size_t first = chunk * width;
+            std::size_t chunk_width = std::min(width, columns - first);
+
+            for (std::size_t l = 0; l + 1 < layers.size(); l++) {
+                kernel(&blocks[layers[l]], &modes[layers[l]], layers[l + 1] - layers[l], re + first, im + first, columns, chunk_width);
+            }
+        });
+    }
+
+    // the dense n x n matrix of the whole mesh
+    ComplexMatrix matrix() const {
+        ComplexMatrix result = ComplexMatrix(n, n);
+        for (std::size_t i = 0; i < n; i++) { result.set(i, i, 1.0); }
+        apply(result);
+        return result;
+    }
+};
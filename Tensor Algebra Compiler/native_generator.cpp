@@ -0,0 +1,1063 @@
+//
+//  native_generator.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <unordered_map>
+
+#include "fusion.cpp"
+#include "contraction.cpp"
+
+// A variable of the generated program: volume() doubles at offset in the storage block,
+// or a literal kept packed in static arrays outside it
+struct NativeVariable {
+    std::string name;
+    std::vector<int> dims;
+    std::size_t offset;
+    SparseTensor const* packed = nullptr;
+
+    std::size_t volume() const {
+        std::size_t v = 1;
+        for (int d : dims) { v *= d; }
+        return v;
+    }
+
+    // the values in row-major order
+    std::vector<double> read(double const* storage) const {
+        if (packed == nullptr) {
+            return std::vector<double>(storage + offset, storage + offset + volume());
+        }
+
+        std::vector<double> values(volume(), 0.0);
+
+        packed->for_each_nonzero([&](std::vector<int> const& coords, double value) {
+            values[packed->linear_index(coords)] = value;
+        });
+
+        return values;
+    }
+};
+
+// Indented C++ text
+class CppWriter {
+private:
+    std::ostringstream out;
+    int indents = 0;
+public:
+    void write_line(std::string line) {
+        for (int i = 0; i < indents; i++) { out << "    "; }
+        out << line << "\n";
+    }
+
+    void open(std::string line) {
+        write_line(line == "" ? "{" : line + " {");
+        indents++;
+    }
+
+    void close() {
+        indents--;
+        write_line("}");
+    }
+
+    std::string str() {
+        return out.str();
+    }
+};
+
+/*
+ Lowers a program to one self-contained C++ file. Every variable gets a fixed slot in a
+ single block of doubles, and every statement becomes a loop nest over its result:
+
+    let tensor T = a * A + A;      for (std::size_t i0 = 0; i0 < 2; i0++) {
+                                       v[3 + i0] = ((s0 * v[1 + i0]) + v[1 + i0]);
+                                   }
+
+ Shapes come from ShapeInference, so every loop bound and slot size is a constant.
+ Broadcast operands index dimension 0 where they have extent 1, and a transpose
+ reverses the indices. Subtrees the FusionPlan makes kernels of (contractions, shared
+ subtrees) are computed into slots of their own first; everything else is inlined into
+ the loop nest that reads it. An index-notation contraction runs as the pairwise steps
+ the ContractionPlanner picks. Tensor literals become static arrays. The entry point is
+ extern "C" void apollo_run(double* v), and apollo_storage_size is the size of v.
+
+ A variable bound to a literal with a {dense, compressed, singleton} format, or to one at
+ most a quarter nonzero, stays packed in that format (PackedTensor). A loop nest reading
+ packed operands at its own shape co-iterates them level by level instead of looping over
+ every element: + and - visit the union of their operands' coordinates, * and / (by its
+ numerator) the intersection, and a dense operand or scalar is looked up at whatever
+ coordinate the others give. For T = A * B + C, at each level:
+
+    while (pA < endA && pB < endB && pC < endC) {      A, B and C
+        i = min(cA, cB, cC);                           cases, most operands first:
+        if (cA == i && cB == i && cC == i) { .. }        A * B + C
+        else if (cA == i && cB == i) { .. }              A * B
+        else if (cC == i) { .. }                         C
+        advance the operands at i
+    }
+    while (pA < endA && pB < endB) { .. }              A and B
+    while (pC < endC) { .. }                           C alone
+
+ so the work follows the nonzeros rather than the volume; the result is zeroed first.
+ Any other read of a packed variable (broadcast, transposed, a divisor, a contraction)
+ goes through a dense copy made the first time one is needed.
+ */
+class NativeGenerator {
+private:
+    std::unordered_map<std::string, std::string> const binary_ops = { {"+", "+"}, {"-", "-"}, {"*", "*"}, {"/", "/"} };
+
+    ProgramNode* ast;
+    ShapeInference& shapes;
+    FusionPlan plan;
+    CppWriter literals;
+    CppWriter body;
+    std::vector<NativeVariable> variables;
+    std::unordered_map<std::string, std::size_t> name_to_variable;
+    std::unordered_map<TensorNode*, std::string> literal_names;
+    std::unordered_map<ExpressionNode*, std::size_t> materialized;
+    std::size_t storage_size = 0;
+
+    // a variable kept in its storage format; offset is its dense copy, once there is one
+    struct PackedVariable {
+        PackedTensor tensor;
+        std::string prefix;
+        std::size_t offset;
+        bool unpacked;
+    };
+
+    std::unordered_map<std::size_t, PackedVariable> packed;
+
+    // the coordinates a co-iteration visits at one level: those of the iterated operands
+    // in the bitmask, or all of them when full
+    struct LatticePoint {
+        std::uint64_t operands;
+        bool full;
+    };
+
+    // per co-iterating nest: the packed variable behind each iterated operand, and the C++
+    // expressions of the subtrees read densely
+    std::vector<int> nest_dims;
+    std::size_t nest_offset = 0;
+    std::vector<std::size_t> iterators;
+    std::unordered_map<ExpressionNode*, std::string> dense_operands;
+
+    // per loop nest: scalar variables read inside it, loaded once before it
+    std::vector<std::string> hoisted;
+    std::unordered_map<std::string, std::string> hoisted_names;
+    bool in_loop = false;
+
+    NativeVariable const& variable(std::string name) {
+        if (name_to_variable.find(name) == name_to_variable.end()) {
+            IllegalIdentifierError(-1);
+        }
+
+        return variables[name_to_variable.at(name)];
+    }
+
+    // the slot holding name's values, unpacking a packed variable the first time
+    std::size_t offset_of(std::string name) {
+        NativeVariable const& var = variable(name);
+        std::size_t k = name_to_variable.at(name);
+
+        return packed.find(k) == packed.end() ? var.offset : unpack(k);
+    }
+
+    static std::size_t volume(std::vector<int> const& dims) {
+        std::size_t v = 1;
+        for (int d : dims) { v *= d; }
+        return v;
+    }
+
+    static std::vector<std::string> loop_indices(std::size_t n) {
+        std::vector<std::string> index;
+        for (std::size_t l = 0; l < n; l++) { index.push_back("i" + std::to_string(l)); }
+        return index;
+    }
+
+    // row-major offset of index in a tensor shaped dims; "0" entries drop out
+    static std::string linear(std::vector<std::string> const& index, std::vector<int> const& dims) {
+        std::string offset = "";
+        std::size_t stride = 1;
+
+        for (int l = (int) dims.size() - 1; l >= 0; l--) {
+            if (index[l] != "0") {
+                std::string term = index[l] + (stride == 1 ? "" : " * " + std::to_string(stride));
+                offset = offset == "" ? term : term + " + " + offset;
+            }
+
+            stride *= dims[l];
+        }
+
+        return offset == "" ? "0" : offset;
+    }
+
+    // the indices of an operand shaped dims inside a result shaped result
+    static std::vector<std::string> broadcast(std::vector<std::string> const& index, std::vector<int> const& result, std::vector<int> const& dims) {
+        std::vector<std::string> operand;
+        std::size_t offset = result.size() - dims.size();
+
+        for (std::size_t l = 0; l < dims.size(); l++) {
+            operand.push_back(dims[l] == 1 && result[offset + l] != 1 ? "0" : index[offset + l]);
+        }
+
+        return operand;
+    }
+
+    static std::string slot(std::size_t offset, std::vector<std::string> const& index, std::vector<int> const& dims) {
+        std::string position = linear(index, dims);
+        return "v[" + std::to_string(offset) + (position == "0" ? "" : " + " + position) + "]";
+    }
+
+    // C++ expression for the element of n at index, one entry per dimension of n
+    std::string element(ExpressionNode* n, std::vector<std::string> const& index) {
+        if (ScalarNode* scalar = dynamic_cast<ScalarNode*>(n)) {
+            return double_literal(scalar->get_number());
+        } else if (TensorNode* tensor = dynamic_cast<TensorNode*>(n)) {
+            return literal(tensor) + "[" + linear(index, tensor->get_storage().get_dims()) + "]";
+        } else if (IndentifierNode* identifier = dynamic_cast<IndentifierNode*>(n)) {
+            NativeVariable const& var = variable(identifier->get_name());
+            std::string value = slot(offset_of(identifier->get_name()), index, var.dims);
+
+            if (!var.dims.empty() || !in_loop) {
+                return value;
+            }
+
+            if (hoisted_names.find(value) == hoisted_names.end()) {
+                hoisted_names[value] = "s" + std::to_string(hoisted.size());
+                hoisted.push_back("const double " + hoisted_names.at(value) + " = " + value + ";");
+            }
+
+            return hoisted_names.at(value);
+        } else if (materialized.find(n) != materialized.end()) {
+            return slot(materialized.at(n), index, shapes.shape_of(n));
+        }
+
+        return compute(n, index);
+    }
+
+    // n's operator applied to its operands' elements
+    std::string compute(ExpressionNode* n, std::vector<std::string> const& index) {
+        std::string op = n->get_value().get_token();
+
+        if (n->get_left() == nullptr && op == "'") {
+            return element(n->get_right(), std::vector<std::string>(index.rbegin(), index.rend()));
+        } else if (n->get_left() == nullptr) {
+            return "(" + op + element(n->get_right(), index) + ")";
+        }
+
+        std::vector<int> const& result = shapes.shape_of(n);
+        std::string left = element(n->get_left(), broadcast(index, result, shapes.shape_of(n->get_left())));
+        std::string right = element(n->get_right(), broadcast(index, result, shapes.shape_of(n->get_right())));
+
+        return "(" + left + " " + binary_ops.at(op) + " " + right + ")";
+    }
+
+    // Dense static copy of a literal; the loops index it like any other operand
+    std::string literal(TensorNode* tensor) {
+        if (literal_names.find(tensor) != literal_names.end()) {
+            return literal_names.at(tensor);
+        }
+
+        SparseTensor const& storage = tensor->get_storage();
+        std::string name = "literal_" + std::to_string(literal_names.size());
+        std::vector<double> dense(storage.volume(), 0.0);
+
+        storage.for_each_nonzero([&](std::vector<int> const& coords, double value) {
+            dense[storage.linear_index(coords)] = value;
+        });
+
+        write_array("double", name, dense);
+        literal_names[tensor] = name;
+
+        return name;
+    }
+
+    // format_double prints whole numbers without a point, which C++ would read as ints and
+    // divide as ints, and the infinities and NaN that folding can produce as inf and nan
+    static std::string double_literal(double value) {
+        if (std::isnan(value)) {
+            return "std::numeric_limits<double>::quiet_NaN()";
+        } else if (std::isinf(value)) {
+            return std::string(value < 0 ? "-" : "") + "std::numeric_limits<double>::infinity()";
+        }
+
+        std::string text = format_double(value);
+        return text.find_first_of(".e") == std::string::npos ? text + ".0" : text;
+    }
+
+    static std::string element_text(double value) {
+        return double_literal(value);
+    }
+
+    static std::string element_text(std::uint32_t value) {
+        return std::to_string(value);
+    }
+
+    template <typename T>
+    void write_array(std::string type, std::string name, std::vector<T> const& values) {
+        std::string text = "";
+        for (std::size_t i = 0; i < values.size(); i++) { text += (i == 0 ? "" : ", ") + element_text(values[i]); }
+
+        // an empty array still takes one element
+        literals.write_line("static const " + type + " " + name + "[" + std::to_string(std::max<std::size_t>(values.size(), 1)) + "] = {" + text + "};");
+    }
+
+    void begin_nest() {
+        hoisted.clear();
+        hoisted_names.clear();
+        in_loop = true;
+    }
+
+    void open_nest(std::vector<int> const& dims) {
+        body.open("");
+
+        for (std::string const& line : hoisted) { body.write_line(line); }
+
+        for (std::size_t l = 0; l < dims.size(); l++) {
+            std::string i = "i" + std::to_string(l);
+            body.open("for (std::size_t " + i + " = 0; " + i + " < " + std::to_string(dims[l]) + "; " + i + "++)");
+        }
+    }
+
+    void close_nest(std::vector<int> const& dims) {
+        for (std::size_t l = 0; l <= dims.size(); l++) { body.close(); }
+    }
+
+    static std::vector<LevelFormat> level_formats(std::vector<std::string> const& names, std::size_t order) {
+        std::vector<LevelFormat> formats;
+
+        for (std::string const& name : names) {
+            formats.push_back(name == "dense" ? LevelFormat::DENSE : name == "singleton" ? LevelFormat::SINGLETON : LevelFormat::COMPRESSED);
+        }
+
+        // unannotated: compressed rows of a dense first level, or a compressed vector
+        for (std::size_t l = formats.size(); l < order; l++) {
+            formats.push_back(l == 0 && order > 1 ? LevelFormat::DENSE : LevelFormat::COMPRESSED);
+        }
+
+        return formats;
+    }
+
+    // a literal is kept packed when it has a format, or when at most a quarter of it is nonzero
+    bool is_packed(VarDecNode* n) {
+        TensorNode* literal = dynamic_cast<TensorNode*>(n->get_rhs());
+
+        if (literal == nullptr || dynamic_cast<ScalarNode*>(literal) != nullptr || literal->get_storage().get_dims() != shapes.shape_of(n)) {
+            return false;
+        }
+
+        SparseTensor const& storage = literal->get_storage();
+        return !n->get_formats().empty() || (storage.order() > 0 && storage.nnz() * 4 <= storage.volume());
+    }
+
+    // static pos, crd and values arrays for the levels that have them
+    void pack(VarDecNode* n) {
+        SparseTensor const& storage = dynamic_cast<TensorNode*>(n->get_rhs())->get_storage();
+        std::string prefix = "packed_" + std::to_string(packed.size());
+        PackedTensor tensor = PackedTensor(storage, level_formats(n->get_formats(), storage.order()));
+        std::string formats = "";
+
+        for (int l = 0; l < tensor.order(); l++) {
+            LevelFormat format = tensor.format(l);
+            formats += std::string(l == 0 ? "" : ", ") + (format == LevelFormat::DENSE ? "dense" : format == LevelFormat::COMPRESSED ? "compressed" : "singleton");
+        }
+
+        literals.write_line("// " + n->get_name() + shape_to_string(storage.get_dims()) + " {" + formats + "}: " + std::to_string(storage.nnz()) + " of " + std::to_string(storage.volume()) + " nonzero");
+
+        for (int l = 0; l < tensor.order(); l++) {
+            if (tensor.format(l) == LevelFormat::COMPRESSED) {
+                write_array("std::uint32_t", prefix + "_pos" + std::to_string(l), tensor.get_pos(l));
+            }
+
+            if (tensor.format(l) != LevelFormat::DENSE) {
+                write_array("std::uint32_t", prefix + "_crd" + std::to_string(l), tensor.get_crd(l));
+            }
+        }
+
+        write_array("double", prefix + "_vals", tensor.get_values());
+
+        NativeVariable var = { n->get_name(), storage.get_dims(), 0, &storage };
+        packed.insert({ variables.size(), { tensor, prefix, 0, false } });
+        name_to_variable[var.name] = variables.size();
+        variables.push_back(var);
+    }
+
+    // Writes a dense copy of packed variable k into a new slot
+    std::size_t unpack(std::size_t k) {
+        PackedVariable& var = packed.at(k);
+
+        if (!var.unpacked) {
+            std::vector<int> const& dims = variables[k].dims;
+            var.offset = storage_size;
+            var.unpacked = true;
+            storage_size += volume(dims);
+
+            body.write_line("// " + variables[k].name + shape_to_string(dims) + " unpacked");
+            body.open("");
+            body.write_line("std::fill(v + " + std::to_string(var.offset) + ", v + " + std::to_string(storage_size) + ", 0.0);");
+            scatter(var, dims, 0, "0");
+            body.close();
+        }
+
+        return var.offset;
+    }
+
+    // one loop per level, over the positions under the one at begin
+    void scatter(PackedVariable const& var, std::vector<int> const& dims, int level, std::string begin) {
+        if (level == (int) dims.size()) {
+            body.write_line(slot(var.offset, loop_indices(dims.size()), dims) + " = " + var.prefix + "_vals[" + begin + "];");
+            return;
+        }
+
+        std::string i = "i" + std::to_string(level);
+        std::string l = std::to_string(level);
+
+        if (var.tensor.format(level) == LevelFormat::DENSE) {
+            body.open("for (std::size_t " + i + " = 0; " + i + " < " + std::to_string(dims[level]) + "; " + i + "++)");
+            scatter(var, dims, level + 1, located(begin, dims[level], i));
+            body.close();
+            return;
+        }
+
+        std::string p = "p" + l;
+        std::string from = var.tensor.format(level) == LevelFormat::COMPRESSED ? var.prefix + "_pos" + l + "[" + begin + "]" : begin;
+        std::string to = var.tensor.format(level) == LevelFormat::COMPRESSED ? var.prefix + "_pos" + l + "[" + begin + " + 1]" : begin + " + 1";
+
+        body.open("for (std::size_t " + p + " = " + from + "; " + p + " < " + to + "; " + p + "++)");
+        body.write_line("const std::size_t " + i + " = " + var.prefix + "_crd" + l + "[" + p + "];");
+        scatter(var, dims, level + 1, p);
+        body.close();
+    }
+
+    // the position of coordinate i under position parent of a dense level
+    static std::string located(std::string parent, int extent, std::string i) {
+        if (parent == "0") { return i; }
+
+        return (parent.find(' ') == std::string::npos ? parent : "(" + parent + ")") + " * " + std::to_string(extent) + " + " + i;
+    }
+
+    // the iterated operand n is, or -1
+    int iterator_of(ExpressionNode* n) {
+        IndentifierNode* identifier = dynamic_cast<IndentifierNode*>(n);
+
+        if (identifier == nullptr || name_to_variable.find(identifier->get_name()) == name_to_variable.end()) {
+            return -1;
+        }
+
+        std::size_t k = name_to_variable.at(identifier->get_name());
+        auto found = std::find(iterators.begin(), iterators.end(), k);
+
+        return found == iterators.end() ? -1 : (int) (found - iterators.begin());
+    }
+
+    static bool is_unary(ExpressionNode* n) {
+        return n->get_left() == nullptr && n->get_right() != nullptr && n->get_value().get_token() == "-";
+    }
+
+    static bool is_elementwise(ExpressionNode* n) {
+        std::string op = n->get_value().get_token();
+        return n->get_left() != nullptr && n->get_right() != nullptr && (op == "+" || op == "-" || op == "*" || op == "/");
+    }
+
+    // packed variables read at the nest's own shape, through + - * and numerators only
+    void find_iterators(ExpressionNode* n) {
+        if (materialized.find(n) != materialized.end() || shapes.shape_of(n) != nest_dims) {
+            return;
+        }
+
+        IndentifierNode* identifier = dynamic_cast<IndentifierNode*>(n);
+
+        if (identifier != nullptr && name_to_variable.find(identifier->get_name()) != name_to_variable.end()) {
+            std::size_t k = name_to_variable.at(identifier->get_name());
+
+            if (packed.find(k) != packed.end() && iterator_of(n) == -1 && iterators.size() < 64) {
+                iterators.push_back(k);
+            }
+        } else if (is_unary(n)) {
+            find_iterators(n->get_right());
+        } else if (is_elementwise(n)) {
+            find_iterators(n->get_left());
+            if (n->get_value().get_token() != "/") { find_iterators(n->get_right()); }
+        }
+    }
+
+    // n takes part in the merge; otherwise it is read densely at every visited coordinate
+    bool co_iterated(ExpressionNode* n) {
+        if (materialized.find(n) != materialized.end() || shapes.shape_of(n) != nest_dims) {
+            return false;
+        } else if (dynamic_cast<IndentifierNode*>(n) != nullptr) {
+            return iterator_of(n) != -1;
+        } else if (is_unary(n)) {
+            return co_iterated(n->get_right());
+        } else if (is_elementwise(n)) {
+            return co_iterated(n->get_left()) || (n->get_value().get_token() != "/" && co_iterated(n->get_right()));
+        }
+
+        return false;
+    }
+
+    // the dense reads happen before the nest opens: they may unpack or hoist
+    void load_dense_operands(ExpressionNode* n) {
+        if (!co_iterated(n)) {
+            load_dense_operand(n);
+        } else if (is_unary(n)) {
+            load_dense_operands(n->get_right());
+        } else if (is_elementwise(n)) {
+            load_dense_operands(n->get_left());
+
+            if (n->get_value().get_token() == "/") {
+                load_dense_operand(n->get_right());
+            } else {
+                load_dense_operands(n->get_right());
+            }
+        }
+    }
+
+    void load_dense_operand(ExpressionNode* n) {
+        if (dense_operands.find(n) == dense_operands.end()) {
+            dense_operands[n] = element(n, broadcast(loop_indices(nest_dims.size()), nest_dims, shapes.shape_of(n)));
+        }
+    }
+
+    // Union (+ -) or intersection (*) of the coordinates two subtrees visit. A full point
+    // covers the others, which are dropped
+    static std::vector<LatticePoint> combine(std::vector<LatticePoint> const& left, std::vector<LatticePoint> const& right, bool is_union) {
+        if (left.empty() || right.empty()) {
+            return !is_union ? std::vector<LatticePoint>() : left.empty() ? right : left;
+        }
+
+        std::vector<LatticePoint> points;
+
+        auto add = [&](LatticePoint point) {
+            for (LatticePoint const& p : points) {
+                if (p.operands == point.operands && p.full == point.full) { return; }
+            }
+
+            points.push_back(point);
+        };
+
+        for (LatticePoint const& a : left) {
+            for (LatticePoint const& b : right) {
+                add({ a.operands | b.operands, is_union ? a.full || b.full : a.full && b.full });
+            }
+        }
+
+        if (is_union) {
+            for (LatticePoint const& a : left) { add(a); }
+            for (LatticePoint const& b : right) { add(b); }
+        }
+
+        if (std::any_of(points.begin(), points.end(), [](LatticePoint const& p) { return p.full; })) {
+            points.erase(std::remove_if(points.begin(), points.end(), [](LatticePoint const& p) { return !p.full; }), points.end());
+        }
+
+        std::stable_sort(points.begin(), points.end(), [](LatticePoint const& a, LatticePoint const& b) {
+            return __builtin_popcountll(a.operands) > __builtin_popcountll(b.operands);
+        });
+
+        return points;
+    }
+
+    // the merge lattice of n at level: empty where n is zero for lack of operands
+    std::vector<LatticePoint> lattice(ExpressionNode* n, int level, std::uint64_t present) {
+        if (!co_iterated(n)) {
+            return { { 0, true } };
+        }
+
+        int k = iterator_of(n);
+
+        if (k != -1) {
+            if (!(present >> k & 1)) {
+                return {};
+            }
+
+            return packed.at(iterators[k]).tensor.format(level) == LevelFormat::DENSE ? std::vector<LatticePoint>{ { 0, true } } : std::vector<LatticePoint>{ { 1ull << k, false } };
+        } else if (is_unary(n)) {
+            return lattice(n->get_right(), level, present);
+        }
+
+        std::vector<LatticePoint> left = lattice(n->get_left(), level, present);
+
+        if (n->get_value().get_token() == "/") {
+            return left;
+        }
+
+        return combine(left, lattice(n->get_right(), level, present), n->get_value().get_token() != "*");
+    }
+
+    // C++ for n's value with the operands outside present taken as zero; "" if it is zero
+    std::string merged_value(ExpressionNode* n, std::uint64_t present, std::vector<std::string> const& positions) {
+        if (!co_iterated(n)) {
+            return dense_operands.at(n);
+        }
+
+        int k = iterator_of(n);
+
+        if (k != -1) {
+            return present >> k & 1 ? packed.at(iterators[k]).prefix + "_vals[" + positions[k] + "]" : "";
+        } else if (is_unary(n)) {
+            std::string operand = merged_value(n->get_right(), present, positions);
+            return operand == "" ? "" : "(-" + operand + ")";
+        }
+
+        std::string op = n->get_value().get_token();
+        std::string left = merged_value(n->get_left(), present, positions);
+        std::string right = op == "/" ? dense_operands.at(n->get_right()) : merged_value(n->get_right(), present, positions);
+
+        if (op == "+" && (left == "" || right == "")) {
+            return left == "" ? right : left;
+        } else if (op == "-" && (left == "" || right == "")) {
+            return right == "" ? left : "(-" + right + ")";
+        } else if (left == "" || right == "") {
+            return "";
+        }
+
+        return "(" + left + " " + binary_ops.at(op) + " " + right + ")";
+    }
+
+    // One level of the co-iteration: positions[k] is where operand k stands at level - 1
+    void merge(ExpressionNode* n, int level, std::uint64_t present, std::vector<std::string> const& positions) {
+        if (level == (int) nest_dims.size()) {
+            std::string value = merged_value(n, present, positions);
+
+            if (value != "") {
+                body.write_line(slot(nest_offset, loop_indices(nest_dims.size()), nest_dims) + " = " + value + ";");
+            }
+
+            return;
+        }
+
+        std::vector<LatticePoint> points = lattice(n, level, present);
+
+        if (points.empty()) {
+            return;
+        }
+
+        std::string l = std::to_string(level);
+        std::string i = "i" + l;
+        bool full = points.front().full;
+        std::uint64_t merged = 0, located_operands = 0;
+
+        for (LatticePoint const& point : points) { merged |= point.operands; }
+
+        for (std::size_t k = 0; k < iterators.size(); k++) {
+            PackedVariable const& var = packed.at(iterators[k]);
+            std::string p = "p" + std::to_string(k) + "_" + l;
+
+            if (merged >> k & 1) {
+                bool compressed = var.tensor.format(level) == LevelFormat::COMPRESSED;
+                std::string begin = compressed ? var.prefix + "_pos" + l + "[" + positions[k] + "]" : positions[k];
+                std::string end = compressed ? var.prefix + "_pos" + l + "[" + positions[k] + " + 1]" : positions[k] + " + 1";
+
+                // a segment of a non-unique parent spans every position with its coordinate
+                if (!compressed && level > 0 && !var.tensor.is_unique(level - 1)) {
+                    end = "q" + std::to_string(k) + "_" + std::to_string(level - 1);
+                }
+
+                body.write_line("std::size_t " + p + " = " + begin + ";");
+                body.write_line("const std::size_t " + p + "_end = " + end + ";");
+            } else if (present >> k & 1 && var.tensor.format(level) == LevelFormat::DENSE) {
+                located_operands |= 1ull << k;
+            }
+        }
+
+        if (full) {
+            body.write_line("std::size_t " + i + " = 0;");
+        }
+
+        for (LatticePoint const& point : points) {
+            std::vector<std::string> bounds, coords;
+
+            for (std::size_t k = 0; k < iterators.size(); k++) {
+                if (point.operands >> k & 1) {
+                    std::string p = "p" + std::to_string(k) + "_" + l;
+                    bounds.push_back(p + " < " + p + "_end");
+                    coords.push_back("c" + std::to_string(k) + "_" + l);
+                }
+            }
+
+            if (full) { bounds.push_back(i + " < " + std::to_string(nest_dims[level])); }
+
+            std::string condition = "";
+            for (std::string const& bound : bounds) { condition += (condition == "" ? "" : " && ") + bound; }
+
+            body.open("while (" + condition + ")");
+
+            for (std::size_t k = 0; k < iterators.size(); k++) {
+                if (point.operands >> k & 1) {
+                    PackedVariable const& var = packed.at(iterators[k]);
+                    std::string p = "p" + std::to_string(k) + "_" + l;
+                    std::string c = "c" + std::to_string(k) + "_" + l;
+                    std::string q = "q" + std::to_string(k) + "_" + l;
+
+                    body.write_line("const std::size_t " + c + " = " + var.prefix + "_crd" + l + "[" + p + "];");
+                    body.write_line("std::size_t " + q + " = " + p + " + 1;");
+
+                    if (!var.tensor.is_unique(level)) {
+                        body.write_line("while (" + q + " < " + p + "_end && " + var.prefix + "_crd" + l + "[" + q + "] == " + c + ") { " + q + "++; }");
+                    }
+                }
+            }
+
+            if (!full) {
+                std::string smallest = coords[0];
+
+                if (coords.size() > 1) {
+                    smallest = "";
+                    for (std::string const& c : coords) { smallest += (smallest == "" ? "" : ", ") + c; }
+                    smallest = "std::min({" + smallest + "})";
+                }
+
+                body.write_line("const std::size_t " + i + " = " + smallest + ";");
+            }
+
+            bool first = true;
+
+            for (LatticePoint const& option : points) {
+                if ((option.operands & ~point.operands) != 0) { continue; }
+
+                std::string test = "";
+                std::vector<std::string> next = positions;
+
+                for (std::size_t k = 0; k < iterators.size(); k++) {
+                    if (option.operands >> k & 1) {
+                        test += (test == "" ? "" : " && ") + ("c" + std::to_string(k) + "_" + l + " == " + i);
+                        next[k] = "p" + std::to_string(k) + "_" + l;
+                    } else if (located_operands >> k & 1) {
+                        next[k] = located(positions[k], nest_dims[level], i);
+                    }
+                }
+
+                // the last case needs no test: a lone operand is always at the minimum
+                bool always = option.operands == 0 || (!full && option.operands == point.operands && coords.size() == 1);
+
+                if (always) {
+                    body.open(first ? "" : "else");
+                } else {
+                    body.open((first ? "if (" : "else if (") + test + ")");
+                }
+
+                merge(n, level + 1, located_operands | option.operands, next);
+                body.close();
+                first = false;
+
+                if (always) { break; }
+            }
+
+            for (std::size_t k = 0; k < iterators.size(); k++) {
+                if (point.operands >> k & 1) {
+                    std::string p = "p" + std::to_string(k) + "_" + l;
+                    std::string c = "c" + std::to_string(k) + "_" + l;
+                    std::string q = "q" + std::to_string(k) + "_" + l;
+
+                    body.write_line(coords.size() == 1 && !full ? p + " = " + q + ";" : "if (" + c + " == " + i + ") { " + p + " = " + q + "; }");
+                }
+            }
+
+            if (full) { body.write_line(i + "++;"); }
+
+            body.close();
+        }
+    }
+
+    // Writes n into a new slot at offset by co-iterating its packed operands; false if it
+    // has none. The caller reserves the slot
+    bool co_iteration(ExpressionNode* n, std::vector<int> const& dims, std::size_t& offset, std::string comment) {
+        if (dims.empty()) {
+            return false;
+        }
+
+        nest_dims = dims;
+        iterators.clear();
+        dense_operands.clear();
+        find_iterators(n);
+
+        if (iterators.empty()) {
+            return false;
+        }
+
+        begin_nest();
+        load_dense_operands(n);
+        offset = storage_size;
+        nest_offset = offset;
+
+        std::string names = "";
+        for (std::size_t k : iterators) { names += (names == "" ? "" : ", ") + variables[k].name; }
+
+        body.write_line(comment + ", co-iterating " + names);
+        body.open("");
+
+        for (std::string const& line : hoisted) { body.write_line(line); }
+
+        body.write_line("std::fill(v + " + std::to_string(offset) + ", v + " + std::to_string(offset + volume(dims)) + ", 0.0);");
+        merge(n, 0, (iterators.size() == 64 ? 0 : 1ull << iterators.size()) - 1, std::vector<std::string>(iterators.size(), "0"));
+        body.close();
+
+        return true;
+    }
+
+    // Computes every kernel under n into a slot of its own, innermost first
+    void materialize(ExpressionNode* n) {
+        if (n == nullptr || materialized.find(n) != materialized.end()) { return; }
+
+        materialize(n->get_left());
+        materialize(n->get_right());
+
+        if (!plan.is_kernel(n)) { return; }
+
+        if (n->get_value().get_token() != "@") {
+            std::vector<int> const& result = shapes.shape_of(n);
+            std::vector<std::string> index = loop_indices(result.size());
+            std::size_t offset;
+
+            if (co_iteration(n, result, offset, "// " + n->get_value().get_token() + " " + shape_to_string(result))) {
+                materialized[n] = offset;
+                storage_size += volume(result);
+                return;
+            }
+
+            begin_nest();
+            std::string value = compute(n, index);
+            offset = storage_size;
+
+            body.write_line("// " + n->get_value().get_token() + " " + shape_to_string(result));
+            open_nest(result);
+            body.write_line(slot(offset, index, result) + " = " + value + ";");
+            close_nest(result);
+
+            materialized[n] = offset;
+            storage_size += volume(result);
+            return;
+        }
+
+        std::vector<int> const& result = shapes.shape_of(n);
+        std::vector<int> const& left_dims = shapes.shape_of(n->get_left());
+        std::vector<int> const& right_dims = shapes.shape_of(n->get_right());
+        std::vector<std::string> index = loop_indices(result.size());
+        std::size_t split = left_dims.size() - 1;
+
+        std::vector<std::string> left_index(index.begin(), index.begin() + split);
+        std::vector<std::string> right_index = { "r" };
+        left_index.push_back("r");
+        right_index.insert(right_index.end(), index.begin() + split, index.end());
+
+        begin_nest();
+        std::string left = element(n->get_left(), left_index);
+        std::string right = element(n->get_right(), right_index);
+        std::size_t offset = storage_size;
+
+        body.write_line("// " + shape_to_string(left_dims) + " @ " + shape_to_string(right_dims));
+        open_nest(result);
+        body.write_line("double sum = 0;");
+        body.open("for (std::size_t r = 0; r < " + std::to_string(left_dims.back()) + "; r++)");
+        body.write_line("sum += " + left + " * " + right + ";");
+        body.close();
+        body.write_line(slot(offset, index, result) + " = sum;");
+        close_nest(result);
+
+        materialized[n] = offset;
+        storage_size += volume(result);
+    }
+
+    // a tensor taking part in one contraction step
+    struct StepOperand {
+        std::size_t offset;
+        std::vector<std::string> indices;
+        std::vector<int> dims;
+    };
+
+    // result[indices] = sum over every other index of the operands' product
+    void contraction_step(std::vector<StepOperand> const& operands, std::vector<std::string> const& indices, std::unordered_map<std::string, int> const& extents, std::size_t offset) {
+        std::vector<std::string> summed;
+
+        for (StepOperand const& operand : operands) {
+            for (std::string const& index : operand.indices) {
+                if (std::find(indices.begin(), indices.end(), index) == indices.end() &&
+                    std::find(summed.begin(), summed.end(), index) == summed.end()) {
+                    summed.push_back(index);
+                }
+            }
+        }
+
+        auto loop_variables = [](std::vector<std::string> const& names) {
+            std::vector<std::string> variables;
+            for (std::string const& name : names) { variables.push_back("x_" + name); }
+            return variables;
+        };
+
+        std::string product = "";
+
+        for (StepOperand const& operand : operands) {
+            product += (product == "" ? "" : " * ") + slot(operand.offset, loop_variables(operand.indices), operand.dims);
+        }
+
+        std::vector<int> dims;
+        for (std::string const& index : indices) { dims.push_back(extents.at(index)); }
+
+        body.open("");
+
+        for (std::string const& index : indices) {
+            body.open("for (std::size_t x_" + index + " = 0; x_" + index + " < " + std::to_string(extents.at(index)) + "; x_" + index + "++)");
+        }
+
+        body.write_line("double sum = 0;");
+
+        for (std::string const& index : summed) {
+            body.open("for (std::size_t x_" + index + " = 0; x_" + index + " < " + std::to_string(extents.at(index)) + "; x_" + index + "++)");
+        }
+
+        body.write_line("sum += " + product + ";");
+
+        for (std::size_t l = 0; l < summed.size(); l++) { body.close(); }
+
+        body.write_line(slot(offset, loop_variables(indices), dims) + " = sum;");
+
+        for (std::size_t l = 0; l <= indices.size(); l++) { body.close(); }
+    }
+
+    // Writes the contraction into v[offset..]; intermediates get slots of their own
+    void contraction(ContractionNode* n, std::size_t offset) {
+        std::unordered_map<std::string, int> const& extents = shapes.extents_of(n);
+        std::vector<std::vector<std::string>> indices;
+        std::vector<StepOperand> operands;
+
+        for (IndexedNode* operand : n->get_operands()) {
+            NativeVariable const& var = variable(operand->get_name());
+            indices.push_back(operand->get_indices());
+            operands.push_back({ offset_of(operand->get_name()), operand->get_indices(), var.dims });
+        }
+
+        ContractionPlanner planner = ContractionPlanner(indices, n->get_output(), extents);
+        std::vector<ContractionStep> steps = planner.plan();
+
+        if (steps.size() > 1) {
+            std::ostringstream flops;
+            flops << ContractionPlanner::total_flops(steps) << " multiply-adds, " << ContractionPlanner::total_flops(planner.left_to_right()) << " left to right";
+            body.write_line("// " + flops.str());
+        }
+
+        if (steps.empty()) {
+            contraction_step(operands, n->get_output(), extents, offset);
+            return;
+        }
+
+        for (std::size_t s = 0; s < steps.size(); s++) {
+            std::vector<int> dims;
+            for (std::string const& index : steps[s].indices) { dims.push_back(extents.at(index)); }
+
+            std::size_t result = offset;
+
+            if (s + 1 < steps.size()) {
+                result = storage_size;
+                storage_size += volume(dims);
+            }
+
+            contraction_step({ operands[steps[s].left], operands[steps[s].right] }, steps[s].indices, extents, result);
+            operands.push_back({ result, steps[s].indices, dims });
+        }
+    }
+
+    void statement(VarDecNode* n) {
+        if (ContractionNode* rhs = dynamic_cast<ContractionNode*>(n->get_rhs())) {
+            for (IndexedNode* operand : rhs->get_operands()) { offset_of(operand->get_name()); }
+
+            NativeVariable var = { n->get_name(), shapes.shape_of(n), storage_size };
+            storage_size += var.volume();
+
+            body.write_line("// " + var.name + (var.dims.empty() ? "" : shape_to_string(var.dims)));
+            contraction(rhs, var.offset);
+
+            name_to_variable[var.name] = variables.size();
+            variables.push_back(var);
+            return;
+        }
+
+        if (is_packed(n)) {
+            pack(n);
+            return;
+        }
+
+        materialize(n->get_rhs());
+
+        std::vector<int> const& dims = shapes.shape_of(n);
+        std::vector<std::string> index = loop_indices(dims.size());
+        NativeVariable var = { n->get_name(), dims, 0 };
+
+        if (co_iteration(n->get_rhs(), dims, var.offset, "// " + var.name + shape_to_string(dims))) {
+            name_to_variable[var.name] = variables.size();
+            variables.push_back(var);
+            storage_size += var.volume();
+            return;
+        }
+
+        begin_nest();
+        in_loop = !dims.empty();
+        std::string value = element(n->get_rhs(), broadcast(index, dims, shapes.shape_of(n->get_rhs())));
+        var.offset = storage_size;
+
+        body.write_line("// " + var.name + (dims.empty() ? "" : shape_to_string(dims)));
+
+        if (dims.empty()) {
+            body.write_line(slot(var.offset, index, dims) + " = " + value + ";");
+        } else {
+            open_nest(dims);
+            body.write_line(slot(var.offset, index, dims) + " = " + value + ";");
+            close_nest(dims);
+        }
+
+        // a redeclaration gets a fresh slot, so earlier statements keep reading the old one
+        name_to_variable[var.name] = variables.size();
+        variables.push_back(var);
+        storage_size += var.volume();
+    }
+
+    void generate_helper(ASTNode& n) {
+        if (VarDecNode* var_dec = dynamic_cast<VarDecNode*>(&n)) {
+            statement(var_dec);
+            return;
+        }
+
+        for (ASTNode* child : n.get_children()) {
+            generate_helper(*child);
+        }
+    }
+public:
+    NativeGenerator(ProgramNode* n, ShapeInference& shapes, bool fuse=true) : ast(n), shapes(shapes), plan(shapes, fuse) {}
+
+    std::string generate_code() {
+        plan.plan(ast);
+        body.open("extern \"C\" void apollo_run(double* v)");
+        generate_helper(*ast);
+        body.close();
+
+        CppWriter out;
+        out.write_line("// Generated by apollo: every variable is a fixed slot in v.");
+        out.write_line("#include <algorithm>");
+        out.write_line("#include <cstddef>");
+        out.write_line("#include <cstdint>");
+        out.write_line("#include <limits>");
+        out.write_line("");
+        out.write_line("extern \"C\" const std::size_t apollo_storage_size = " + std::to_string(storage_size) + ";");
+        out.write_line("");
+
+        return out.str() + literals.str() + "\n" + body.str();
+    }
+
+    std::vector<NativeVariable> const& get_variables() {
+        return variables;
+    }
+
+    std::size_t get_storage_size() {
+        return storage_size;
+    }
+
+    std::size_t get_kernel_count() {
+        return plan.kernel_count();
+    }
+};
@@ -0,0 +1,93 @@
+//
+//  native_module.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <dlfcn.h>
+#include <unistd.h>
+
+/*
+ Builds generated C++ into a shared object with the system compiler ($CXX, or c++) and
+ loads it with dlopen. The build directory is removed once the library is mapped.
+ */
+class NativeModule {
+private:
+    void* handle = nullptr;
+    void (*entry)(double*) = nullptr;
+    std::size_t storage_size = 0;
+
+    static std::string compiler() {
+        const char* cxx = std::getenv("CXX");
+        return cxx != nullptr && cxx[0] != '\0' ? cxx : "c++";
+    }
+public:
+    NativeModule(std::string const& source) {
+        char dir[] = "/tmp/apollo-XXXXXX";
+
+        if (mkdtemp(dir) == nullptr) {
+            Error(-1, "Cannot create a build directory");
+        }
+
+        std::string cpp_path = std::string(dir) + "/program.cpp";
+        std::string so_path = std::string(dir) + "/program.so";
+
+        std::ofstream(cpp_path) << source;
+
+        std::string command = compiler() + " -std=c++17 -O3 -march=native -shared -fPIC -o '" + so_path + "' '" + cpp_path + "'";
+        int status = std::system(command.c_str());
+
+        if (status == 0) {
+            handle = dlopen(so_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        }
+
+        unlink(cpp_path.c_str());
+        unlink(so_path.c_str());
+        rmdir(dir);
+
+        if (status != 0) {
+            Error(-1, "Native compilation failed: " + command);
+        }
+
+        if (handle == nullptr) {
+            Error(-1, dlerror());
+        }
+
+        entry = (void (*)(double*)) dlsym(handle, "apollo_run");
+        const std::size_t* size = (const std::size_t*) dlsym(handle, "apollo_storage_size");
+
+        if (entry == nullptr || size == nullptr) {
+            Error(-1, "Not an apollo module");
+        }
+
+        storage_size = *size;
+    }
+
+    NativeModule(NativeModule const&) = delete;
+
+    NativeModule& operator=(NativeModule const&) = delete;
+
+    ~NativeModule() {
+        if (handle != nullptr) { dlclose(handle); }
+    }
+
+    std::size_t get_storage_size() {
+        return storage_size;
+    }
+
+    // storage must hold get_storage_size() doubles
+    void run(double* storage) {
+        entry(storage);
+    }
+
+    std::vector<double> run() {
+        std::vector<double> storage(storage_size);
+        run(storage.data());
+        return storage;
+    }
+};
@@ -11,12 +11,15 @@
 #include <iostream>
 #include <fstream>
 #include <unordered_map>
+#include <memory>
 
 #include "data_type.cpp"
 #include "symbol_table.cpp"
 #include "virtual_segment.cpp"
 #include "error.cpp"
 #include "vm_writer.cpp"
+#include "arena.cpp"
+#include "sparse_tensor.cpp"
 
 std::unordered_map<DataType, TokenType> const dtype_to_ttype = { {DataType::INT, TokenType::T_INT}, {DataType::FLOAT, TokenType::T_FLOAT} };
 std::unordered_map<VarKind, std::string> const vkind_to_vsegment = { {VarKind::ARG, "argument"}, {VarKind::LOCAL, "local"}, {VarKind::GLOBAL, "global"} };
@@ -24,7 +27,7 @@ std::unordered_map<VarKind, std::string> const vkind_to_vsegment = { {VarKind::A
 class ASTNode {
 private:
     Token token;
-    std::vector<std::shared_ptr<ASTNode>> children;
+    std::vector<ASTNode*> children;
 public:
     ASTNode() {
         token = Token();
@@ -49,12 +52,12 @@ public:
         this->token = token;
     }
 
-    std::vector<std::shared_ptr<ASTNode>> const& get_children() {
+    std::vector<ASTNode*> const& get_children() {
         return children;
     }
 
-    void add_child(std::shared_ptr<ASTNode>& child) {
-        children.push_back(std::move(child));
+    void add_child(ASTNode* child) {
+        children.push_back(child);
     }
 
     void write_line(std::string line, int indents) {
@@ -67,7 +70,7 @@ public:
 
     virtual void print(int indents=0) = 0;
     
-    virtual void codegen(std::ofstream& out, SymbolTable& symbol_table) = 0;
+    virtual void codegen(VMWriter& writer, SymbolTable& symbol_table) = 0;
 };
 
 class ProgramNode : public ASTNode {
@@ -86,7 +89,7 @@ public:
         write_line("<" + get_token().get_token() + ">", indents);
         indents++;
 
-        for (std::shared_ptr<ASTNode> const& child : get_children()) {
+        for (ASTNode* child : get_children()) {
             child->print(indents);
         }
 
@@ -94,7 +97,7 @@ public:
         write_line("</" + get_token().get_token() + ">", indents);
     }
     
-    void codegen(std::ofstream& out, SymbolTable& symbol_table) override {
+    void codegen(VMWriter& writer, SymbolTable& symbol_table) override {
         
     }
 };
@@ -107,27 +110,22 @@ public:
 class ExpressionNode : public ASTNode {
 private:
     Token value;
-    std::shared_ptr<ExpressionNode> left, right;
+    ExpressionNode* left = nullptr;
+    ExpressionNode* right = nullptr;
+    int temp = -1;
+    bool emitted = false;
 public:
     ExpressionNode() : ASTNode() {}
 
     ExpressionNode(Token t) : value(t), ASTNode(t) {}
     
-    ExpressionNode(Token t, std::shared_ptr<ExpressionNode> left_ptr, std::shared_ptr<ExpressionNode> right_ptr) : value(t), ASTNode(t) {
-        std::shared_ptr<ASTNode> left_child = std::make_shared<ExpressionNode>(*left_ptr);
-        std::shared_ptr<ASTNode> right_child = std::make_shared<ExpressionNode>(*right_ptr);
+    // Operands are shared, not copied: children and left/right point at the same arena nodes
+    ExpressionNode(Token t, ExpressionNode* left_ptr, ExpressionNode* right_ptr) : value(t), ASTNode(t) {
         left = left_ptr;
         right = right_ptr;
-        add_child(left_child);
-        add_child(right_child);
-    }
-    
-    ExpressionNode& operator=(ExpressionNode other) {
-        value = other.get_value();
-        left = other.get_left();
-        right = other.get_right();
         
-        return *this;
+        if (left != nullptr) { add_child(left); }
+        if (right != nullptr) { add_child(right); }
     }
 
     Token get_value() {
@@ -138,20 +136,29 @@ public:
         this->value = value;
     }
 
-    std::shared_ptr<ExpressionNode> get_left() {
+    ExpressionNode* get_left() {
         return left;
     }
 
-    void set_left(ExpressionNode left) {
-        this->left = std::make_shared<ExpressionNode>(left);
+    void set_left(ExpressionNode* left) {
+        this->left = left;
     }
 
-    std::shared_ptr<ExpressionNode> get_right() {
+    ExpressionNode* get_right() {
         return right;
     }
 
-    void set_right(ExpressionNode right) {
-        this->right = std::make_shared<ExpressionNode>(right);
+    void set_right(ExpressionNode* right) {
+        this->right = right;
+    }
+    
+    // A subtree shared by several parents is computed once into temp, then pushed from there
+    int get_temp() {
+        return temp;
+    }
+    
+    void set_temp(int temp) {
+        this->temp = temp;
     }
 
     virtual void print(int indents=0) override {
@@ -172,78 +179,93 @@ public:
         write_line("</expr_node>", indents);
     }
     
-    virtual void codegen(std::ofstream& out, SymbolTable& symbol_table) override {
+    virtual void codegen(VMWriter& writer, SymbolTable& symbol_table) override {
         std::unordered_map<std::string, std::string> fmap_binary = { {"+", "fadd"}, {"-", "fsub"}, {"*", "fmult"}, {"/", "fdiv"} };
         std::unordered_map<std::string, std::string> fmap_unary = { {"-", "fneg"} };
         int f1 = -1, f2 = -1;
         
+        if (emitted) {
+            writer.write_push("temp", temp);
+            return;
+        }
+        
         if (left != nullptr) {
             f1 = 1;
-            left->codegen(out, symbol_table);
+            left->codegen(writer, symbol_table);
         }
         
         if (right != nullptr) {
             f2 = 1;
-            right->codegen(out, symbol_table);
+            right->codegen(writer, symbol_table);
         }
         
         if (f1 == 1 && f2 == 1) {
             if (fmap_binary.find(value.get_token()) != fmap_binary.end()) {
-                out << fmap_binary.at(value.get_token()) << std::endl;
+                writer.write_arithmetic(fmap_binary.at(value.get_token()));
             } /* else if (op in tmap_binary) { out << tmap_binary.at(value.get_token()) << std::endl; } */
         } else if (f1 == 1 || f2 == 1) {
             if (fmap_unary.find(value.get_token()) != fmap_unary.end()) {
-                out << fmap_unary.at(value.get_token()) << std::endl;
+                writer.write_arithmetic(fmap_unary.at(value.get_token()));
             } /* else if (op in tmap_unary) { out << tmap_unary.at(value.get_token()) << std::endl; } */
         }
+        
+        if (temp >= 0) {
+            writer.write_pop("temp", temp);
+            writer.write_push("temp", temp);
+            emitted = true;
+        }
 
     }
 };
 
 class TensorNode : public ExpressionNode {
 private:
-    int index;
-    std::shared_ptr<TensorNode> first_child;
-    std::shared_ptr<TensorNode> next_sibling;
-public:
-    TensorNode() : ExpressionNode(Token("tensor")) {
-        first_child = std::shared_ptr<TensorNode>();
-        next_sibling = std::shared_ptr<TensorNode>();
-    }
-    
+    SparseTensor storage;
+    DataType dtype;
+protected:
     TensorNode(std::string number, DataType dtype) : ExpressionNode(Token(number, dtype_to_ttype.at(dtype))) {
-        first_child = nullptr;
-        next_sibling = nullptr;
+        this->dtype = dtype;
+    }
+public:
+    TensorNode(SparseTensor storage, DataType dtype) : ExpressionNode(Token("tensor")) {
+        this->storage = std::move(storage);
+        this->dtype = dtype;
     }
     
-    int get_index() { return index; }
-    
-    void set_index(int index) { this->index = index; }
-    
-    std::shared_ptr<TensorNode> get_first_child() { return first_child; }
-    
-    void set_first_child(std::shared_ptr<TensorNode> first_child) { this->first_child = first_child; }
-    
-    std::shared_ptr<TensorNode> get_next_sibling() { return next_sibling; }
+    SparseTensor const& get_storage() { return storage; }
     
-    void set_next_sibling(std::shared_ptr<TensorNode> next_sibling) { this->next_sibling = next_sibling; };
+    DataType get_dtype() { return dtype; }
     
     bool is_leaf() {
         return false;
     }
     
-    void codegen(std::ofstream& out, SymbolTable& symbol_table) override {
-        VMWriter::write_push(out, "constant", index);
-        first_child->codegen(out, symbol_table);
-        next_sibling->codegen(out, symbol_table);
+    // Allocates the dense tensor (Memory.alloc zero-fills) and stores only the nonzeros
+    void codegen(VMWriter& writer, SymbolTable& symbol_table) override {
+        writer.write_malloc(storage.volume());
+        writer.write_pop("pointer", 0);
+        
+        storage.for_each_nonzero([&](std::vector<int> const& coords, double value) {
+            writer.write_push("constant", value);
+            writer.write_pop("this", (int) storage.linear_index(coords));
+        });
+        
+        writer.write_push("pointer", 0);
     }
     
     void print(int indents=0) override {
-        write_line("<tensor>", indents);
+        std::string shape = "";
+        for (int d : storage.get_dims()) { shape += "[" + std::to_string(d) + "]"; }
+        
+        write_line("<tensor" + shape + ">", indents);
         indents++;
         
-        first_child->print(indents=indents);
-        next_sibling->print(indents=indents);
+        storage.for_each_nonzero([&](std::vector<int> const& coords, double value) {
+            std::ostringstream os;
+            for (int c : coords) { os << "[" << c << "]"; }
+            os << " " << value;
+            write_line(os.str(), indents);
+        });
         
         indents--;
         write_line("</tensor>", indents);
@@ -465,20 +487,14 @@ public:
 class ScalarNode : public TensorNode {
 private:
     double number;
-    DataType dtype;
 public:
     ScalarNode(std::string number, DataType dtype) : TensorNode(number, dtype) {
         this->number = std::stod(number);
-        this->dtype = dtype;
     }
 
     double get_number() {
         return number;
     }
-
-    DataType get_dtype() {
-        return dtype;
-    }
     
     bool is_leaf() {
         return true;
@@ -490,8 +506,8 @@ public:
         write_line(os.str(), indents);
     }
     
-    void codegen(std::ofstream& out, SymbolTable& symbol_table) override {
-        VMWriter::write_push(out, "constant", number);
+    void codegen(VMWriter& writer, SymbolTable& symbol_table) override {
+        writer.write_push("constant", number);
     }
 };
 
@@ -513,14 +529,85 @@ public:
     
     void print(int indents=0) override {}
     
-    void codegen(std::ofstream& out, SymbolTable& symbol_table) override {
+    void codegen(VMWriter& writer, SymbolTable& symbol_table) override {
         VarKind kind = symbol_table.kind_of(name);
         
         if (kind == VarKind::NONE) {
             IllegalIdentifierError(-1);
         }
         
-        VMWriter::write_push(out, vkind_to_vsegment.at(kind), symbol_table.index_of(name));
+        writer.write_push(vkind_to_vsegment.at(kind), symbol_table.index_of(name));
+    }
+};
+
+// A[i,j,l]: a tensor variable with one index name per dimension
+class IndexedNode : public ExpressionNode {
+private:
+    std::string name;
+    std::vector<std::string> indices;
+public:
+    IndexedNode(std::string name, std::vector<std::string> indices) : ExpressionNode(Token(name)) {
+        this->name = name;
+        this->indices = indices;
+    }
+    
+    std::string get_name() {
+        return name;
+    }
+    
+    std::vector<std::string> const& get_indices() {
+        return indices;
+    }
+    
+    void print(int indents=0) override {
+        std::string text = name + "[";
+        for (std::size_t i = 0; i < indices.size(); i++) { text += (i == 0 ? "" : ",") + indices[i]; }
+        
+        write_line(text + "]", indents);
+    }
+    
+    void codegen(VMWriter& writer, SymbolTable& symbol_table) override {
+        LogicalError(-1);
+    }
+};
+
+// A[i,j,l] @ B[j,l,k] into output indices [i,k]: every index missing from the output is summed over
+class ContractionNode : public ExpressionNode {
+private:
+    std::vector<IndexedNode*> operands;
+    std::vector<std::string> output;
+public:
+    ContractionNode(std::vector<IndexedNode*> operands, std::vector<std::string> output) : ExpressionNode(Token("@")) {
+        this->operands = operands;
+        this->output = output;
+        
+        for (IndexedNode* operand : operands) { add_child(operand); }
+    }
+    
+    std::vector<IndexedNode*> const& get_operands() {
+        return operands;
+    }
+    
+    std::vector<std::string> const& get_output() {
+        return output;
+    }
+    
+    void print(int indents=0) override {
+        std::string text = "<contraction[";
+        for (std::size_t i = 0; i < output.size(); i++) { text += (i == 0 ? "" : ",") + output[i]; }
+        
+        write_line(text + "]>", indents);
+        indents++;
+        
+        for (IndexedNode* operand : operands) { operand->print(indents); }
+        
+        indents--;
+        write_line("</contraction>", indents);
+    }
+    
+    // contractions need loops, which only the native backend has
+    void codegen(VMWriter& writer, SymbolTable& symbol_table) override {
+        LogicalError(-1);
     }
 };
 
@@ -529,13 +616,19 @@ private:
     std::string name;
     std::string type;
     VarKind kind;
-    std::shared_ptr<ExpressionNode> rhs;
+    ExpressionNode* rhs;
+    std::vector<int> dims;
+    bool has_shape;
+    std::vector<std::string> formats;
 public:
-    VarDecNode(std::string name, std::string type, VarKind kind, std::shared_ptr<ExpressionNode> right) : ASTNode(Token("var_dec")) {
+    VarDecNode(std::string name, std::string type, VarKind kind, ExpressionNode* right, std::vector<int> dims={}, bool has_shape=false, std::vector<std::string> formats={}) : ASTNode(Token("var_dec")) {
         this->name = name;
         this->type = type;
         this->kind = kind;
         rhs = right;
+        this->dims = dims;
+        this->has_shape = has_shape;
+        this->formats = formats;
     }
 
     std::string get_name() {
@@ -550,27 +643,48 @@ public:
         return kind;
     }
 
-    std::shared_ptr<ExpressionNode> get_rhs() {
+    ExpressionNode* get_rhs() {
         return rhs;
     }
+    
+    void set_rhs(ExpressionNode* rhs) {
+        this->rhs = rhs;
+    }
+    
+    // the tensor[..] annotation; without one a tensor takes the shape of its expression
+    std::vector<int> const& get_dims() {
+        return dims;
+    }
+    
+    bool get_has_shape() {
+        return has_shape;
+    }
+    
+    // the {dense, compressed} annotation, one storage format per level; empty if none
+    std::vector<std::string> const& get_formats() {
+        return formats;
+    }
 
     void print(int indents=0) override {
         write_line("<var_dec>", indents);
         indents++;
         
-        write_line(name + "{" + type + "}: ", indents);
+        std::string shape = "";
+        for (int d : dims) { shape += "[" + std::to_string(d) + "]"; }
+        
+        write_line(name + "{" + type + shape + "}: ", indents);
         rhs->print(indents);
         
         indents--;
         write_line("</var_dec>", indents);
     }
     
-    void codegen(std::ofstream& out, SymbolTable& symbol_table) override {
-        rhs->codegen(out, symbol_table);
+    void codegen(VMWriter& writer, SymbolTable& symbol_table) override {
+        rhs->codegen(writer, symbol_table);
         symbol_table.define(name, type, kind);
         
         if (rhs != nullptr) {
-            VMWriter::write_pop(out, vkind_to_vsegment.at(kind), symbol_table.index_of(name));
+            writer.write_pop(vkind_to_vsegment.at(kind), symbol_table.index_of(name));
         }
     }
 };
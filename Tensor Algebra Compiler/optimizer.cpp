@@ -0,0 +1,238 @@
+//
+//  optimizer.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/*
+ Runs between the parser and the code generators, rewriting each statement's expression:
+
+    1. Arithmetic on literals (scalar or tensor) is folded at compile time.
+    2. A variable declared with a constant expression is recorded in the SymbolTable;
+       scalar constants replace their uses, tensor constants are only read while folding.
+    3. Identical subtrees are hash-consed into one node, across statements too. Interior
+       nodes that end up with several parents get a temp slot, so the VM computes them once.
+
+ New nodes come from the parse's Arena; nodes are shared, never copied.
+ */
+class Optimizer {
+private:
+    Arena& arena;
+    SymbolTable symbol_table;
+
+    // an identifier's key includes how often its name has been declared, so a redeclared
+    // variable never shares nodes with the old one
+    std::unordered_map<std::string, int> versions;
+    std::unordered_map<std::string, ExpressionNode*> interned;
+    std::unordered_map<ExpressionNode*, std::string> ids;
+    std::unordered_map<ExpressionNode*, int> uses;
+    std::vector<ExpressionNode*> roots;
+    int temp_count = 0;
+
+    static bool is_leaf(ExpressionNode* n) {
+        return dynamic_cast<TensorNode*>(n) != nullptr || dynamic_cast<IndentifierNode*>(n) != nullptr;
+    }
+
+    static bool is_foldable(ExpressionNode* n) {
+        std::string op = n->get_value().get_token();
+
+        if (n->get_left() == nullptr) {
+            return n->get_right() != nullptr && op == "-";
+        }
+
+        return n->get_right() != nullptr && (op == "+" || op == "-" || op == "*" || op == "/");
+    }
+
+    static double apply(std::string const& op, double a, double b) {
+        if (op == "+") { return a + b; }
+        if (op == "-") { return a - b; }
+        if (op == "*") { return a * b; }
+        return a / b;
+    }
+
+    TensorNode* constant_value(ExpressionNode* n) {
+        if (TensorNode* tensor = dynamic_cast<TensorNode*>(n)) {
+            return tensor;
+        } else if (IndentifierNode* identifier = dynamic_cast<IndentifierNode*>(n)) {
+            return symbol_table.constant_of(identifier->get_name());
+        }
+
+        return nullptr;
+    }
+
+    // Scalars broadcast; other shapes fold only when equal and are left to ShapeInference
+    static bool can_fold(TensorNode* left, TensorNode* right) {
+        return left == nullptr || dynamic_cast<ScalarNode*>(left) != nullptr || dynamic_cast<ScalarNode*>(right) != nullptr ||
+            left->get_storage().get_dims() == right->get_storage().get_dims();
+    }
+
+    // left is null for unary minus
+    TensorNode* fold(std::string const& op, TensorNode* left, TensorNode* right) {
+        ScalarNode* left_scalar = dynamic_cast<ScalarNode*>(left);
+        ScalarNode* right_scalar = dynamic_cast<ScalarNode*>(right);
+        bool is_float = op == "/" || right->get_dtype() == DataType::FLOAT || (left != nullptr && left->get_dtype() == DataType::FLOAT);
+        DataType dtype = is_float ? DataType::FLOAT : DataType::INT;
+
+        if (left == nullptr && right_scalar != nullptr) {
+            return arena.make<ScalarNode>(format_double(-right_scalar->get_number()), dtype);
+        } else if (left_scalar != nullptr && right_scalar != nullptr) {
+            return arena.make<ScalarNode>(format_double(apply(op, left_scalar->get_number(), right_scalar->get_number())), dtype);
+        }
+
+        std::vector<int> dims = right_scalar == nullptr ? right->get_storage().get_dims() : left->get_storage().get_dims();
+        std::size_t volume = right_scalar == nullptr ? right->get_storage().volume() : left->get_storage().volume();
+        std::vector<double> a = left == nullptr ? std::vector<double>(volume, 0.0) : dense(left, volume);
+        std::vector<double> b = dense(right, volume);
+
+        std::vector<std::uint32_t> coords;
+        std::vector<double> values;
+
+        for (std::size_t i = 0; i < volume; i++) {
+            double value = apply(op, a[i], b[i]);
+
+            if (value == 0) { continue; }
+
+            std::size_t rest = i;
+            std::size_t first = coords.size();
+            coords.resize(first + dims.size());
+
+            for (int l = (int) dims.size() - 1; l >= 0; l--) {
+                coords[first + l] = (std::uint32_t) (rest % dims[l]);
+                rest /= dims[l];
+            }
+
+            values.push_back(value);
+        }
+
+        return arena.make<TensorNode>(SparseTensor(dims, coords, values), dtype);
+    }
+
+    static std::vector<double> dense(TensorNode* n, std::size_t volume) {
+        if (ScalarNode* scalar = dynamic_cast<ScalarNode*>(n)) {
+            return std::vector<double>(volume, scalar->get_number());
+        }
+
+        std::vector<double> values(volume, 0.0);
+
+        n->get_storage().for_each_nonzero([&](std::vector<int> const& coords, double value) {
+            values[n->get_storage().linear_index(coords)] = value;
+        });
+
+        return values;
+    }
+
+    // The canonical node for n's structure, n itself if it is the first of its kind
+    ExpressionNode* intern(ExpressionNode* n) {
+        std::string key;
+
+        if (ScalarNode* scalar = dynamic_cast<ScalarNode*>(n)) {
+            key = "c" + format_double(scalar->get_number());
+        } else if (dynamic_cast<TensorNode*>(n) != nullptr) {
+            key = "t" + std::to_string(ids.size());
+        } else if (IndentifierNode* identifier = dynamic_cast<IndentifierNode*>(n)) {
+            key = "v" + identifier->get_name() + "#" + std::to_string(versions[identifier->get_name()]);
+        } else {
+            std::string left = n->get_left() == nullptr ? "" : ids.at(n->get_left());
+            std::string right = n->get_right() == nullptr ? "" : ids.at(n->get_right());
+            key = n->get_value().get_token() + "(" + left + "," + right + ")";
+        }
+
+        if (interned.find(key) != interned.end()) {
+            return interned.at(key);
+        }
+
+        interned[key] = n;
+        ids[n] = std::to_string(ids.size());
+
+        return n;
+    }
+
+    ExpressionNode* optimize(ExpressionNode* n) {
+        if (IndentifierNode* identifier = dynamic_cast<IndentifierNode*>(n)) {
+            ScalarNode* constant = dynamic_cast<ScalarNode*>(symbol_table.constant_of(identifier->get_name()));
+            return intern(constant != nullptr ? constant : n);
+        } else if (is_leaf(n)) {
+            return intern(n);
+        } else if (n->get_left() == nullptr && n->get_right() == nullptr) {
+            return n;
+        }
+
+        ExpressionNode* left = n->get_left() == nullptr ? nullptr : optimize(n->get_left());
+        ExpressionNode* right = n->get_right() == nullptr ? nullptr : optimize(n->get_right());
+
+        TensorNode* left_value = left == nullptr ? nullptr : constant_value(left);
+        TensorNode* right_value = constant_value(right);
+
+        if (is_foldable(n) && (left == nullptr || left_value != nullptr) && right_value != nullptr && can_fold(left_value, right_value)) {
+            return intern(fold(n->get_value().get_token(), left_value, right_value));
+        }
+
+        if (left != n->get_left() || right != n->get_right()) {
+            n = arena.make<ExpressionNode>(n->get_value(), left, right);
+        }
+
+        return intern(n);
+    }
+
+    void statement(VarDecNode* n) {
+        ExpressionNode* rhs = optimize(n->get_rhs());
+        n->set_rhs(rhs);
+        roots.push_back(rhs);
+
+        TensorNode* constant = constant_value(rhs);
+
+        // a constant that broadcasts to a declared shape is not the variable's value
+        if (constant != nullptr && n->get_has_shape() &&
+            (dynamic_cast<ScalarNode*>(constant) != nullptr || constant->get_storage().get_dims() != n->get_dims())) {
+            constant = nullptr;
+        }
+
+        symbol_table.define(n->get_name(), n->get_type(), n->get_kind());
+        symbol_table.set_constant(n->get_name(), constant);
+        versions[n->get_name()]++;
+    }
+
+    // the second parent of an interior node gives it a temp, in program order
+    void count_uses(ExpressionNode* n) {
+        if (n == nullptr) { return; }
+
+        if (++uses[n] == 2 && !is_leaf(n)) {
+            n->set_temp(temp_count++);
+        }
+
+        if (uses[n] > 1) { return; }
+
+        count_uses(n->get_left());
+        count_uses(n->get_right());
+    }
+
+    void optimize_helper(ASTNode& n) {
+        if (VarDecNode* var_dec = dynamic_cast<VarDecNode*>(&n)) {
+            statement(var_dec);
+            return;
+        }
+
+        for (ASTNode* child : n.get_children()) {
+            optimize_helper(*child);
+        }
+    }
+public:
+    Optimizer(Arena& arena) : arena(arena) {}
+
+    void optimize(ProgramNode* ast) {
+        optimize_helper(*ast);
+
+        for (ExpressionNode* root : roots) {
+            count_uses(root);
+        }
+    }
+
+    int get_temp_count() {
+        return temp_count;
+    }
+};
@@ -0,0 +1,219 @@
+//
+//  parse_sink.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+// Receives the parse as a stream of events. Events carry views into the tokenizer's
+// input, so a sink that ignores them costs the parser nothing beyond the call.
+class ParseSink {
+public:
+    virtual ~ParseSink() = default;
+
+    virtual void begin(std::string_view rule) {}
+
+    virtual void end(std::string_view rule) {}
+
+    virtual void token(Lexeme const& lexeme) {}
+
+    virtual void identifier(std::string_view kind, int index, Lexeme const& lexeme) {}
+};
+
+class NullParseSink : public ParseSink {};
+
+// Base for sinks that write a file: output goes through an in-memory buffer in large chunks
+class BufferedParseSink : public ParseSink {
+private:
+    static constexpr std::size_t flush_threshold = 1 << 16;
+
+    std::ofstream out;
+
+    // Errors exit() without unwinding, so open sinks are flushed from an atexit handler
+    static std::vector<BufferedParseSink*>& open_sinks() {
+        static std::vector<BufferedParseSink*> sinks;
+        return sinks;
+    }
+
+    static void flush_open_sinks() {
+        for (BufferedParseSink* sink : open_sinks()) { sink->flush(); }
+    }
+protected:
+    std::string buffer;
+
+    void maybe_flush() {
+        if (buffer.size() >= flush_threshold) { flush(); }
+    }
+public:
+    BufferedParseSink(std::string ofname, std::ios::openmode mode) {
+        out = std::ofstream(ofname, mode);
+        buffer.reserve(flush_threshold * 2);
+
+        if (open_sinks().empty()) { std::atexit(flush_open_sinks); }
+        open_sinks().push_back(this);
+    }
+
+    ~BufferedParseSink() override {
+        flush();
+        open_sinks().erase(std::find(open_sinks().begin(), open_sinks().end(), this));
+    }
+
+    void flush() {
+        out.write(buffer.data(), buffer.size());
+        out.flush();
+        buffer.clear();
+    }
+};
+
+// The indented XML parse tree the parser used to write unconditionally
+class XmlParseSink : public BufferedParseSink {
+private:
+    int indents;
+
+    void write_line(std::string_view a, std::string_view b="", std::string_view c="") {
+        buffer.append(indents, '\t');
+        buffer.append(a);
+        buffer.append(b);
+        buffer.append(c);
+        buffer.push_back('\n');
+        maybe_flush();
+    }
+
+    static std::string_view escape(std::string_view text) {
+        if (text == "<") { return "&lt;"; }
+        if (text == ">") { return "&gt;"; }
+        if (text == "\"") { return "&quot;"; }
+        if (text == "&") { return "&amp;"; }
+        return text;
+    }
+public:
+    XmlParseSink(std::string ofname) : BufferedParseSink(ofname, std::ios::out) {
+        indents = 0;
+    }
+
+    void begin(std::string_view rule) override {
+        write_line("<", rule, ">");
+        indents++;
+    }
+
+    void end(std::string_view rule) override {
+        indents--;
+        write_line("</", rule, ">");
+    }
+
+    void token(Lexeme const& lexeme) override {
+        switch (lexeme.get_type()) {
+            case TokenType::T_KEYWORD:
+                write_line("<keyword> ", lexeme.get_text(), " </keyword>");
+                break;
+            case TokenType::T_SYMBOL:
+                write_line("<symbol> ", escape(lexeme.get_text()), " </symbol>");
+                break;
+            case TokenType::T_IDENTIFIER:
+                write_line("<identifier>", lexeme.get_text(), " </identifier>");
+                break;
+            case TokenType::T_INT:
+                write_line("<int_const> ", lexeme.get_text(), " </int_const>");
+                break;
+            case TokenType::T_FLOAT:
+                write_line("<float_const> ", lexeme.get_text(), " </float_const>");
+                break;
+            default:
+                write_line("");
+        }
+    }
+
+    void identifier(std::string_view kind, int index, Lexeme const& lexeme) override {
+        std::string tag = std::string(kind) + "_identifier" + std::to_string(index);
+        write_line("<" + tag + "> ", lexeme.get_text(), " </" + tag + ">");
+    }
+};
+
+/*
+ Compact binary trace: "APTR" and a version byte, then one record per event.
+
+    RULE        0x00 id:varint length:varint bytes      (first use of a rule name)
+    BEGIN       0x01 id:varint
+    END         0x02 id:varint
+    TOKEN       0x03 type:u8 offset:varint length:varint bytes
+    IDENTIFIER  0x04 kind_id:varint index:varint offset:varint length:varint bytes
+ */
+class TraceParseSink : public BufferedParseSink {
+private:
+    static constexpr unsigned char version = 1;
+
+    std::unordered_map<std::string, std::size_t> rule_ids;
+
+    void write_varint(std::size_t n) {
+        while (n >= 0x80) {
+            buffer.push_back((char) (n | 0x80));
+            n >>= 7;
+        }
+
+        buffer.push_back((char) n);
+    }
+
+    void write_bytes(std::string_view bytes) {
+        write_varint(bytes.size());
+        buffer.append(bytes);
+    }
+
+    std::size_t rule_id(std::string_view rule) {
+        auto it = rule_ids.find(std::string(rule));
+
+        if (it != rule_ids.end()) { return it->second; }
+
+        std::size_t id = rule_ids.size();
+        rule_ids.insert({std::string(rule), id});
+        buffer.push_back(0x00);
+        write_varint(id);
+        write_bytes(rule);
+
+        return id;
+    }
+public:
+    TraceParseSink(std::string ofname) : BufferedParseSink(ofname, std::ios::out | std::ios::binary) {
+        buffer.append("APTR");
+        buffer.push_back((char) version);
+    }
+
+    void begin(std::string_view rule) override {
+        std::size_t id = rule_id(rule);
+        buffer.push_back(0x01);
+        write_varint(id);
+        maybe_flush();
+    }
+
+    void end(std::string_view rule) override {
+        std::size_t id = rule_id(rule);
+        buffer.push_back(0x02);
+        write_varint(id);
+        maybe_flush();
+    }
+
+    void token(Lexeme const& lexeme) override {
+        buffer.push_back(0x03);
+        buffer.push_back((char) lexeme.get_type());
+        write_varint(lexeme.get_offset());
+        write_bytes(lexeme.get_text());
+        maybe_flush();
+    }
+
+    void identifier(std::string_view kind, int index, Lexeme const& lexeme) override {
+        std::size_t kind_id = rule_id(kind);
+        buffer.push_back(0x04);
+        write_varint(kind_id);
+        write_varint(index);
+        write_varint(lexeme.get_offset());
+        write_bytes(lexeme.get_text());
+        maybe_flush();
+    }
+};
@@ -11,73 +11,44 @@
 #include <fstream>
 
 #include "tokenizer.cpp"
+#include "parse_sink.cpp"
 
 class Parser {
 private:
     std::regex const r_type = std::regex("int|float|tensor");
+    std::regex const r_format = std::regex("dense|compressed|singleton");
     std::regex const r_statements = std::regex("let");
     std::regex const r_binary_op = std::regex("[@+*-/^%]");
     std::regex const r_unary_op = std::regex("[~'-]");
     std::unordered_map<VarKind, std::string> const kind_to_string = { {VarKind::ARG, "arg"}, {VarKind::LOCAL, "local"}, {VarKind::GLOBAL, "global"}, {VarKind::NONE, "none"} };
     std::unordered_map<TokenType, DataType> const ttype_to_dtype = { {TokenType::T_INT, DataType::INT}, {TokenType::T_FLOAT, DataType::FLOAT} };
-    std::unordered_map<char, int> const precedence_map = { {'^', 3}, {'/', 2}, {'*', 2}, {'+', 1}, {'-', 1} };
-    std::unordered_map<char, bool> const left_associativity_map = { {'^', false}, {'/', true}, {'*', true}, {'+', true}, {'-', true} };
+    std::unordered_map<char, int> const precedence_map = { {'^', 3}, {'/', 2}, {'*', 2}, {'@', 2}, {'+', 1}, {'-', 1} };
+    std::unordered_map<char, bool> const left_associativity_map = { {'^', false}, {'/', true}, {'*', true}, {'@', true}, {'+', true}, {'-', true} };
     
-    std::ifstream in;
-    std::ofstream out;
     Tokenizer tokenizer;
+    Arena& arena;
+    ParseSink* sink;
     
-    int indents, num_labels;
+    int num_labels;
     SymbolTable symbol_table;
-public:
-    Parser(std::string& ifname, std::string ofname) : tokenizer(ifname) {
-        in = std::ifstream(ifname);
-        out = std::ofstream(ofname);
-        indents = 0;
-        num_labels = 0;
-    }
     
-    void write_line(std::string line) {
-        for (int i = 0; i < indents; i++) {
-            out << "\t";
-        }
-        
-        out << line << std::endl;
+    static ParseSink* null_sink() {
+        static NullParseSink sink;
+        return &sink;
     }
-    
-    void write_identifier(std::string identifier, std::string kind) {
-        std::string running_index = std::to_string(symbol_table.get_running_index());
-        write_line("<" + kind + "_identifier" + running_index + "> " + identifier + " </" + kind + "_identifier" + running_index + ">");
-    }
-    
-    std::string get_current_token_repr() {
-        switch (tokenizer.token_type()) {
-            case TokenType::T_KEYWORD:
-                return "<keyword> " + tokenizer.get_current_token() + " </keyword>";
-            case TokenType::T_SYMBOL:
-                if (regex_match(std::string(1, tokenizer.symbol()), std::regex("[<>\"&]"))) {
-                    return "<symbol> " + tokenizer.get_altered_symbols().at({tokenizer.symbol()}) + "; </symbol>";
-                } else {
-                    return "<symbol> " + std::string(1, tokenizer.symbol()) + " </symbol>";
-                }
-            case TokenType::T_IDENTIFIER:
-                return "<identifier>" + tokenizer.identifier() + " </identifier>";
-            case TokenType::T_INT:
-                return "<int_const> " + tokenizer.get_current_token() + " </int_const>";
-            case TokenType::T_FLOAT:
-                return "<float_const> " + tokenizer.get_current_token() + " </float_const>";
-            default:
-                return "";
-        }
+public:
+    Parser(std::string& ifname, Arena& arena, ParseSink* sink=nullptr) : tokenizer(ifname), arena(arena) {
+        this->sink = sink != nullptr ? sink : null_sink();
+        num_labels = 0;
     }
     
     void advance() {
-        write_line(get_current_token_repr());
+        sink->token(tokenizer.get_current_lexeme());
         tokenizer.advance();
     }
     
     void advance_identifier(std::string kind) {
-        write_identifier(tokenizer.identifier(), kind);
+        sink->identifier(kind, symbol_table.get_running_index(), tokenizer.get_current_lexeme());
         tokenizer.advance();
     }
     
@@ -119,110 +90,123 @@ public:
         return op == '^';
     }
     
-    ProgramNode parse_compilation_unit() {
-        write_line("<compilation_unit>");
-        indents++;
-        ProgramNode compilation_unit = ProgramNode("compilation_unit");
-        ProgramNode statements = parse_statements();
-        std::shared_ptr<ASTNode> statements_ptr = std::make_shared<ProgramNode>(statements);
-        compilation_unit.add_child(statements_ptr);
+    ProgramNode* parse_compilation_unit() {
+        sink->begin("compilation_unit");
+        ProgramNode* compilation_unit = arena.make<ProgramNode>("compilation_unit");
+        compilation_unit->add_child(parse_statements());
 //
-        indents--;
-        write_line("</compilation_unit>");
+        sink->end("compilation_unit");
 //
         return compilation_unit;
     }
     
-    ProgramNode parse_statements() {
-        write_line("<statements>");
-        indents++;
-        ProgramNode statements = ProgramNode("statements");
+    ProgramNode* parse_statements() {
+        sink->begin("statements");
+        ProgramNode* statements = arena.make<ProgramNode>("statements");
 
         symbol_table = SymbolTable();
 
         while (regex_match(tokenizer.get_current_token(), r_statements)) {
             if (tokenizer.get_current_token() == "let") {
-                VarDecNode var_dec = parse_var_dec();
-                std::shared_ptr<ASTNode> var_dec_ptr = std::make_shared<VarDecNode>(var_dec);
-                statements.add_child(var_dec_ptr);
+                statements->add_child(parse_var_dec());
             } else {
                 SyntaxError(-1);
             }
         }
 
-        indents--;
-        write_line("</statements>");
+        sink->end("statements");
 
         return statements;
     }
 //
-    VarDecNode parse_var_dec() {
-        write_line("<var_dec>");
-        indents++;
+    VarDecNode* parse_var_dec() {
+        sink->begin("var_dec");
 
         eat(std::regex("let"));
         std::string var_type = eat(r_type);
+        std::vector<int> dims;
+        bool has_shape = tokenizer.get_current_token() == "[";
 
-//        while (tokenizer.get_current_token() == "[") {
-//            eat(std::regex("\\["));
-//            parse_expression());
-//            eat(std::regex("\\]"));
-//        }
+        // tensor[3][2][2]: static dimensions only
+        while (tokenizer.get_current_token() == "[") {
+            eat(std::regex("\\["));
+
+            if (var_type != "tensor" || tokenizer.token_type() != TokenType::T_INT || std::stoi(tokenizer.get_current_token()) <= 0) {
+                SyntaxError(-1);
+            }
+
+            dims.push_back(std::stoi(tokenizer.get_current_token()));
+            advance();
+            eat(std::regex("\\]"));
+        }
+
+        // {dense, compressed}: how a tensor literal is stored, one format per level
+        std::vector<std::string> formats;
+
+        if (tokenizer.get_current_token() == "{") {
+            if (var_type != "tensor") {
+                SyntaxError(-1);
+            }
+
+            eat(std::regex("\\{"));
+            formats.push_back(eat(r_format));
+
+            while (tokenizer.get_current_token() == ",") {
+                eat(std::regex(","));
+                formats.push_back(eat(r_format));
+            }
+
+            eat(std::regex("\\}"));
+        }
 
         std::string var_name = eat_next_identifier(kind_to_string.at(VarKind::LOCAL));
-        symbol_table.define(var_name, var_type, VarKind::LOCAL);
+        bool has_output = tokenizer.get_current_token() == "[";
+        std::vector<std::string> output = has_output ? parse_index_list() : std::vector<std::string>();
+        symbol_table.define(var_name, var_type, VarKind::LOCAL, dims);
 
         eat(std::regex("="));
-        std::shared_ptr<ExpressionNode> rhs = parse_expression();
+        ExpressionNode* rhs = parse_contraction(parse_expression(), output, has_output);
         eat(std::regex(";"));
 
-        indents--;
-        write_line("</var_dec>");
-        return VarDecNode(var_name, var_type, VarKind::LOCAL, rhs);
+        sink->end("var_dec");
+        return arena.make<VarDecNode>(var_name, var_type, VarKind::LOCAL, rhs, dims, has_shape, formats);
     }
 //
-    std::shared_ptr<ExpressionNode> parse_expression() {
-        write_line("<expression>");
-        indents++;
-        std::shared_ptr<ExpressionNode> expression = parse_term();
+    ExpressionNode* parse_expression() {
+        sink->begin("expression");
+        ExpressionNode* expression = parse_term();
 
         while (regex_match(tokenizer.get_current_token(), std::regex("[+-]"))) {
             Token op = Token(tokenizer.get_current_token(), tokenizer.token_type());
             advance();
-            std::shared_ptr<ExpressionNode> term = parse_term();
-            ExpressionNode n = ExpressionNode(op, expression, term);
-            expression = std::make_shared<ExpressionNode>(n);
+            ExpressionNode* term = parse_term();
+            expression = arena.make<ExpressionNode>(op, expression, term);
         }
 
-        indents--;
-        write_line("</expression>");
+        sink->end("expression");
 
         return expression;
     }
 //
-    std::shared_ptr<ExpressionNode> parse_term() {
-        write_line("<term>");
-        indents++;
-        std::shared_ptr<ExpressionNode> term = parse_factor();
+    ExpressionNode* parse_term() {
+        sink->begin("term");
+        ExpressionNode* term = parse_factor();
 
-        while (regex_match(tokenizer.get_current_token(), std::regex("[*/]"))) {
+        while (regex_match(tokenizer.get_current_token(), std::regex("[*/@]"))) {
             Token op = Token(tokenizer.get_current_token(), tokenizer.token_type());
             advance();
-            std::shared_ptr<ExpressionNode> term2 = parse_term();
-            ExpressionNode n = ExpressionNode(op, term, term2);
-            term = std::make_shared<ExpressionNode>(n);
+            ExpressionNode* term2 = parse_term();
+            term = arena.make<ExpressionNode>(op, term, term2);
         }
 
-        indents--;
-        write_line("</term>");
+        sink->end("term");
 
         return term;
     }
 //
-    std::shared_ptr<ExpressionNode> parse_factor() {
-        write_line("<factor>");
-        indents++;
-        std::shared_ptr<ExpressionNode> factor;
+    ExpressionNode* parse_factor() {
+        sink->begin("factor");
+        ExpressionNode* factor;
 
         if (tokenizer.get_current_token() == "(") {
             advance();
@@ -232,81 +216,161 @@ public:
             factor = parse_primary();
         }
 
-        indents--;
-        write_line("</factor>");
+        sink->end("factor");
 
         return factor;
     }
 //
-    std::shared_ptr<ExpressionNode> parse_primary() {
-        write_line("<primary>");
-        indents++;
-        ExpressionNode n = ExpressionNode();
-        std::shared_ptr<ExpressionNode> primary = std::make_shared<ExpressionNode>(n);
+    ExpressionNode* parse_primary() {
+        sink->begin("primary");
+        ExpressionNode* primary = nullptr;
 
         if (tokenizer.token_type() == TokenType::T_INT ||
             tokenizer.token_type() == TokenType::T_FLOAT) {
-            ScalarNode scalar_node = ScalarNode(tokenizer.get_current_token(), ttype_to_dtype.at(tokenizer.token_type()));
-            primary = std::make_shared<ScalarNode>(scalar_node);
+            primary = arena.make<ScalarNode>(tokenizer.get_current_token(), ttype_to_dtype.at(tokenizer.token_type()));
             advance();
         } else if (tokenizer.token_type() == TokenType::T_IDENTIFIER) {
             VarKind var_kind = symbol_table.kind_of(tokenizer.get_current_token());
-            IndentifierNode identifier_node = IndentifierNode(tokenizer.get_current_token());
-            primary = std::make_shared<IndentifierNode>(identifier_node);
-            eat_next_identifier(kind_to_string.at(var_kind));
+            std::string name = eat_next_identifier(kind_to_string.at(var_kind));
+
+            if (tokenizer.get_current_token() == "[") {
+                primary = arena.make<IndexedNode>(name, parse_index_list());
+            } else {
+                primary = arena.make<IndentifierNode>(name);
+            }
         } else if (tokenizer.get_current_token() == "{") {
             primary = parse_tensor();
         } else if (regex_match(tokenizer.get_current_token(), r_unary_op)) {
             Token op = Token(tokenizer.get_current_token(), tokenizer.token_type());
             advance();
-            std::shared_ptr<ExpressionNode> term = parse_term();
-            primary->set_value(op);
-            primary->set_right(*term);
+            ExpressionNode* term = parse_term();
+            primary = arena.make<ExpressionNode>(op, nullptr, term);
+        } else {
+            primary = arena.make<ExpressionNode>();
         }
 
-        indents--;
-        write_line("</primary>");
+        sink->end("primary");
 
         return primary;
     }
     
-    std::shared_ptr<TensorNode> parse_tensor(std::shared_ptr<TensorNode> curr_node=std::make_shared<TensorNode>(TensorNode()), int level=0, int prev_level=0) {
-        while (tokenizer.get_current_token() == "{") {
-            prev_level = level;
-            level++;
-            
-            std::cout << prev_level << ", " << level << "|" << tokenizer.get_current_token() << std::endl;
-            
-            if (level < prev_level) {
-                curr_node->set_first_child(parse_tensor(curr_node=curr_node, level=level, prev_level=prev_level));
-            } else if (level == prev_level) {
-                curr_node->set_next_sibling(parse_tensor(curr_node=curr_node, level=level, prev_level=prev_level));
+    // [i, j, l]: index names are not variables, so they are plain tokens
+    std::vector<std::string> parse_index_list() {
+        std::vector<std::string> indices;
+        eat(std::regex("\\["));
+
+        while (tokenizer.token_type() == TokenType::T_IDENTIFIER) {
+            indices.push_back(tokenizer.get_current_token());
+            advance();
+
+            if (eat_if_next(std::regex(",")) != ",") { break; }
+        }
+
+        eat(std::regex("\\]"));
+
+        return indices;
+    }
+
+    // The operands of an @-chain of indexed tensors, in order; false for anything else
+    bool collect_operands(ExpressionNode* n, std::vector<IndexedNode*>& operands) {
+        if (IndexedNode* indexed = dynamic_cast<IndexedNode*>(n)) {
+            operands.push_back(indexed);
+            return true;
+        }
+
+        return n->get_value().get_token() == "@" && n->get_left() != nullptr && n->get_right() != nullptr &&
+            collect_operands(n->get_left(), operands) && collect_operands(n->get_right(), operands);
+    }
+
+    bool contains_indexed(ExpressionNode* n) {
+        return n != nullptr && (dynamic_cast<IndexedNode*>(n) != nullptr || contains_indexed(n->get_left()) || contains_indexed(n->get_right()));
+    }
+
+    /*
+     let tensor C[i,k] = A[i,j,l] @ B[j,l,k];
+     An expression with indexed operands must be a single @-chain of them. Without output
+     indices the result keeps the indices that occur once, in order of appearance.
+     */
+    ExpressionNode* parse_contraction(ExpressionNode* rhs, std::vector<std::string> output, bool has_output) {
+        std::vector<IndexedNode*> operands;
+
+        if (!collect_operands(rhs, operands)) {
+            if (has_output || contains_indexed(rhs)) {
+                SyntaxError(-1);
+            }
+
+            return rhs;
+        }
+
+        if (!has_output) {
+            std::unordered_map<std::string, int> counts;
+            std::vector<std::string> order;
+
+            for (IndexedNode* operand : operands) {
+                for (std::string const& index : operand->get_indices()) {
+                    if (counts[index]++ == 0) { order.push_back(index); }
+                }
+            }
+
+            for (std::string const& index : order) {
+                if (counts.at(index) == 1) { output.push_back(index); }
             }
-            
-            eat(std::regex("\\{"));
         }
+
+        return arena.make<ContractionNode>(operands, output);
+    }
+
+    TensorNode* parse_tensor() {
+        sink->begin("tensor");
+        SparseTensorBuilder builder = SparseTensorBuilder();
+        DataType dtype = DataType::INT;
+        
+        parse_tensor_list(builder, dtype);
+        
+        if (!builder.is_complete()) {
+            SyntaxError(-1);
+        }
+        
+        sink->end("tensor");
+        
+        return arena.make<TensorNode>(builder.build(), dtype);
+    }
+    
+    // { entry, entry, ... } where every entry is a number or a nested list; zeros are not stored
+    void parse_tensor_list(SparseTensorBuilder& builder, DataType& dtype) {
+        eat(std::regex("\\{"));
+        builder.enter();
         
         while (tokenizer.get_current_token() != "}") {
-            if (tokenizer.token_type() == TokenType::T_INT ||
-                tokenizer.token_type() == TokenType::T_FLOAT) {
-                if (tokenizer.get_current_token() != "0") {
-                    ScalarNode leaf_node = ScalarNode(tokenizer.get_current_token(), ttype_to_dtype.at(tokenizer.token_type()));
-                    curr_node->set_first_child(std::make_shared<TensorNode>(leaf_node));
+            if (tokenizer.get_current_token() == "{") {
+                parse_tensor_list(builder, dtype);
+            } else {
+                double sign = eat_if_next(std::regex("-")) == "-" ? -1 : 1;
+                
+                if (tokenizer.token_type() != TokenType::T_INT &&
+                    tokenizer.token_type() != TokenType::T_FLOAT) {
+                    SyntaxError(-1);
+                }
+                
+                if (tokenizer.token_type() == TokenType::T_FLOAT) { dtype = DataType::FLOAT; }
+                
+                if (!builder.add(sign * std::stod(tokenizer.get_current_token()))) {
+                    SyntaxError(-1);
                 }
+                
+                advance();
             }
             
-            advance();
-            eat_if_next(std::regex(","));
+            if (eat_if_next(std::regex(",")) != "," && tokenizer.get_current_token() != "}") {
+                SyntaxError(-1);
+            }
         }
         
-        while (tokenizer.get_current_token() == "}") {
-            level--;
-            
-            eat(std::regex("\\}"));
-            eat_if_next(std::regex(","));
-        }
+        eat(std::regex("\\}"));
         
-        return curr_node;
+        if (!builder.leave()) {
+            SyntaxError(-1);
+        }
     }
 //
 //    std::shared_ptr<TensorNode> parse_tensor(bool is_first_pass=true) {
@@ -0,0 +1,230 @@
+//
+//  shape_inference.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+std::string shape_to_string(std::vector<int> const& shape) {
+    if (shape.empty()) { return "scalar"; }
+
+    std::string text = "";
+    for (int d : shape) { text += "[" + std::to_string(d) + "]"; }
+    return text;
+}
+
+/*
+ Gives every expression and variable a static shape, and stops the compilation with a
+ ShapeError where they cannot agree:
+
+    + - * /    broadcast: shapes are aligned at the last dimension, and each pair of
+               dimensions must be equal or one of them 1 (a scalar has no dimensions)
+    A @ B      contracts the last dimension of A with the first of B:
+               [3][2] @ [2][4][5] is [3][4][5]
+    'A         reverses the dimensions: '[3][2][2] is [2][2][3]
+    -A         keeps the shape
+    A[i,j] @ B[j,k]    an index takes the same extent everywhere it appears; the
+                       result has the extents of the output indices
+
+ A tensor[..] annotation fixes a variable's shape and its expression must broadcast to
+ it; without one the variable takes the expression's shape. int and float are scalars.
+ A {dense, compressed, ..} format needs a literal and one format per dimension, and a
+ singleton level must follow a compressed or singleton one.
+ */
+class ShapeInference {
+private:
+    SymbolTable symbol_table;
+    std::unordered_map<ExpressionNode*, std::vector<int>> shapes;
+    std::unordered_map<VarDecNode*, std::vector<int>> variable_shapes;
+    std::unordered_map<ContractionNode*, std::unordered_map<std::string, int>> contraction_extents;
+    int statement_index = 0;
+
+    void mismatch(std::vector<int> const& left, std::string op, std::vector<int> const& right) {
+        ShapeError(statement_index, shape_to_string(left) + " " + op + " " + shape_to_string(right));
+    }
+
+    std::vector<int> broadcast(std::vector<int> const& left, std::string op, std::vector<int> const& right) {
+        std::vector<int> const& longer = left.size() >= right.size() ? left : right;
+        std::vector<int> const& shorter = left.size() >= right.size() ? right : left;
+        std::vector<int> result = longer;
+        std::size_t offset = longer.size() - shorter.size();
+
+        for (std::size_t l = 0; l < shorter.size(); l++) {
+            if (shorter[l] != longer[offset + l] && shorter[l] != 1 && longer[offset + l] != 1) {
+                mismatch(left, op, right);
+            }
+
+            result[offset + l] = std::max(shorter[l], longer[offset + l]);
+        }
+
+        return result;
+    }
+
+    // the extent of every index name, checked for agreement across operands
+    void index_extents(ContractionNode* n, std::unordered_map<std::string, int>& extents) {
+        for (IndexedNode* operand : n->get_operands()) {
+            if (symbol_table.kind_of(operand->get_name()) == VarKind::NONE) {
+                IllegalIdentifierError((int) statement_index);
+            }
+
+            std::vector<int> shape = symbol_table.shape_of(operand->get_name());
+            std::vector<std::string> const& indices = operand->get_indices();
+
+            if (shape.size() != indices.size()) {
+                ShapeError(statement_index, operand->get_name() + shape_to_string(shape) + " has " + std::to_string(indices.size()) + " indices");
+            }
+
+            for (std::size_t l = 0; l < indices.size(); l++) {
+                if (extents.find(indices[l]) != extents.end() && extents.at(indices[l]) != shape[l]) {
+                    ShapeError(statement_index, "index " + indices[l] + " is " + std::to_string(extents.at(indices[l])) + " and " + std::to_string(shape[l]));
+                }
+
+                extents[indices[l]] = shape[l];
+            }
+        }
+    }
+
+    std::vector<int> infer_helper(ExpressionNode* n) {
+        if (ContractionNode* contraction = dynamic_cast<ContractionNode*>(n)) {
+            std::unordered_map<std::string, int> extents;
+            std::vector<int> result;
+            index_extents(contraction, extents);
+
+            std::vector<std::string> const& output = contraction->get_output();
+
+            for (std::size_t l = 0; l < output.size(); l++) {
+                if (extents.find(output[l]) == extents.end() || std::find(output.begin(), output.begin() + l, output[l]) != output.begin() + l) {
+                    ShapeError(statement_index, "output index " + output[l] + " must appear once in the output and in an operand");
+                }
+
+                result.push_back(extents.at(output[l]));
+            }
+
+            contraction_extents[contraction] = extents;
+            return result;
+        } else if (dynamic_cast<ScalarNode*>(n) != nullptr) {
+            return {};
+        } else if (TensorNode* tensor = dynamic_cast<TensorNode*>(n)) {
+            return tensor->get_storage().get_dims();
+        } else if (IndentifierNode* identifier = dynamic_cast<IndentifierNode*>(n)) {
+            if (symbol_table.kind_of(identifier->get_name()) == VarKind::NONE) {
+                IllegalIdentifierError((int) statement_index);
+            }
+
+            return symbol_table.shape_of(identifier->get_name());
+        }
+
+        std::string op = n->get_value().get_token();
+
+        if (n->get_left() == nullptr && n->get_right() != nullptr) {
+            std::vector<int> operand = infer(n->get_right());
+
+            if (op == "-") {
+                return operand;
+            } else if (op == "'") {
+                return std::vector<int>(operand.rbegin(), operand.rend());
+            }
+        } else if (n->get_left() != nullptr && n->get_right() != nullptr) {
+            std::vector<int> left = infer(n->get_left());
+            std::vector<int> right = infer(n->get_right());
+
+            if (op == "+" || op == "-" || op == "*" || op == "/") {
+                return broadcast(left, op, right);
+            } else if (op == "@") {
+                if (left.empty() || right.empty() || left.back() != right.front()) {
+                    mismatch(left, op, right);
+                }
+
+                std::vector<int> result(left.begin(), left.end() - 1);
+                result.insert(result.end(), right.begin() + 1, right.end());
+                return result;
+            }
+        }
+
+        LogicalError((int) statement_index);
+        return {};
+    }
+
+    void statement(VarDecNode* n) {
+        std::vector<int> shape = infer(n->get_rhs());
+
+        if (n->get_type() != "tensor" || n->get_has_shape()) {
+            std::vector<int> declared = n->get_dims();
+
+            if (broadcast(declared, "=", shape) != declared) {
+                mismatch(declared, "=", shape);
+            }
+
+            shape = declared;
+        }
+
+        std::vector<std::string> const& formats = n->get_formats();
+
+        if (!formats.empty()) {
+            TensorNode* literal = dynamic_cast<TensorNode*>(n->get_rhs());
+
+            if (literal == nullptr || dynamic_cast<ScalarNode*>(literal) != nullptr || literal->get_storage().get_dims() != shape) {
+                ShapeError(statement_index, "only a tensor literal of the variable's shape has a storage format");
+            }
+
+            bool valid = formats.size() == shape.size();
+
+            // a singleton level hangs off the positions of a compressed or singleton one
+            for (std::size_t l = 0; l < formats.size(); l++) {
+                if (formats[l] == "singleton" && (l == 0 || formats[l - 1] == "dense")) { valid = false; }
+            }
+
+            if (!valid) {
+                std::string text = "";
+                for (std::string const& format : formats) { text += (text == "" ? "" : ", ") + format; }
+                ShapeError(statement_index, "{" + text + "} is no format for " + shape_to_string(shape));
+            }
+        }
+
+        symbol_table.define(n->get_name(), n->get_type(), n->get_kind());
+        symbol_table.set_shape(n->get_name(), shape);
+        variable_shapes[n] = shape;
+        statement_index++;
+    }
+
+    void infer_statements(ASTNode& n) {
+        if (VarDecNode* var_dec = dynamic_cast<VarDecNode*>(&n)) {
+            statement(var_dec);
+            return;
+        }
+
+        for (ASTNode* child : n.get_children()) {
+            infer_statements(*child);
+        }
+    }
+public:
+    void infer(ProgramNode* ast) {
+        infer_statements(*ast);
+    }
+
+    // shared subtrees are inferred once
+    std::vector<int> const& infer(ExpressionNode* n) {
+        if (shapes.find(n) == shapes.end()) {
+            shapes[n] = infer_helper(n);
+        }
+
+        return shapes.at(n);
+    }
+
+    std::vector<int> const& shape_of(ExpressionNode* n) {
+        return shapes.at(n);
+    }
+
+    std::vector<int> const& shape_of(VarDecNode* n) {
+        return variable_shapes.at(n);
+    }
+
+    std::unordered_map<std::string, int> const& extents_of(ContractionNode* n) {
+        return contraction_extents.at(n);
+    }
+};
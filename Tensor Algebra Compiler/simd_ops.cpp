@@ -0,0 +1,173 @@
+//
+//  simd_ops.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <cstdint>
+#include <initializer_list>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+/*
+ The operations the SIMD math templates (U2Math in mat2c.cpp, InterpolationMath in
+ interpolation_kernels.cpp, AngleMath in angle_kernels.cpp, MeshMath in mesh.cpp,
+ SolverMath in angle_solver.cpp and GemmMath in complex_gemm.cpp) are written against,
+ once for AVX2 and once for AVX-512. V is a vector of doubles, Q one of 64-bit integers,
+ and M a lane mask: a vector of all-ones or all-zeros lanes on AVX2 and a __mmask8 on
+ AVX-512.
+
+ The templates carry no target of their own. Each ISA gets one entry point built with
+ __attribute__((target(...), flatten)), such as u2_avx2 and u2_avx512, so all of the
+ template is inlined into code for that ISA. Vectors cross the templates' functions by
+ reference only, since passing them by value without the ISA would change the ABI. The
+ calls into the Ops still return vectors, which GCC notes with -Wpsabi although they are
+ inlined; the note is turned off below for every file that follows.
+ */
+#define APOLLO_AVX2 __attribute__((target("avx2,fma"))) static inline
+
+struct Avx2Ops {
+    typedef __m256d V;
+    typedef __m256i Q;
+    typedef __m256d M;
+    static constexpr std::size_t width = 4;
+
+    APOLLO_AVX2 V set(double x) { return _mm256_set1_pd(x); }
+    APOLLO_AVX2 V load(const double* p) { return _mm256_loadu_pd(p); }
+    APOLLO_AVX2 void store(double* p, V v) { _mm256_storeu_pd(p, v); }
+    APOLLO_AVX2 V add(V a, V b) { return _mm256_add_pd(a, b); }
+    APOLLO_AVX2 V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+    APOLLO_AVX2 V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+    APOLLO_AVX2 V div(V a, V b) { return _mm256_div_pd(a, b); }
+    APOLLO_AVX2 V min(V a, V b) { return _mm256_min_pd(a, b); }
+    APOLLO_AVX2 V max(V a, V b) { return _mm256_max_pd(a, b); }
+    APOLLO_AVX2 V neg(V a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+    APOLLO_AVX2 V abs(V a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+    APOLLO_AVX2 V fma(V a, V b, V c) { return _mm256_fmadd_pd(a, b, c); }
+    APOLLO_AVX2 V fnma(V a, V b, V c) { return _mm256_fnmadd_pd(a, b, c); }
+
+    // the magnitude of a with the sign of s
+    APOLLO_AVX2 V copysign(V a, V s) { return _mm256_or_pd(abs(a), _mm256_and_pd(s, _mm256_set1_pd(-0.0))); }
+
+    // to the nearest integer for |a| < 2^51: adding 2^52 + 2^51 rounds away the fraction
+    APOLLO_AVX2 V round(V a) { return _mm256_sub_pd(_mm256_add_pd(a, _mm256_set1_pd(6755399441055744.0)), _mm256_set1_pd(6755399441055744.0)); }
+    APOLLO_AVX2 V floor(V a) { return _mm256_floor_pd(a); }
+
+    // integer-valued doubles to 64-bit integers: adding 2^52 + 2^51 puts them in the low bits
+    APOLLO_AVX2 Q quadrant(V j) { return _mm256_castpd_si256(_mm256_add_pd(j, _mm256_set1_pd(6755399441055744.0))); }
+    APOLLO_AVX2 Q add_quadrant(Q q, int n) { return _mm256_add_epi64(q, _mm256_set1_epi64x(n)); }
+    APOLLO_AVX2 M bit(Q q, int b) { return _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(q, _mm256_set1_epi64x(b)), _mm256_set1_epi64x(b))); }
+
+    // non-negative integer-valued doubles below 2^52 to 64-bit integers, which then index
+    // p as doubles
+    APOLLO_AVX2 Q index(V a) { return _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(a, _mm256_set1_pd(4503599627370496.0))), _mm256_castpd_si256(_mm256_set1_pd(4503599627370496.0))); }
+    APOLLO_AVX2 Q add_index(Q q, std::int64_t n) { return _mm256_add_epi64(q, _mm256_set1_epi64x(n)); }
+    APOLLO_AVX2 V gather(const double* p, Q q) { return _mm256_i64gather_pd(p, q, 8); }
+
+    APOLLO_AVX2 M less(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    APOLLO_AVX2 M equal(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+    APOLLO_AVX2 M unordered(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_UNORD_Q); }
+    APOLLO_AVX2 M both(M a, M b) { return _mm256_and_pd(a, b); }
+    APOLLO_AVX2 V blend(V a, V b, M mask) { return _mm256_blendv_pd(a, b, mask); }
+    APOLLO_AVX2 V negate_if(V a, M mask) { return _mm256_xor_pd(a, _mm256_and_pd(mask, _mm256_set1_pd(-0.0))); }
+
+    APOLLO_AVX2 V pow2(V n) {
+        __m256i bits = _mm256_castpd_si256(_mm256_add_pd(n, _mm256_set1_pd(6755399441055744.0 + 1023)));
+        return _mm256_castsi256_pd(_mm256_slli_epi64(bits, 52));
+    }
+
+    // x = mantissa(x) 2^exponent(x) with the mantissa in [1, 2), for positive normal x:
+    // the exponent field is made a double by placing it under the bits of 2^52
+    APOLLO_AVX2 V exponent(V x) {
+        __m256i field = _mm256_srli_epi64(_mm256_castpd_si256(x), 52);
+        V biased = _mm256_castsi256_pd(_mm256_or_si256(field, _mm256_castpd_si256(_mm256_set1_pd(4503599627370496.0))));
+        return _mm256_sub_pd(biased, _mm256_set1_pd(4503599627370496.0 + 1023));
+    }
+
+    APOLLO_AVX2 V mantissa(V x) {
+        __m256i fraction = _mm256_and_si256(_mm256_castpd_si256(x), _mm256_set1_epi64x(0x000fffffffffffff));
+        return _mm256_castsi256_pd(_mm256_or_si256(fraction, _mm256_castpd_si256(_mm256_set1_pd(1.0))));
+    }
+};
+
+#undef APOLLO_AVX2
+#define APOLLO_AVX512 __attribute__((target("avx512f"))) static inline
+
+struct Avx512Ops {
+    typedef __m512d V;
+    typedef __m512i Q;
+    typedef __mmask8 M;
+    static constexpr std::size_t width = 8;
+
+    APOLLO_AVX512 V set(double x) { return _mm512_set1_pd(x); }
+    APOLLO_AVX512 V load(const double* p) { return _mm512_loadu_pd(p); }
+    APOLLO_AVX512 void store(double* p, V v) { _mm512_storeu_pd(p, v); }
+    APOLLO_AVX512 V add(V a, V b) { return _mm512_add_pd(a, b); }
+    APOLLO_AVX512 V sub(V a, V b) { return _mm512_sub_pd(a, b); }
+    APOLLO_AVX512 V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+    APOLLO_AVX512 V div(V a, V b) { return _mm512_div_pd(a, b); }
+
+    // min, max, floor, gather, pow2, exponent and mantissa are masked with every lane set,
+    // since the plain forms trip a false -Wmaybe-uninitialized in GCC 12
+    APOLLO_AVX512 V min(V a, V b) { return _mm512_mask_min_pd(a, 0xff, a, b); }
+    APOLLO_AVX512 V max(V a, V b) { return _mm512_mask_max_pd(a, 0xff, a, b); }
+
+    APOLLO_AVX512 V neg(V a) { return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(a), _mm512_set1_epi64(INT64_MIN))); }
+    APOLLO_AVX512 V abs(V a) { return _mm512_castsi512_pd(_mm512_and_si512(_mm512_castpd_si512(a), _mm512_set1_epi64(INT64_MAX))); }
+    APOLLO_AVX512 V fma(V a, V b, V c) { return _mm512_fmadd_pd(a, b, c); }
+    APOLLO_AVX512 V fnma(V a, V b, V c) { return _mm512_fnmadd_pd(a, b, c); }
+
+    APOLLO_AVX512 V copysign(V a, V s) {
+        __m512i magnitude = _mm512_and_si512(_mm512_castpd_si512(a), _mm512_set1_epi64(INT64_MAX));
+        __m512i sign = _mm512_and_si512(_mm512_castpd_si512(s), _mm512_set1_epi64(INT64_MIN));
+        return _mm512_castsi512_pd(_mm512_or_si512(magnitude, sign));
+    }
+
+    APOLLO_AVX512 V round(V a) { return _mm512_sub_pd(_mm512_add_pd(a, _mm512_set1_pd(6755399441055744.0)), _mm512_set1_pd(6755399441055744.0)); }
+    APOLLO_AVX512 V floor(V a) { return _mm512_mask_roundscale_pd(a, 0xff, a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+
+    APOLLO_AVX512 Q quadrant(V j) { return _mm512_castpd_si512(_mm512_add_pd(j, _mm512_set1_pd(6755399441055744.0))); }
+    APOLLO_AVX512 Q add_quadrant(Q q, int n) { return _mm512_add_epi64(q, _mm512_set1_epi64(n)); }
+    APOLLO_AVX512 M bit(Q q, int b) { return _mm512_test_epi64_mask(q, _mm512_set1_epi64(b)); }
+
+    APOLLO_AVX512 Q index(V a) { return _mm512_sub_epi64(_mm512_castpd_si512(_mm512_add_pd(a, _mm512_set1_pd(4503599627370496.0))), _mm512_castpd_si512(_mm512_set1_pd(4503599627370496.0))); }
+    APOLLO_AVX512 Q add_index(Q q, std::int64_t n) { return _mm512_add_epi64(q, _mm512_set1_epi64(n)); }
+    APOLLO_AVX512 V gather(const double* p, Q q) { return _mm512_mask_i64gather_pd(_mm512_setzero_pd(), 0xff, q, p, 8); }
+
+    APOLLO_AVX512 M less(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+    APOLLO_AVX512 M equal(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+    APOLLO_AVX512 M unordered(V a, V b) { return _mm512_cmp_pd_mask(a, b, _CMP_UNORD_Q); }
+    APOLLO_AVX512 M both(M a, M b) { return (M) (a & b); }
+    APOLLO_AVX512 V blend(V a, V b, M mask) { return _mm512_mask_blend_pd(mask, a, b); }
+
+    APOLLO_AVX512 V negate_if(V a, M mask) {
+        __m512i bits = _mm512_castpd_si512(a);
+        return _mm512_castsi512_pd(_mm512_mask_xor_epi64(bits, mask, bits, _mm512_set1_epi64(INT64_MIN)));
+    }
+
+    APOLLO_AVX512 V pow2(V n) {
+        __m512i bits = _mm512_castpd_si512(_mm512_add_pd(n, _mm512_set1_pd(6755399441055744.0 + 1023)));
+        return _mm512_castsi512_pd(_mm512_mask_slli_epi64(bits, 0xff, bits, 52));
+    }
+
+    APOLLO_AVX512 V exponent(V x) { return _mm512_mask_getexp_pd(x, 0xff, x); }
+    APOLLO_AVX512 V mantissa(V x) { return _mm512_mask_getmant_pd(x, 0xff, x, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_src); }
+};
+
+#undef APOLLO_AVX512
+
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+// c0 + c1 z + c2 z^2 + ... for coefficients c0, c1, c2, ..., by Horner's rule
+template <typename Ops>
+inline void polynomial(typename Ops::V const& z, std::initializer_list<double> coefficients, typename Ops::V& result) {
+    result = Ops::set(*(coefficients.end() - 1));
+
+    for (auto c = coefficients.end() - 1; c != coefficients.begin(); ) {
+        --c;
+        result = Ops::fma(result, z, Ops::set(*c));
+    }
+}
+#endif
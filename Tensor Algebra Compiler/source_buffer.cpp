@@ -0,0 +1,153 @@
+//
+//  source_buffer.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Read-only window over the source. Lexemes point into [data(), data() + size()), which
+// stays valid until the next refill(); base() is the source offset of data()[0].
+class SourceBuffer {
+public:
+    virtual ~SourceBuffer() = default;
+
+    virtual const char* data() = 0;
+
+    virtual std::size_t size() = 0;
+
+    virtual std::size_t base() = 0;
+
+    // Drop everything before keep_from and extend the window; returns false at end of input
+    virtual bool refill(std::size_t keep_from) = 0;
+
+    // Everything before upto has been consumed and may be released
+    virtual void consume(std::size_t upto) {}
+
+    static std::unique_ptr<SourceBuffer> open(std::string const& ifname);
+};
+
+class MappedSource : public SourceBuffer {
+private:
+    static constexpr std::size_t release_granularity = 1 << 20;
+
+    const char* mapped;
+    std::size_t length;
+    std::size_t page;
+    std::size_t released;
+public:
+    MappedSource(const char* mapped, std::size_t length) {
+        this->mapped = mapped;
+        this->length = length;
+        page = (std::size_t) sysconf(_SC_PAGESIZE);
+        released = 0;
+        madvise((void*) mapped, length, MADV_SEQUENTIAL);
+    }
+
+    ~MappedSource() override {
+        munmap((void*) mapped, length);
+    }
+
+    const char* data() override { return mapped; }
+
+    std::size_t size() override { return length; }
+
+    std::size_t base() override { return 0; }
+
+    bool refill(std::size_t keep_from) override { return false; }
+
+    void consume(std::size_t upto) override {
+        std::size_t boundary = upto / page * page;
+
+        // clean file-backed pages: dropping them only costs a re-read if we ever look back
+        if (boundary >= released + release_granularity) {
+            madvise((void*) (mapped + released), boundary - released, MADV_DONTNEED);
+            released = boundary;
+        }
+    }
+};
+
+class StreamSource : public SourceBuffer {
+private:
+    static constexpr std::size_t chunk_size = 1 << 16;
+
+    int fd;
+    bool owns_fd;
+    std::vector<char> buffer;
+    std::size_t filled;
+    std::size_t offset;
+public:
+    StreamSource(int fd, bool owns_fd) {
+        this->fd = fd;
+        this->owns_fd = owns_fd;
+        buffer = std::vector<char>(chunk_size);
+        filled = 0;
+        offset = 0;
+    }
+
+    ~StreamSource() override {
+        if (owns_fd) { close(fd); }
+    }
+
+    const char* data() override { return buffer.data(); }
+
+    std::size_t size() override { return filled; }
+
+    std::size_t base() override { return offset; }
+
+    bool refill(std::size_t keep_from) override {
+        std::size_t kept = filled - keep_from;
+        std::memmove(buffer.data(), buffer.data() + keep_from, kept);
+        offset += keep_from;
+        filled = kept;
+
+        // only a single token longer than the buffer makes it grow
+        if (filled == buffer.size()) { buffer.resize(buffer.size() * 2); }
+
+        while (true) {
+            ssize_t n = read(fd, buffer.data() + filled, buffer.size() - filled);
+
+            if (n > 0) {
+                filled += n;
+                return true;
+            } else if (n == 0 || errno != EINTR) {
+                return false;
+            }
+        }
+    }
+};
+
+std::unique_ptr<SourceBuffer> SourceBuffer::open(std::string const& ifname) {
+    if (ifname == "-") {
+        return std::make_unique<StreamSource>(STDIN_FILENO, false);
+    }
+
+    int fd = ::open(ifname.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        Error(-1, "Cannot open " + ifname);
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (mapped != MAP_FAILED) {
+            close(fd);
+            return std::make_unique<MappedSource>((const char*) mapped, st.st_size);
+        }
+    }
+
+    // pipes, FIFOs, character devices, empty files and anything mmap refuses
+    return std::make_unique<StreamSource>(fd, true);
+}
@@ -0,0 +1,320 @@
+//
+//  sparse_tensor.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+
+/*
+ Compressed sparse fiber storage: every level is compressed. For level l, the children of
+ the i-th node of level l - 1 are crd[l][pos[l][i] .. pos[l][i + 1]), and values[k] belongs
+ to the k-th node of the last level. All of it lives in a handful of contiguous arrays.
+
+    {{0, 1.5}, {0, 0}, {2, 0}}    dims   = {3, 2}
+                                  pos[0] = {0, 2}       crd[0] = {0, 2}
+                                  pos[1] = {0, 1, 2}    crd[1] = {1, 0}
+                                  values = {1.5, 2}
+ */
+class SparseTensor {
+private:
+    std::vector<int> dims;
+    std::vector<std::vector<std::uint32_t>> pos;
+    std::vector<std::vector<std::uint32_t>> crd;
+    std::vector<double> values;
+
+    template <typename F>
+    void visit(int level, std::uint32_t node, std::vector<int>& coords, F& f) const {
+        for (std::uint32_t p = pos[level][node]; p < pos[level][node + 1]; p++) {
+            coords[level] = crd[level][p];
+
+            if (level + 1 == order()) {
+                f(coords, values[p]);
+            } else {
+                visit(level + 1, p, coords, f);
+            }
+        }
+    }
+public:
+    SparseTensor() {}
+
+    // coords holds nnz * dims.size() coordinates in row-major (lexicographic) order
+    SparseTensor(std::vector<int> dims, std::vector<std::uint32_t> const& coords, std::vector<double> values) {
+        this->dims = dims;
+        this->values = values;
+
+        int n = order();
+        std::size_t nnz = this->values.size();
+        pos = std::vector<std::vector<std::uint32_t>>(n);
+        crd = std::vector<std::vector<std::uint32_t>>(n);
+
+        if (n == 0) { return; }
+
+        pos[0].push_back(0);
+
+        for (std::size_t e = 0; e < nnz; e++) {
+            const std::uint32_t* c = &coords[e * n];
+            int first = 0;
+
+            if (e > 0) {
+                const std::uint32_t* prev = &coords[(e - 1) * n];
+                while (first < n - 1 && c[first] == prev[first]) { first++; }
+            }
+
+            for (int l = first; l < n; l++) {
+                crd[l].push_back(c[l]);
+
+                if (l + 1 < n) { pos[l + 1].push_back((std::uint32_t) crd[l + 1].size()); }
+            }
+        }
+
+        for (int l = 0; l < n; l++) {
+            pos[l].push_back((std::uint32_t) crd[l].size());
+        }
+    }
+
+    int order() const {
+        return (int) dims.size();
+    }
+
+    std::vector<int> const& get_dims() const {
+        return dims;
+    }
+
+    std::size_t nnz() const {
+        return values.size();
+    }
+
+    std::size_t volume() const {
+        std::size_t v = 1;
+        for (int d : dims) { v *= d; }
+        return v;
+    }
+
+    std::vector<std::uint32_t> const& get_pos(int level) const {
+        return pos[level];
+    }
+
+    std::vector<std::uint32_t> const& get_crd(int level) const {
+        return crd[level];
+    }
+
+    std::vector<double> const& get_values() const {
+        return values;
+    }
+
+    std::size_t bytes() const {
+        std::size_t n = values.size() * sizeof(double);
+
+        for (int l = 0; l < order(); l++) {
+            n += (pos[l].size() + crd[l].size()) * sizeof(std::uint32_t);
+        }
+
+        return n;
+    }
+
+    std::size_t linear_index(std::vector<int> const& coords) const {
+        std::size_t index = 0;
+        for (int l = 0; l < order(); l++) { index = index * dims[l] + coords[l]; }
+        return index;
+    }
+
+    // f(coords, value) for every stored entry, in row-major order
+    template <typename F>
+    void for_each_nonzero(F f) const {
+        if (order() == 0) { return; }
+
+        std::vector<int> coords(order());
+        visit(0, 0, coords, f);
+    }
+};
+
+// Collects a nested literal one entry at a time and checks that it is rectangular
+class SparseTensorBuilder {
+private:
+    std::vector<int> dims;
+    std::vector<std::uint32_t> prefix;
+    std::vector<std::uint32_t> coords;
+    std::vector<double> values;
+    int leaf_depth = -1;
+public:
+    // '{'
+    void enter() {
+        prefix.push_back(0);
+    }
+
+    // '}': false if this list's length disagrees with an earlier list at the same depth
+    bool leave() {
+        std::size_t depth = prefix.size() - 1;
+        int count = (int) prefix.back();
+        prefix.pop_back();
+
+        if (dims.size() <= depth) { dims.resize(depth + 1, -1); }
+
+        if (dims[depth] == -1) {
+            dims[depth] = count;
+        } else if (dims[depth] != count) {
+            return false;
+        }
+
+        if (!prefix.empty()) { prefix.back()++; }
+
+        return true;
+    }
+
+    // a scalar entry: false if entries appear at different depths
+    bool add(double value) {
+        int depth = (int) prefix.size();
+
+        if (leaf_depth == -1) {
+            leaf_depth = depth;
+        } else if (leaf_depth != depth) {
+            return false;
+        }
+
+        if (value != 0) {
+            coords.insert(coords.end(), prefix.begin(), prefix.end());
+            values.push_back(value);
+        }
+
+        prefix.back()++;
+
+        return true;
+    }
+
+    // every entry sits at the innermost depth
+    bool is_complete() {
+        return leaf_depth == -1 || leaf_depth == (int) dims.size();
+    }
+
+    SparseTensor build() {
+        return SparseTensor(dims, coords, values);
+    }
+};
+
+enum class LevelFormat {
+    DENSE,
+    COMPRESSED,
+    SINGLETON
+};
+
+/*
+ A SparseTensor laid out with a storage format per level. Positions at level l number the
+ nodes of that level; a node's children are found from its position:
+
+    dense       all of 0 .. dims[l]; the child with coordinate i is at p * dims[l] + i
+    compressed  crd[l][pos[l][p] .. pos[l][p + 1])
+    singleton   one coordinate crd[l][p] at the parent's own position
+
+ A compressed level above a singleton keeps one position per distinct entry below it, so
+ its coordinates repeat: {compressed, singleton} is a coordinate list. Dense levels store
+ no arrays, but their zeros take places in values.
+
+    {{0, 1.5}, {0, 0}, {2, 0}}    {dense, compressed}     pos[1] = {0, 1, 1, 2}  crd[1] = {1, 0}
+                                  {compressed, singleton}  pos[0] = {0, 2}  crd[0] = {0, 2}  crd[1] = {1, 0}
+ */
+class PackedTensor {
+private:
+    std::vector<int> dims;
+    std::vector<LevelFormat> formats;
+    std::vector<std::vector<std::uint32_t>> pos;
+    std::vector<std::vector<std::uint32_t>> crd;
+    std::vector<double> values;
+
+    // the entries [first, last) of coords / entry_values share their first l coordinates
+    void pack(int l, std::size_t first, std::size_t last, std::vector<std::uint32_t> const& coords, std::vector<double> const& entry_values) {
+        int n = order();
+
+        if (l == n) {
+            values.push_back(first < last ? entry_values[first] : 0.0);
+            return;
+        }
+
+        if (formats[l] == LevelFormat::DENSE) {
+            std::size_t e = first;
+
+            for (int i = 0; i < dims[l]; i++) {
+                std::size_t end = e;
+                while (end < last && coords[end * n + l] == (std::uint32_t) i) { end++; }
+
+                pack(l + 1, e, end, coords, entry_values);
+                e = end;
+            }
+
+            return;
+        }
+
+        // the singletons under this level share its positions
+        int m = l;
+        while (m + 1 < n && formats[m + 1] == LevelFormat::SINGLETON) { m++; }
+
+        for (std::size_t e = first; e < last;) {
+            const std::uint32_t* group = coords.data() + e * n;
+            std::size_t end = e + 1;
+            while (end < last && std::equal(group + l, group + m + 1, coords.data() + end * n + l)) { end++; }
+
+            for (int k = l; k <= m; k++) { crd[k].push_back(group[k]); }
+
+            pack(m + 1, e, end, coords, entry_values);
+            e = end;
+        }
+
+        pos[l].push_back((std::uint32_t) crd[l].size());
+    }
+public:
+    // formats has one entry per dimension, and the first is not a singleton
+    PackedTensor(SparseTensor const& storage, std::vector<LevelFormat> formats) {
+        this->dims = storage.get_dims();
+        this->formats = formats;
+
+        int n = order();
+        pos = std::vector<std::vector<std::uint32_t>>(n);
+        crd = std::vector<std::vector<std::uint32_t>>(n);
+
+        for (int l = 0; l < n; l++) {
+            if (formats[l] == LevelFormat::COMPRESSED) { pos[l].push_back(0); }
+        }
+
+        std::vector<std::uint32_t> coords;
+        std::vector<double> entry_values;
+
+        storage.for_each_nonzero([&](std::vector<int> const& c, double value) {
+            coords.insert(coords.end(), c.begin(), c.end());
+            entry_values.push_back(value);
+        });
+
+        pack(0, 0, entry_values.size(), coords, entry_values);
+    }
+
+    int order() const {
+        return (int) dims.size();
+    }
+
+    std::vector<int> const& get_dims() const {
+        return dims;
+    }
+
+    LevelFormat format(int level) const {
+        return formats[level];
+    }
+
+    // several positions of a level may hold the same coordinate when a singleton follows
+    bool is_unique(int level) const {
+        return level + 1 == order() || formats[level + 1] != LevelFormat::SINGLETON;
+    }
+
+    std::vector<std::uint32_t> const& get_pos(int level) const {
+        return pos[level];
+    }
+
+    std::vector<std::uint32_t> const& get_crd(int level) const {
+        return crd[level];
+    }
+
+    std::vector<double> const& get_values() const {
+        return values;
+    }
+};
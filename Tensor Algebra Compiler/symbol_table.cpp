@@ -24,8 +24,8 @@ public:
         return running_index;
     }
     
-    void define(std::string name, std::string type, VarKind kind) {
-        table.insert({name, VarInfo(type, kind, running_index)});
+    void define(std::string name, std::string type, VarKind kind, std::vector<int> shape={}) {
+        table.insert({name, VarInfo(type, kind, running_index, shape)});
         running_index++;
     }
     
@@ -64,4 +64,32 @@ public:
         
         return -1;
     }
+    
+    std::vector<int> shape_of(std::string name) {
+        if (table.find(name) != table.end()) {
+            return table.at(name).get_shape();
+        }
+        
+        return {};
+    }
+    
+    void set_shape(std::string name, std::vector<int> shape) {
+        if (table.find(name) != table.end()) {
+            table.at(name).set_shape(shape);
+        }
+    }
+    
+    void set_constant(std::string name, TensorNode* value) {
+        if (table.find(name) != table.end()) {
+            table.at(name).set_constant(value);
+        }
+    }
+    
+    TensorNode* constant_of(std::string name) {
+        if (table.find(name) != table.end()) {
+            return table.at(name).get_constant();
+        }
+        
+        return nullptr;
+    }
 };
@@ -6,26 +6,147 @@
 #include <stdio.h>
 #include <fstream>
 #include <iostream>
-#include <unordered_map>
+#include <algorithm>
 #include <complex>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <memory>
 #include <vector>
 #include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "complex_kernels.cpp"
+#include "simd_ops.cpp"
+#include "interpolation_kernels.cpp"
+#include "angle_kernels.cpp"
+#include "thread_pool.cpp"
+#include "clock_cache.cpp"
 
 using namespace std::complex_literals;
 
-struct vd_hash {
-    size_t operator()(const std::vector<double>& v) const {
-        size_t seed = v.size();
-        for(auto &d : v) { seed ^= (size_t) d + 0x9e3779b9 + (seed << 6) + (seed >> 2); }
-        return seed;
+// The angles of one u2, stored inline in the table rather than in a vector of their own
+struct U2Angles {
+    std::complex<double> theta;
+    std::complex<double> alpha;
+    std::complex<double> beta;
+
+    std::vector<std::complex<double>> to_vector() const {
+        return {theta, alpha, beta};
     }
 };
 
+static_assert(sizeof(U2Angles) == 6 * sizeof(double), "the interpolation kernels read a cell as six doubles");
+
+// The derivatives of a batch of angles that can be nonzero: theta and alpha depend on u11
+// and u12 only, beta on u21 and u22 only
+struct AngleJacobian {
+    ComplexVector theta_u11;
+    ComplexVector theta_u12;
+    ComplexVector alpha_u11;
+    ComplexVector alpha_u12;
+    ComplexVector beta_u21;
+    ComplexVector beta_u22;
+
+    AngleJacobian(std::size_t n) : theta_u11(n), theta_u12(n), alpha_u11(n), alpha_u12(n), beta_u21(n), beta_u22(n) {}
+};
+
+/*
+ Table file (.apt). Native byte order, every array 8-byte aligned, so a float64 file is
+ used in place after one mmap:
+
+    header     "APTB" version:u16 dtype:u16 byte_order:u32 count:u32
+               lower:f64 upper:f64 step:f64 present_offset:u64 cells_offset:u64
+    PRESENT    u64[(count^4 + 63) / 64]    bit i % 64 of word i / 64: cell i has angles
+    CELLS      dtype[6 count^4]            theta, alpha, beta of each cell, real then imaginary
+
+ upper is lower + (count - 1) step, for readers of the header. A float32 file is half the
+ size and is widened into memory when it is loaded.
+ */
+struct TableHeader {
+    char magic[4];
+    std::uint16_t version;
+    std::uint16_t dtype;
+    std::uint32_t byte_order;
+    std::uint32_t count;
+    double lower;
+    double upper;
+    double step;
+    std::uint64_t present_offset;
+    std::uint64_t cells_offset;
+};
+
+enum class TableDtype : std::uint16_t {
+    FLOAT64 = 1,
+    FLOAT32 = 2
+};
+
+constexpr std::uint16_t table_version = 1;
+constexpr std::uint32_t table_byte_order = 0x01020304;
+
+/*
+ Warm-start file of a lazy table (see Table::init_lazy), in native byte order:
+
+    header     "APTC" version:u16 reserved:u16 byte_order:u32 count:u32
+               lower:f64 step:f64 entries:u64
+    ENTRIES    { cell:u64 theta, alpha, beta:f64[6] }[entries]
+
+ It only seeds a table over the same grid.
+ */
+struct CacheHeader {
+    char magic[4];
+    std::uint16_t version;
+    std::uint16_t reserved;
+    std::uint32_t byte_order;
+    std::uint32_t count;
+    double lower;
+    double step;
+    std::uint64_t entries;
+};
+
+/*
+ The u22angle table maps u2 = (u11, u21, u12, u22) to (theta, alpha, beta). Its keys are a
+ regular grid, count points per coordinate from lower at intervals of step, so the angles
+ are kept in one dense array indexed by the quantized coordinates:
+
+    cell(u2) = ((q(u11) count + q(u21)) count + q(u12)) count + q(u22),
+    q(u) = round((u - lower) / step)
+
+ A lookup is arithmetic and one load, with no hashing or allocation, and finds the grid
+ point nearest u2 rather than needing its exact doubles. A cell takes 48 bytes plus a
+ bit saying whether it holds angles, against about 200 for a node of the
+ unordered_map<vector<double>, vector<complex<double>>> this replaces, whose key and
+ value were two more heap blocks. The cells are either owned or lie in a mapped table file.
+ */
 class Table {
 private:
-    std::unordered_map<std::vector<double>, std::vector<std::complex<double>>, vd_hash> m;
-    
+    // 256^4 cells are already 200 GB
+    static constexpr std::size_t max_count = 256;
+
+    // a lazy table's cell numbers stay below 2^64
+    static constexpr std::size_t max_lazy_count = 65535;
+
+    double lower = 0;
+    double step = 1;
+    std::size_t count = 0;
+    std::size_t cell_count = 0;
+    std::vector<U2Angles> owned_cells;
+    std::vector<std::uint64_t> owned_present;
+    const U2Angles* cells = nullptr;
+    const std::uint64_t* present = nullptr;
+    void* mapping = nullptr;
+    std::size_t mapping_size = 0;
+
+    // every cell holds angles
+    bool complete = false;
+
+    // the angles computed so far, when the table is lazy
+    std::unique_ptr<ClockCache<U2Angles>> cache;
+
     static std::complex<double> theta2(std::vector<double>& u2) {
         auto c = 1i * u2[2];
         return 1i * log(-(u2[0] - c) / (u2[0] + c));
@@ -34,34 +155,340 @@ private:
     static std::complex<double> alpha2(std::vector<double>& u2) {
         return 1i * log(-u2[2] - u2[0] * 1i);
     }
-    
+
     static std::complex<double> beta2(std::vector<double>& u2) {
         return 1i * log(u2[3] + 1i * u2[1]);
     }
+
+    // the number of grid points from 0 up to 2 pi at step prec, or limit + 1 if more
+    static std::size_t points(double prec, std::size_t limit) {
+        std::size_t n = 0;
+        while (prec > 0 && n * prec < 2 * M_PI && n <= limit) { n++; }
+        return n;
+    }
+
+    // the grid's geometry, with no cells yet
+    void reshape(double lower, double step, std::size_t count, std::size_t limit=max_count) {
+        if (!(step > 0) || count == 0 || count > limit) {
+            TableError("a grid of " + std::to_string(count) + " points at step " + std::to_string(step));
+        }
+
+        release();
+        this->lower = lower;
+        this->step = step;
+        this->count = count;
+        cell_count = count * count * count * count;
+        complete = false;
+    }
+
+    void resize(double lower, double step, std::size_t count) {
+        reshape(lower, step, count);
+        owned_cells.assign(cell_count, U2Angles());
+        owned_present.assign((cell_count + 63) / 64, 0);
+        cells = owned_cells.data();
+        present = owned_present.data();
+    }
+
+    void release() {
+        if (mapping != nullptr) { munmap(mapping, mapping_size); }
+        mapping = nullptr;
+        owned_cells.clear();
+        owned_present.clear();
+        cells = nullptr;
+        present = nullptr;
+        cache.reset();
+    }
+
+    // the methods that walk the cells cannot be used on a lazy table
+    void require_cells(std::string const& what) const {
+        if (cache) {
+            TableError(what + " needs every cell in memory, and this table is lazy");
+        }
+    }
+
+    bool has(std::size_t index) const {
+        return present[index / 64] >> (index % 64) & 1;
+    }
+
+    void set(std::size_t index, U2Angles const& angles) {
+        owned_cells[index] = angles;
+        owned_present[index / 64] |= std::uint64_t(1) << (index % 64);
+    }
+
+    // q(u), or count when u is more than half a step outside the grid
+    std::size_t quantize(double u) const {
+        double q = std::round((u - lower) / step);
+        return q >= 0 && q < (double) count ? (std::size_t) q : count;
+    }
+
+    double coordinate(std::size_t q) const {
+        return lower + q * step;
+    }
+
+    // the grid point of a cell
+    std::vector<double> point(std::size_t index) const {
+        return {coordinate(index / (count * count * count)), coordinate(index / (count * count) % count), coordinate(index / count % count), coordinate(index % count)};
+    }
+
+    // cell_count when u2 is off the grid
+    std::size_t cell(double const* u2) const {
+        std::size_t index = 0;
+
+        for (int d = 0; d < 4; d++) {
+            std::size_t q = quantize(u2[d]);
+            if (q == count) { return cell_count; }
+            index = index * count + q;
+        }
+
+        return index;
+    }
+
+    void write_cell(std::ostream& out, std::size_t index) const {
+        for (double u : point(index)) { out << u << ","; }
+        out << "\"" << cells[index].theta << "\",\"" << cells[index].alpha << "\",\"" << cells[index].beta << "\"\n";
+    }
+
+    // u within the grid, give or take rounding
+    bool inside(double u) const {
+        double x = (u - lower) / step;
+        return x >= -1e-9 && x <= count - 1 + 1e-9;
+    }
+
+    void check_interpolation(double const* u2) const {
+        require_cells("interpolate");
+
+        if (count < 2 || !inside(u2[0]) || !inside(u2[1]) || !inside(u2[2]) || !inside(u2[3])) {
+            TableError("cannot interpolate at u2 (" + std::to_string(u2[0]) + ", " + std::to_string(u2[1]) + ", " + std::to_string(u2[2]) + ", " + std::to_string(u2[3]) + ")");
+        }
+
+        if (complete) { return; }
+
+        double base[4];
+        for (int d = 0; d < 4; d++) { base[d] = coordinate((std::size_t) std::min(std::max(std::floor((u2[d] - lower) / step), 0.0), (double) (count - 2))); }
+
+        for (int b = 0; b < 16; b++) {
+            double corner[4];
+            for (int d = 0; d < 4; d++) { corner[d] = base[d] + (b >> (3 - d) & 1) * step; }
+            lookup(corner);
+        }
+    }
 public:
-    Table() {
-        this->m = std::unordered_map<std::vector<double>, std::vector<std::complex<double>>, vd_hash>();
-    }
-
-    void init_u22angle(double prec) {
-        for (double i = 0; i < 2 * M_PI; i += prec) {
-            for (double j = 0; j < 2 * M_PI; j += prec) {
-                for (double k = 0; k < 2 * M_PI; k += prec) {
-                    for (double l = 0; l < 2 * M_PI; l += prec) {
-                        std::vector<double> u2 = {i, j, k, l};
-                        std::vector<std::complex<double>> angles = {theta2(u2), alpha2(u2), beta2(u2)};
-                        m.insert({u2, angles});
+    Table() {}
+
+    Table(Table const&) = delete;
+
+    Table(Table&& other) {
+        *this = std::move(other);
+    }
+
+    Table& operator=(Table&& other) {
+        release();
+        lower = other.lower;
+        step = other.step;
+        count = other.count;
+        cell_count = other.cell_count;
+        owned_cells = std::move(other.owned_cells);
+        owned_present = std::move(other.owned_present);
+        cells = other.mapping != nullptr ? other.cells : owned_cells.data();
+        present = other.mapping != nullptr ? other.present : owned_present.data();
+        mapping = other.mapping;
+        mapping_size = other.mapping_size;
+        complete = other.complete;
+        cache = std::move(other.cache);
+        other.mapping = nullptr;
+        other.cells = nullptr;
+        other.present = nullptr;
+        other.cell_count = 0;
+        other.count = 0;
+
+        return *this;
+    }
+
+    ~Table() {
+        release();
+    }
+
+    // theta2, alpha2 and beta2 at u2 exactly, which is what the table samples
+    static U2Angles angles_of(std::vector<double> u2) {
+        return {theta2(u2), alpha2(u2), beta2(u2)};
+    }
+
+    /*
+     The grid from 0 up to 2 pi at step prec in every coordinate. theta and alpha depend on
+     (u11, u12) only and beta on (u21, u22) only, so the i log kernel evaluates two planes
+     of count^2 points, and the pool then fills the cells in slabs of one u11 each, every
+     slab writing its own part of the preallocated grid.
+     */
+    void init_u22angle(double prec, ThreadPool& pool=thread_pool()) {
+        std::size_t n = points(prec, max_count);
+        resize(0, prec, n);
+
+        // the i log arguments of theta, alpha and beta, each a plane of n^2 points:
+        // theta2 = i log(-(u11 - i u12) / (u11 + i u12)), alpha2 = i log(-u12 - i u11),
+        // beta2 = i log(u22 + i u21)
+        std::size_t plane = n * n;
+        std::vector<double> x(3 * plane), y(3 * plane), re(3 * plane), im(3 * plane);
+
+        for (std::size_t a = 0; a < n; a++) {
+            for (std::size_t b = 0; b < n; b++) {
+                double u = coordinate(a), v = coordinate(b), r2 = u * u + v * v;
+                std::size_t i = a * n + b;
+                x[i] = (v * v - u * u) / r2;
+                y[i] = 2 * u * v / r2;
+                x[plane + i] = -v;
+                y[plane + i] = -u;
+                x[2 * plane + i] = v;
+                y[2 * plane + i] = u;
+            }
+        }
+
+        static ILogKernel const kernel = i_log_kernel(complex_kernels().isa);
+
+        pool.parallel_for(3 * n, [&](std::size_t row) {
+            kernel(&x[row * n], &y[row * n], n, &re[row * n], &im[row * n]);
+        });
+
+        U2Angles* out = owned_cells.data();
+
+        pool.parallel_for(n, [&](std::size_t q0) {
+            U2Angles* slab = out + q0 * n * n * n;
+
+            for (std::size_t q1 = 0; q1 < n; q1++) {
+                for (std::size_t q2 = 0; q2 < n; q2++) {
+                    std::size_t ta = q0 * n + q2;
+                    std::complex<double> theta = {re[ta], im[ta]}, alpha = {re[plane + ta], im[plane + ta]};
+                    U2Angles* row = slab + (q1 * n + q2) * n;
+
+                    for (std::size_t q3 = 0; q3 < n; q3++) {
+                        std::size_t b = 2 * plane + q1 * n + q3;
+                        row[q3] = {theta, alpha, {re[b], im[b]}};
                     }
                 }
             }
+        });
+
+        std::fill(owned_present.begin(), owned_present.end(), ~std::uint64_t(0));
+        if (cell_count % 64 != 0) { owned_present.back() = (std::uint64_t(1) << (cell_count % 64)) - 1; }
+        complete = true;
+    }
+
+    // the grid holds count^4 cells, of which size() have angles
+    double get_lower() const { return lower; }
+    double get_step() const { return step; }
+    std::size_t get_count() const { return count; }
+
+    /*
+     A lazy table over the grid init_u22angle(prec) would fill, which can be far finer: no
+     cells are made up front. lookup_u2_angles computes a cell's angles the first time it
+     is asked for them and keeps them in a ClockCache of at most memory_cap bytes, evicting
+     the least recently used. It may be called from many threads at once. If warm_path
+     names a file that save_cache wrote for the same grid, the cache starts with its
+     entries. memory_cap must leave room for an entry in each of the cache's shards.
+     */
+    void init_lazy(double prec, std::size_t memory_cap, std::string const& warm_path="") {
+        reshape(0, prec, points(prec, max_lazy_count), max_lazy_count);
+        cache.reset(new ClockCache<U2Angles>(memory_cap));
+
+        if (!warm_path.empty() && std::ifstream(warm_path)) {
+            load_cache(warm_path);
+        }
+    }
+
+    bool is_lazy() const {
+        return cache != nullptr;
+    }
+
+    CacheStats cache_stats() const {
+        return cache ? cache->stats() : CacheStats();
+    }
+
+    // the cells a lazy table holds, as a warm-start file for init_lazy
+    void save_cache(std::string const& path) const {
+        if (!cache) {
+            TableError("only a lazy table has a cache to save");
+        }
+
+        std::vector<char> entries;
+        std::size_t record = sizeof(std::uint64_t) + sizeof(U2Angles);
+
+        cache->for_each([&](std::uint64_t index, U2Angles const& angles) {
+            entries.resize(entries.size() + record);
+            std::memcpy(&entries[entries.size() - record], &index, sizeof(index));
+            std::memcpy(&entries[entries.size() - record + sizeof(index)], &angles, sizeof(angles));
+        });
+
+        CacheHeader header = { {'A', 'P', 'T', 'C'}, table_version, 0, table_byte_order, (std::uint32_t) count, lower, step, entries.size() / record };
+
+        std::ofstream out(path, std::ios::binary);
+        out.write((const char*) &header, sizeof(header));
+        out.write(entries.data(), entries.size());
+
+        if (!out) {
+            TableError("cannot write " + path);
+        }
+    }
+
+    void load_cache(std::string const& path) {
+        std::ifstream in(path, std::ios::binary);
+        CacheHeader header;
+
+        if (!cache || !in.read((char*) &header, sizeof(header)) || std::memcmp(header.magic, "APTC", 4) != 0 ||
+            header.version != table_version || header.byte_order != table_byte_order) {
+            TableError(path + " is not a u22angle cache");
+        }
+
+        if (header.count != count || header.lower != lower || header.step != step) {
+            TableError(path + " caches a grid of " + std::to_string(header.count) + " points at step " + std::to_string(header.step) +
+                       ", not " + std::to_string(count) + " at step " + std::to_string(step));
+        }
+
+        for (std::uint64_t e = 0; e < header.entries; e++) {
+            std::uint64_t index;
+            U2Angles angles;
+
+            if (!in.read((char*) &index, sizeof(index)) || !in.read((char*) &angles, sizeof(angles)) || index >= cell_count) {
+                TableError(path + " is cut short or damaged");
+            }
+
+            cache->put(index, angles);
         }
     }
-    
-    std::unordered_map<std::vector<double>, std::vector<std::complex<double>>, vd_hash> get_u22angle() {
-        return m;
+
+    std::size_t size() const {
+        if (cache) { return cache->stats().entries; }
+
+        std::size_t n = 0;
+        for (std::size_t w = 0; w < (cell_count + 63) / 64; w++) { n += __builtin_popcountll(present[w]); }
+        return n;
+    }
+
+    std::size_t memory_bytes() const {
+        if (cache) { return cache->memory_bytes(); }
+
+        return cell_count * sizeof(U2Angles) + (cell_count + 63) / 64 * sizeof(std::uint64_t);
     }
-    
+
+    // whether cell index, in grid order, holds angles
+    bool has_angles(std::size_t index) const {
+        require_cells("has_angles");
+        return index < cell_count && has(index);
+    }
+
+    // every cell in grid order, whether or not it holds angles: get_count()^4 of them, or
+    // nullptr for a lazy table
+    const U2Angles* get_u22angle() const {
+        return cells;
+    }
+
+    AngleGrid grid() const {
+        return { reinterpret_cast<const double*>(cells), lower, step, count };
+    }
+
+    // The grid is inferred from the rows: it starts at the smallest coordinate, and its
+    // step is the smallest gap between two distinct coordinate values
     void read_u22angle(std::ifstream& fin) {
+        std::vector<std::vector<double>> keys;
+        std::vector<U2Angles> rows;
         char buffer[1024] = {};
         fin.getline(buffer, 1024);
         while (fin.getline(buffer, 1024)) {
@@ -72,41 +499,244 @@ public:
             std::complex<double> theta2; std::istringstream(theta2_tok) >> theta2;
             std::complex<double> alpha2; std::istringstream(alpha2_tok) >> alpha2;
             std::complex<double> beta2; std::istringstream(beta2_tok) >> beta2;
-            std::vector<std::complex<double>> angles = {theta2, alpha2, beta2};
-            m.insert({u2, angles});
+            keys.push_back(u2);
+            rows.push_back({theta2, alpha2, beta2});
+        }
+
+        if (keys.empty()) {
+            TableError("no rows to read");
         }
+
+        std::vector<double> values;
+        for (std::vector<double> const& u2 : keys) { values.insert(values.end(), u2.begin(), u2.end()); }
+        std::sort(values.begin(), values.end());
+
+        // values closer than this are the same grid point written with rounding
+        double epsilon = 1e-9 * std::max(1.0, std::abs(values.back()));
+        double gap = 0;
+
+        for (std::size_t i = 1; i < values.size(); i++) {
+            double d = values[i] - values[i - 1];
+            if (d > epsilon && (gap == 0 || d < gap)) { gap = d; }
+        }
+
+        resize(values.front(), gap == 0 ? 1 : gap, (std::size_t) std::round((values.back() - values.front()) / (gap == 0 ? 1 : gap)) + 1);
+
+        for (std::size_t r = 0; r < keys.size(); r++) {
+            set(cell(keys[r].data()), rows[r]);
+        }
+
+        complete = size() == cell_count;
     }
 
     void write_u22angle(std::ofstream& fout) {
-        std::cout << m.size() << std::endl;
+        require_cells("write_u22angle");
+        std::cout << size() << std::endl;
         fout << "u11,u21,u12,u22,theta(2),alpha(2),beta(2)\n";
-        for (auto pair : m) {
-            for (double d : pair.first) { fout << d << ","; }
-            for (size_t i = 0; i < pair.second.size(); i++) {
-                fout << "\"" << pair.second[i] << "\"";
-                if (i < pair.second.size() - 1) { fout << ","; }
-            }
-            fout << "\n";
+        for (std::size_t index = 0; index < cell_count; index++) {
+            if (has(index)) { write_cell(fout, index); }
         }
         fout.close();
     }
-    
+
     void print_u22angle() {
-        for (auto pair : m) {
-            for (double d : pair.first) { std::cout << d << ","; }
-            for (size_t i = 0; i < pair.second.size(); i++) {
-                std::cout << "\"" << pair.second[i] << "\"";
-                if (i < pair.second.size() - 1) { std::cout << ","; }
-            }
-            std::cout << "\n";
+        require_cells("print_u22angle");
+        for (std::size_t index = 0; index < cell_count; index++) {
+            if (has(index)) { write_cell(std::cout, index); }
         }
     }
-    
-    std::vector<std::complex<double>> lookup_u2_angles(std::vector<double>& u2) {
-        return m.at(u2);
+
+    static bool is_table_file(std::string const& path) {
+        char magic[4] = {};
+        std::ifstream in(path, std::ios::binary);
+        in.read(magic, 4);
+
+        return in && std::memcmp(magic, "APTB", 4) == 0;
+    }
+
+    void write_table(std::string const& path, TableDtype dtype=TableDtype::FLOAT64) const {
+        require_cells("write_table");
+        std::size_t present_bytes = (cell_count + 63) / 64 * sizeof(std::uint64_t);
+        TableHeader header = { {'A', 'P', 'T', 'B'}, table_version, (std::uint16_t) dtype, table_byte_order, (std::uint32_t) count,
+                               lower, lower + (count - 1.0) * step, step, sizeof(TableHeader), sizeof(TableHeader) + present_bytes };
+
+        std::ofstream out(path, std::ios::binary);
+        out.write((const char*) &header, sizeof(header));
+        out.write((const char*) present, present_bytes);
+
+        if (dtype == TableDtype::FLOAT64) {
+            out.write((const char*) cells, cell_count * sizeof(U2Angles));
+        } else {
+            const double* values = reinterpret_cast<const double*>(cells);
+            std::vector<float> narrow(values, values + 6 * cell_count);
+            out.write((const char*) narrow.data(), narrow.size() * sizeof(float));
+        }
+
+        if (!out) {
+            TableError("cannot write " + path);
+        }
+    }
+
+    // One mmap; a float64 file's cells are used where they lie in it
+    void map_table(std::string const& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat st;
+
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            TableError("cannot open " + path);
+        }
+
+        std::size_t file_size = (std::size_t) st.st_size;
+
+        if (file_size < sizeof(TableHeader)) {
+            close(fd);
+            TableError(path + " is not a u22angle table");
+        }
+
+        void* mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+
+        if (mapped == MAP_FAILED) {
+            TableError("cannot map " + path);
+        }
+
+        const char* base = (const char*) mapped;
+        TableHeader header;
+        std::memcpy(&header, base, sizeof(TableHeader));
+
+        std::size_t n = header.count;
+        std::size_t cells_in_file = n * n * n * n;
+        std::size_t present_bytes = (cells_in_file + 63) / 64 * sizeof(std::uint64_t);
+        std::size_t value_size = header.dtype == (std::uint16_t) TableDtype::FLOAT32 ? sizeof(float) : sizeof(double);
+
+        if (std::memcmp(header.magic, "APTB", 4) != 0 || header.version != table_version || header.byte_order != table_byte_order ||
+            (header.dtype != (std::uint16_t) TableDtype::FLOAT64 && header.dtype != (std::uint16_t) TableDtype::FLOAT32) ||
+            n == 0 || n > max_count || header.present_offset % 8 != 0 || header.cells_offset % 8 != 0 ||
+            header.present_offset > file_size || present_bytes > file_size - header.present_offset ||
+            header.cells_offset > file_size || 6 * cells_in_file * value_size > file_size - header.cells_offset) {
+            munmap(mapped, file_size);
+            TableError(path + " is not a u22angle table");
+        }
+
+        if (header.dtype == (std::uint16_t) TableDtype::FLOAT64) {
+            reshape(header.lower, header.step, n);
+            cells = (const U2Angles*) (base + header.cells_offset);
+            present = (const std::uint64_t*) (base + header.present_offset);
+            mapping = mapped;
+            mapping_size = file_size;
+        } else {
+            resize(header.lower, header.step, n);
+            const float* values = (const float*) (base + header.cells_offset);
+            double* widened = reinterpret_cast<double*>(owned_cells.data());
+            for (std::size_t i = 0; i < 6 * cell_count; i++) { widened[i] = values[i]; }
+            std::memcpy(owned_present.data(), base + header.present_offset, present_bytes);
+            munmap(mapped, file_size);
+        }
+
+        complete = size() == cell_count;
+    }
+
+    // A table file or, failing that, the CSV
+    void load(std::string const& path) {
+        if (is_table_file(path)) {
+            map_table(path);
+            return;
+        }
+
+        std::ifstream fin(path);
+
+        if (!fin) {
+            TableError("cannot open " + path);
+        }
+
+        read_u22angle(fin);
+    }
+
+    // the angles at the grid point nearest the four entries of u2, which must have some
+    U2Angles const& lookup(double const* u2) const {
+        require_cells("lookup");
+        std::size_t index = cell(u2);
+
+        if (index == cell_count || !has(index)) {
+            TableError("no angles for u2 (" + std::to_string(u2[0]) + ", " + std::to_string(u2[1]) + ", " + std::to_string(u2[2]) + ", " + std::to_string(u2[3]) + ")");
+        }
+
+        return cells[index];
+    }
+
+    // as lookup, and on a lazy table the angles at the nearest grid point, computed if they
+    // are not cached
+    std::vector<std::complex<double>> lookup_u2_angles(std::vector<double> const& u2) const {
+        if (!cache) { return lookup(u2.data()).to_vector(); }
+
+        std::size_t index = cell(u2.data());
+
+        if (index == cell_count) {
+            TableError("u2 (" + std::to_string(u2[0]) + ", " + std::to_string(u2[1]) + ", " + std::to_string(u2[2]) + ", " + std::to_string(u2[3]) + ") is off the grid");
+        }
+
+        return cache->get(index, [&](std::uint64_t i) { return angles_of(point(i)); }).to_vector();
+    }
+
+    // The angles at any u2 within the grid, blended from the 16 grid points around it (see
+    // interpolation_kernels.cpp). Every one of them must have angles.
+    U2Angles interpolate(double const* u2, bool unwrap=false) const {
+        check_interpolation(u2);
+
+        double result[6];
+        interpolate_point(grid(), u2, unwrap, result);
+        return {{result[0], result[1]}, {result[2], result[3]}, {result[4], result[5]}};
+    }
+
+    // theta[i], alpha[i] and beta[i] interpolated at (u2[0][i], .., u2[3][i]) for i < n, on
+    // the SIMD kernels; the three vectors must hold n entries
+    void interpolate(const double* const u2[4], std::size_t n, ComplexVector& theta, ComplexVector& alpha, ComplexVector& beta, bool unwrap=false) const {
+        if (theta.size() != n || alpha.size() != n || beta.size() != n) {
+            TableError("interpolating " + std::to_string(n) + " u2 into vectors of " + std::to_string(theta.size()) + ", " + std::to_string(alpha.size()) + " and " + std::to_string(beta.size()));
+        }
+
+        for (std::size_t i = 0; i < n; i++) {
+            double u[4] = {u2[0][i], u2[1][i], u2[2][i], u2[3][i]};
+            check_interpolation(u);
+        }
+
+        static InterpolationKernel const kernel = interpolation_kernel(complex_kernels().isa);
+        double* const out[6] = {theta.real(), theta.imag(), alpha.real(), alpha.imag(), beta.real(), beta.imag()};
+        kernel(grid(), u2, n, unwrap, out);
+    }
+
+    // The Jacobian of the angles at u2: six rows, the real and imaginary parts of theta,
+    // alpha and beta, by four columns, u11, u21, u12 and u22. It is analytic (see
+    // angle_kernels.cpp), so it needs no cells and is exact off the grid.
+    static std::vector<std::vector<double>> J_u22u4(std::vector<double> const& u2) {
+        double result[12];
+        jacobian_point(u2.data(), result);
+
+        std::vector<std::vector<double>> J(6, std::vector<double>(4, 0.0));
+        int columns[6] = {0, 2, 0, 2, 1, 3};
+
+        for (int c = 0; c < 6; c++) {
+            J[c / 2 * 2][columns[c]] = result[2 * c];
+            J[c / 2 * 2 + 1][columns[c]] = result[2 * c + 1];
+        }
+
+        return J;
+    }
+
+    // The Jacobian at (u2[0][i], .., u2[3][i]) for i < n in one pass of the SIMD kernels;
+    // every vector of J must hold n entries
+    static void J_u22u4(const double* const u2[4], std::size_t n, AngleJacobian& J) {
+        ComplexVector* columns[6] = {&J.theta_u11, &J.theta_u12, &J.alpha_u11, &J.alpha_u12, &J.beta_u21, &J.beta_u22};
+
+        for (ComplexVector* column : columns) {
+            if (column->size() != n) {
+                TableError("a Jacobian of " + std::to_string(n) + " u2 into vectors of " + std::to_string(column->size()));
+            }
+        }
+
+        static JacobianKernel const kernel = jacobian_kernel(complex_kernels().isa);
+        double* const out[12] = {J.theta_u11.real(), J.theta_u11.imag(), J.theta_u12.real(), J.theta_u12.imag(), J.alpha_u11.real(), J.alpha_u11.imag(),
+                                 J.alpha_u12.real(), J.alpha_u12.imag(), J.beta_u21.real(), J.beta_u21.imag(), J.beta_u22.real(), J.beta_u22.imag()};
+        kernel(u2, n, out);
     }
-    
-//    std::vector<std::vector<double>> J_u22u4() {
-//
-//    }
 };
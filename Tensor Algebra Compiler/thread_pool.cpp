@@ -0,0 +1,112 @@
+//
+//  thread_pool.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+ A fixed set of worker threads for data-parallel loops. parallel_for(n, f) runs f(0) ..
+ f(n - 1) on the workers and the calling thread, handing out iterations one at a time
+ from a shared counter so that uneven iterations balance, and returns once all have
+ finished. Calls from several threads take turns; f must not call parallel_for itself.
+ */
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::mutex turn;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    std::function<void(std::size_t)> const* job = nullptr;
+    std::size_t job_size = 0;
+    std::atomic<std::size_t> next{0};
+    std::size_t busy = 0;
+    std::uint64_t generation = 0;
+    bool stopping = false;
+
+    void run() {
+        for (std::size_t i = next++; i < job_size; i = next++) { (*job)(i); }
+    }
+
+    void work() {
+        std::uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+
+        while (true) {
+            wake.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping) { return; }
+
+            seen = generation;
+            lock.unlock();
+            run();
+            lock.lock();
+
+            if (--busy == 0) { done.notify_all(); }
+        }
+    }
+public:
+    // threads counts the caller, so ThreadPool(1) runs everything on the calling thread
+    ThreadPool(std::size_t threads) {
+        for (std::size_t t = 1; t < threads; t++) {
+            workers.emplace_back([this]() { work(); });
+        }
+    }
+
+    ThreadPool(ThreadPool const&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        wake.notify_all();
+        for (std::thread& worker : workers) { worker.join(); }
+    }
+
+    std::size_t size() const {
+        return workers.size() + 1;
+    }
+
+    void parallel_for(std::size_t n, std::function<void(std::size_t)> const& f) {
+        std::lock_guard<std::mutex> own_turn(turn);
+
+        if (workers.empty() || n < 2) {
+            for (std::size_t i = 0; i < n; i++) { f(i); }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &f;
+            job_size = n;
+            next = 0;
+            busy = workers.size();
+            generation++;
+        }
+
+        wake.notify_all();
+        run();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]() { return busy == 0; });
+        job = nullptr;
+    }
+};
+
+// one pool for the process, with a thread per hardware thread
+ThreadPool& thread_pool() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
@@ -4,149 +4,163 @@
 //
 //
 
-#include <regex>
 #include <fstream>
 #include <unordered_map>
 #include <iostream>
+#include <string_view>
 #include "keyword.cpp"
 #include "node.cpp"
+#include "char_class.cpp"
+#include "lexeme.cpp"
+#include "source_buffer.cpp"
 
 class Tokenizer {
 private:
-    std::regex const keywords = std::regex("let|int|float|tensor");
-    std::regex const symbols = std::regex("[!@'{}().,;+*-/^%=~]|[[\\]]");
+    enum class LexState : unsigned char {
+        START,
+        COMMENT,
+        IDENT,
+        INT,
+        INT_DOT,
+        DOT,
+        FLOAT,
+        SYMBOL,
+        DONE,
+        ERROR
+    };
+
+    using S = LexState;
+
+    // transitions[state][char class]; DONE stops before the current char, ERROR is a lexical error at it
+    static constexpr LexState transitions[8][NUM_CHAR_CLASSES] = {
+        /*            SPACE       NEWLINE     DIGIT       DOT         ALPHA       SYMBOL      HASH        OTHER       END     */
+        /* START   */ {S::START,   S::START,   S::INT,     S::DOT,     S::IDENT,   S::SYMBOL,  S::COMMENT, S::ERROR,   S::DONE},
+        /* COMMENT */ {S::COMMENT, S::START,   S::COMMENT, S::COMMENT, S::COMMENT, S::COMMENT, S::COMMENT, S::COMMENT, S::DONE},
+        /* IDENT   */ {S::DONE,    S::DONE,    S::IDENT,   S::DONE,    S::IDENT,   S::DONE,    S::DONE,    S::DONE,    S::DONE},
+        /* INT     */ {S::DONE,    S::DONE,    S::INT,     S::INT_DOT, S::ERROR,   S::DONE,    S::DONE,    S::DONE,    S::DONE},
+        /* INT_DOT */ {S::DONE,    S::DONE,    S::FLOAT,   S::DONE,    S::ERROR,   S::DONE,    S::DONE,    S::DONE,    S::DONE},
+        /* DOT     */ {S::DONE,    S::DONE,    S::FLOAT,   S::DONE,    S::DONE,    S::DONE,    S::DONE,    S::DONE,    S::DONE},
+        /* FLOAT   */ {S::DONE,    S::DONE,    S::FLOAT,   S::DONE,    S::ERROR,   S::DONE,    S::DONE,    S::DONE,    S::DONE},
+        /* SYMBOL  */ {S::DONE,    S::DONE,    S::DONE,    S::DONE,    S::DONE,    S::DONE,    S::DONE,    S::DONE,    S::DONE}
+    };
+
+    static constexpr std::string_view keywords[] = { "let", "int", "float", "tensor" };
+    static constexpr Keyword keyword_values[] = { Keyword::LET, Keyword::INT, Keyword::FLOAT, Keyword::TENSOR };
+
     std::unordered_map<TokenType, std::string> const type_to_string = { {TokenType::T_KEYWORD, "t_keyword"}, {TokenType::T_SYMBOL, "t_symbol"}, {TokenType::T_IDENTIFIER, "t_identifier"}, {TokenType::T_INT, "t_int"}, {TokenType::T_FLOAT, "t_float"}, {TokenType::T_NONE, "t_none"} };
-    std::unordered_map<std::string, Keyword> const string_to_keyword = { {"let", Keyword::LET}, {"int", Keyword::INT}, {"float", Keyword::FLOAT}, {"tensor", Keyword::TENSOR} };
     std::unordered_map<std::string, std::string> const altered_symbols = { {"<", "&lt"}, {">", "&gt"}, {"\"", "&quot"}, {"&", "&amp"} };
-    
-    std::string content;
-    int current_index;
-    std::string current_char;
-    std::string current_token;
+
+    std::unique_ptr<SourceBuffer> source;
+    std::size_t position;
+    Lexeme current;
+
+    static TokenType accepted_type(LexState state, std::string_view text) {
+        switch (state) {
+            case LexState::IDENT:
+                for (std::string_view keyword : keywords) {
+                    if (text == keyword) { return TokenType::T_KEYWORD; }
+                }
+
+                return TokenType::T_IDENTIFIER;
+            case LexState::INT:
+                return TokenType::T_INT;
+            case LexState::FLOAT:
+                return TokenType::T_FLOAT;
+            case LexState::DOT:
+            case LexState::SYMBOL:
+                return TokenType::T_SYMBOL;
+            default:
+                return TokenType::T_NONE;
+        }
+    }
 public:
     Tokenizer(std::string ifname) {
-        std::ifstream in(ifname);
-        content = std::string((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
-        current_index = -1;
-        current_char = "";
-        current_token = "";
-        advance();        
+        source = SourceBuffer::open(ifname);
+        position = 0;
+        advance();
     }
-    
+
     bool has_more_tokens() {
-        return current_index == -1 || current_index <= content.size();
-    };
-    
-    void next_char() {
-        current_index++;
-        
-        if (current_index < content.size()) {
-            current_char = {content[current_index]};
-        }
+        return !current.empty();
     };
-    
+
     void advance() {
-        current_token = "";
-        
-        while (has_more_tokens()) {            
-            if (current_char == "" || isspace(current_char[0])) {
-                if (current_token != "") { break; }
-                
-                next_char();
-            } else if (current_char == "#") {
-                do {
-                    next_char();
-                } while (current_char != "\n" && current_char != "\r");
-            } else if (regex_match(current_char, std::regex("\\.|[0-9]"))) {
-                if (!regex_match(current_token, std::regex("\\d*\\.?\\d*"))) {
-                    if (current_token != "" && regex_match(std::string(1, current_token[0]), std::regex("[0-9]"))) {
-                        if (regex_match(current_char, std::regex("[a-zA-Z_]"))) { break; }
-                    }
-                                    
-                    current_token += current_char;
-                    next_char();
-                } else {
-                    if (current_char == "." && current_token.find(".") != std::string::npos) { break; }
-                    
-                    current_token += current_char;
-                    next_char();
-                }
-            } else if (regex_match(current_char, symbols)) {
-                if (current_token != "") { break; }
-                
-                current_token += current_char;
-                next_char();
-                break;
-            } else if (regex_match(current_char, std::regex("[a-zA-Z0-9_]"))) {
-                if (current_token == ".") { break; }
-                if (current_token != "" && regex_match(std::string(1, current_token[0]), std::regex("[0-9]"))) {
-                    if (regex_match(current_char, std::regex("[a-zA-Z_]"))) {
-                        LexicalError(-1);
-                    }
-                }
-                                
-                current_token += current_char;
-                next_char();
-            } else {
-                break;
+        LexState state = LexState::START;
+        std::size_t start = position;
+
+        source->consume(source->base() + start);
+
+        while (true) {
+            if (position == source->size()) {
+                std::size_t base = source->base();
+                source->refill(start);
+                position -= source->base() - base;
+                start -= source->base() - base;
             }
+
+            CharClass c = position < source->size() ? char_classes[(unsigned char) source->data()[position]] : CharClass::END;
+            LexState next = transitions[(int) state][(int) c];
+
+            if (next == LexState::DONE) { break; }
+            if (next == LexState::ERROR) { LexicalError((int) (source->base() + position)); }
+
+            position++;
+            state = next;
+
+            if (state == LexState::START || state == LexState::COMMENT) { start = position; }
         }
+
+        std::string_view text = std::string_view(source->data() + start, position - start);
+        current = Lexeme(text, accepted_type(state, text), source->base() + start);
     };
-    
+
     TokenType token_type() {
-        if (regex_match(current_token, symbols)) {
-            return TokenType::T_SYMBOL;
-        } else if (regex_match(current_token, std::regex("[a-zA-Z_][a-zA-Z0-9_]*"))) {
-//            cout << current_token << endl;
-            
-            if (regex_match(current_token, keywords)) {
-                return TokenType::T_KEYWORD;
-            } else {
-                return TokenType::T_IDENTIFIER;
-            }
-        } else if (regex_match(current_token, std::regex("\\d*\\.\\d+"))) {
-            return TokenType::T_FLOAT;
-        } else if (regex_match(current_token, std::regex("[0-9]+"))) {
-            return TokenType::T_INT;
-        }
-        
-        return TokenType::T_NONE;
+        return current.get_type();
     };
-    
+
     Keyword keyword() {
-        return string_to_keyword.at(current_token);
+        for (int i = 0; i < 4; i++) {
+            if (current.get_text() == keywords[i]) { return keyword_values[i]; }
+        }
+
+        LexicalError((int) current.get_offset());
+        return Keyword::LET;
     };
 
     char symbol() {
-        return current_token[0];
+        return current.get_text()[0];
     };
 
     std::string identifier() {
-        return current_token;
+        return std::string(current.get_text());
     };
 
     int int_val() {
-        return stoi(current_token);
+        return stoi(std::string(current.get_text()));
     };
-    
+
     float float_val() {
-        return stof(current_token);
+        return stof(std::string(current.get_text()));
     }
-    
+
     Token get_current_token_obj() {
-        return Token(current_token, token_type());
+        return Token(std::string(current.get_text()), token_type());
     }
-    
+
     std::string get_current_token() {
-        return current_token;
+        return std::string(current.get_text());
     }
-    
+
+    Lexeme const& get_current_lexeme() {
+        return current;
+    }
+
     std::string get_current_token_repr() {
         std::string t_type = type_to_string.at(token_type());
-        
-        return "<" + t_type + "> " + current_token + " </" + t_type + ">";
+
+        return "<" + t_type + "> " + get_current_token() + " </" + t_type + ">";
     };
-    
+
     std::unordered_map<std::string, std::string> get_altered_symbols() {
         return altered_symbols;
     }
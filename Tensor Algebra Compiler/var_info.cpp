@@ -6,19 +6,26 @@
 
 #include <stdio.h>
 #include <string>
+#include <vector>
 
 #include "var_kind.cpp"
 
+class TensorNode;
+
 class VarInfo {
 private:
     std::string type;
     VarKind kind;
     int index;
+    std::vector<int> shape;
+    TensorNode* constant;
 public:
-    VarInfo(std::string type, VarKind kind, int index) {
+    VarInfo(std::string type, VarKind kind, int index, std::vector<int> shape={}) {
         this->type = type;
         this->kind = kind;
         this->index = index;
+        this->shape = shape;
+        constant = nullptr;
     }
     
     std::string get_type() {
@@ -33,4 +40,22 @@ public:
         return index;
     }
     
+    // dimensions, outermost first; empty for scalars
+    std::vector<int> const& get_shape() {
+        return shape;
+    }
+    
+    void set_shape(std::vector<int> shape) {
+        this->shape = shape;
+    }
+    
+    // the folded value, when the variable was declared with a constant expression
+    TensorNode* get_constant() {
+        return constant;
+    }
+    
+    void set_constant(TensorNode* constant) {
+        this->constant = constant;
+    }
+    
 };
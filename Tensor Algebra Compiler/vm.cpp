@@ -0,0 +1,189 @@
+//
+//  vm.cpp
+//  Tensor Algebra Compiler
+//
+//
+
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+/*
+ Runs a bytecode Program: a flat array of 8-byte Instructions plus a constant pool, either
+ mapped straight from an .irb file or decoded once from text. The loop dispatches with
+ computed goto (a switch where that is not available).
+
+ Every value is a double, heap addresses included. Memory.alloc hands out zero-filled
+ blocks from a bump heap; address 0 is never handed out. pointer 0 / pointer 1 hold the
+ bases that this / that index into.
+ */
+class VM {
+private:
+    Program program;
+
+    std::vector<double> stack, local, argument, statics, temp, heap;
+    double pointer[2];
+    std::size_t heap_top;
+    std::size_t executed;
+
+    std::size_t alloc(double size) {
+        if (!(size >= 0)) {
+            RuntimeError(-1);
+        }
+
+        std::size_t n = (std::size_t) size;
+        std::size_t address = heap_top;
+
+        heap_top += n;
+
+        if (heap_top > heap.size()) {
+            heap.resize(std::max(heap_top, heap.size() * 2));
+        }
+
+        std::fill(heap.begin() + address, heap.begin() + heap_top, 0.0);
+
+        return address;
+    }
+
+    static double* heap_at(double* mem, std::size_t limit, std::size_t address) {
+        if (address == 0 || address >= limit) {
+            RuntimeError(-1);
+        }
+
+        return mem + address;
+    }
+public:
+    VM() {
+        reset();
+    }
+
+    void load(Program&& program) {
+        this->program = std::move(program);
+
+        SegmentTable const& segments = this->program.get_segments();
+        stack = std::vector<double>(segments.stack);
+        local = std::vector<double>(segments.local);
+        argument = std::vector<double>(segments.argument);
+        statics = std::vector<double>(segments.statics);
+        temp = std::vector<double>(segments.temp);
+        reset();
+    }
+
+    // .irb bytecode or .ir text
+    void load_file(std::string ifname) {
+        load(Program::load_file(ifname));
+    }
+
+    // Clears every segment and the heap; the loaded program stays
+    void reset() {
+        std::fill(local.begin(), local.end(), 0.0);
+        std::fill(argument.begin(), argument.end(), 0.0);
+        std::fill(statics.begin(), statics.end(), 0.0);
+        std::fill(temp.begin(), temp.end(), 0.0);
+        pointer[0] = pointer[1] = 0;
+        heap_top = 1;
+        executed = 0;
+    }
+
+    void run() {
+        const Instruction* ip = program.get_code();
+        const double* pool = program.get_constants();
+        double* sp = stack.data();
+        double* lcl = local.data();
+        double* arg = argument.data();
+        double* stat = statics.data();
+        double* tmp = temp.data();
+        double* mem = heap.data();
+        std::size_t limit = heap_top;
+
+#define VM_HEAP(base) (*heap_at(mem, limit, (std::size_t) pointer[base] + ip->operand))
+
+#if VM_COMPUTED_GOTO
+        static void* const handlers[NUM_OPCODES] = {
+            &&L_PUSH_CONSTANT, &&L_PUSH_LOCAL, &&L_PUSH_ARGUMENT, &&L_PUSH_STATIC, &&L_PUSH_THIS, &&L_PUSH_THAT, &&L_PUSH_POINTER, &&L_PUSH_TEMP,
+            &&L_POP_LOCAL, &&L_POP_ARGUMENT, &&L_POP_STATIC, &&L_POP_THIS, &&L_POP_THAT, &&L_POP_POINTER, &&L_POP_TEMP,
+            &&L_FADD, &&L_FSUB, &&L_FMULT, &&L_FDIV, &&L_FNEG, &&L_ALLOC, &&L_HALT
+        };
+#define VM_CASE(name) L_##name:
+#define VM_NEXT() goto *handlers[(int) (++ip)->op]
+        goto *handlers[(int) ip->op];
+#else
+#define VM_CASE(name) case Opcode::name:
+#define VM_NEXT() ip++; continue
+        while (true) {
+            switch (ip->op) {
+#endif
+        VM_CASE(PUSH_CONSTANT) *sp++ = pool[ip->operand]; VM_NEXT();
+        VM_CASE(PUSH_LOCAL) *sp++ = lcl[ip->operand]; VM_NEXT();
+        VM_CASE(PUSH_ARGUMENT) *sp++ = arg[ip->operand]; VM_NEXT();
+        VM_CASE(PUSH_STATIC) *sp++ = stat[ip->operand]; VM_NEXT();
+        VM_CASE(PUSH_THIS) *sp++ = VM_HEAP(0); VM_NEXT();
+        VM_CASE(PUSH_THAT) *sp++ = VM_HEAP(1); VM_NEXT();
+        VM_CASE(PUSH_POINTER) *sp++ = pointer[ip->operand]; VM_NEXT();
+        VM_CASE(PUSH_TEMP) *sp++ = tmp[ip->operand]; VM_NEXT();
+        VM_CASE(POP_LOCAL) lcl[ip->operand] = *--sp; VM_NEXT();
+        VM_CASE(POP_ARGUMENT) arg[ip->operand] = *--sp; VM_NEXT();
+        VM_CASE(POP_STATIC) stat[ip->operand] = *--sp; VM_NEXT();
+        VM_CASE(POP_THIS) VM_HEAP(0) = *--sp; VM_NEXT();
+        VM_CASE(POP_THAT) VM_HEAP(1) = *--sp; VM_NEXT();
+        VM_CASE(POP_POINTER) pointer[ip->operand] = *--sp; VM_NEXT();
+        VM_CASE(POP_TEMP) tmp[ip->operand] = *--sp; VM_NEXT();
+        VM_CASE(FADD) sp--; sp[-1] += sp[0]; VM_NEXT();
+        VM_CASE(FSUB) sp--; sp[-1] -= sp[0]; VM_NEXT();
+        VM_CASE(FMULT) sp--; sp[-1] *= sp[0]; VM_NEXT();
+        VM_CASE(FDIV) sp--; sp[-1] /= sp[0]; VM_NEXT();
+        VM_CASE(FNEG) sp[-1] = -sp[-1]; VM_NEXT();
+        VM_CASE(ALLOC)
+            heap_top = limit;
+            sp[-1] = (double) alloc(sp[-1]);
+            mem = heap.data();
+            limit = heap_top;
+            VM_NEXT();
+        VM_CASE(HALT) goto halt;
+#if !VM_COMPUTED_GOTO
+            }
+        }
+#endif
+    halt:
+        heap_top = limit;
+        executed += (std::size_t) (ip - program.get_code());
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_HEAP
+    }
+
+    std::size_t program_size() {
+        return program.get_code_size() - 1;
+    }
+
+    std::size_t instructions_executed() {
+        return executed;
+    }
+
+    std::vector<double> const& get_locals() {
+        return local;
+    }
+
+    std::vector<double> const& get_statics() {
+        return statics;
+    }
+
+    // count words of heap starting at address, as the program left them
+    std::vector<double> read_heap(std::size_t address, std::size_t count) {
+        if (address == 0 || address + count > heap_top) {
+            RuntimeError(-1);
+        }
+
+        return std::vector<double>(heap.begin() + address, heap.begin() + address + count);
+    }
+};
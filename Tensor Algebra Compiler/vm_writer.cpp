@@ -7,26 +7,47 @@
 #include <stdio.h>
 #include <fstream>
 
+#include "bytecode.cpp"
+
+// Encodes the code generator's output straight to bytecode; text is a disassembly of it
 class VMWriter {
+private:
+    BytecodeBuilder builder;
+
+    static VirtualSegment segment_of(std::string segment) {
+        if (name_to_segment.find(segment) == name_to_segment.end()) {
+            LogicalError(-1);
+        }
+
+        return name_to_segment.at(segment);
+    }
 public:
-    static void write_newline(std::ofstream& out) {
-        out << std::endl;
+    void write_push(std::string segment, double n) {
+        builder.push(segment_of(segment), n);
+    }
+    
+    void write_pop(std::string segment, int n) {
+        builder.pop(segment_of(segment), (std::uint32_t) n);
     }
     
-    static void write_push(std::ofstream& out, std::string segment, double n) {
-        out << "push " << segment << " " << n << std::endl;
+    void write_arithmetic(std::string command) {
+        builder.op(name_to_arithmetic.at(command));
     }
     
-    static void write_pop(std::ofstream& out, std::string segment, int n) {
-        out << "pop " << segment << " " << n << std::endl;
+    void write_malloc(std::size_t size) {
+        write_push("constant", size);
+        write_call("Memory.alloc", 1);
     }
     
-    static void write_malloc(std::ofstream& out, std::size_t size) {
-        write_push(out, "constant", size);
-        write_call(out, "Memory.alloc", 1);
+    void write_call(std::string func_name, int n_args) {
+        if (func_name != "Memory.alloc" || n_args != 1) {
+            LogicalError(-1);
+        }
+        
+        builder.op(Opcode::ALLOC);
     }
     
-    static void write_call(std::ofstream& out, std::string func_name, int n_args) {
-        out << "call " << func_name << " " << n_args << std::endl;
+    Program finish() {
+        return builder.finish();
     }
 };